@@ -182,6 +182,19 @@ public:
     items_[section + '/' + key] = value;
   }
 
+  //! returns all key/value pairs of a section, the keys without the section name
+  /*! @param section the section name
+   *  @return map of key name to value
+   */
+  std::map<std::string, std::string> get_section(std::string const &section) const {
+    std::map<std::string, std::string> out;
+    std::string prefix = section + '/';
+    for (auto i = items_.lower_bound(prefix);
+         i != items_.end() && i->first.compare(0, prefix.size(), prefix) == 0; ++i)
+      out[i->first.substr(prefix.size())] = i->second;
+    return out;
+  }
+
   //! checks if a key is part of the hash map
   /*! @param section the section name of the key
    *  @param key the key name to be checked
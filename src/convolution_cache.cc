@@ -0,0 +1,317 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <convolution_cache.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+bool convolution_cache::benabled_ = false;
+size_t convolution_cache::budget_ = 0;
+size_t convolution_cache::used_ = 0;
+std::string convolution_cache::cache_dir_ = ".";
+std::map<std::string, convolution_cache::entry> convolution_cache::entries_;
+size_t convolution_cache::nhits_ = 0;
+size_t convolution_cache::nmisses_ = 0;
+
+std::string convolution_cache::key(config_file &cf, tf_type type, bool shift, bool fix, bool flip)
+{
+	std::stringstream ss;
+	ss << (int)type << "|" << shift << fix << flip;
+
+	//... everything that enters the base level convolution
+	for (auto &section : {"cosmology", "random"})
+		for (auto &kv : cf.get_section(section))
+			ss << "|" << section << "/" << kv.first << "=" << kv.second;
+
+	for (auto &k : {"boxlength", "zstart", "levelmin", "levelmin_TF", "levelmax", "baryons", "baryon_staggering", "force_pnorm"})
+		ss << "|" << k << "=" << cf.get_value_safe<std::string>("setup", k, "");
+
+	return ss.str();
+}
+
+void convolution_cache::get_roll(config_file &cf, int roll[3])
+{
+	unsigned levelmin = cf.get_value<unsigned>("setup", "levelmin");
+	unsigned levelmin_TF = cf.get_value_safe<unsigned>("setup", "levelmin_TF", levelmin);
+	int lfac = 1 << (levelmin_TF - levelmin);
+
+	roll[0] = lfac * cf.get_value<int>("setup", "shift_x");
+	roll[1] = lfac * cf.get_value<int>("setup", "shift_y");
+	roll[2] = lfac * cf.get_value<int>("setup", "shift_z");
+}
+
+void convolution_cache::enable(config_file &cf)
+{
+	benabled_ = true;
+	budget_ = (size_t)(cf.get_value_safe<double>("batch", "cache_memory", 2048.0) * 1024.0 * 1024.0);
+	cache_dir_ = cf.get_value_safe<std::string>("batch", "cache_dir", ".");
+	music::ilog.Print("- Caching convolved base levels for the batch, %.0f MB in memory", budget_ / 1048576.0);
+}
+
+bool convolution_cache::fetch(config_file &cf, tf_type type, bool shift, bool fix, bool flip, DensityGrid<real_t> &top)
+{
+	if (!benabled_)
+		return false;
+
+	auto it = entries_.find(key(cf, type, shift, fix, flip));
+	if (it == entries_.end())
+	{
+		++nmisses_;
+		return false;
+	}
+
+	const size_t nx = top.size(0), ny = top.size(1), nz = top.size(2);
+	std::vector<real_t> spilled;
+	const std::vector<real_t> *pdata = &it->second.data;
+
+	if (pdata->empty())
+	{
+		spilled.resize(nx * ny * nz);
+		std::ifstream ifs(it->second.spill_file.c_str(), std::ios::binary);
+		ifs.read(reinterpret_cast<char *>(&spilled[0]), spilled.size() * sizeof(real_t));
+		if (!ifs.good())
+			throw std::runtime_error("Could not read convolution cache file " + it->second.spill_file);
+		pdata = &spilled;
+	}
+
+	if (pdata->size() != nx * ny * nz)
+		throw std::runtime_error("Internal consistency error in convolution cache");
+
+	int roll[3];
+	get_roll(cf, roll);
+
+#pragma omp parallel for
+	for (int i = 0; i < (int)nx; ++i)
+	{
+		size_t ii = ((i - roll[0]) % (int)nx + nx) % nx;
+		for (size_t j = 0; j < ny; ++j)
+		{
+			size_t jj = (((int)j - roll[1]) % (int)ny + ny) % ny;
+			for (size_t k = 0; k < nz; ++k)
+			{
+				size_t kk = (((int)k - roll[2]) % (int)nz + nz) % nz;
+				top(i, j, k) = (*pdata)[(ii * ny + jj) * nz + kk];
+			}
+		}
+	}
+
+	++nhits_;
+	music::ilog.Print("- Reusing convolved base level from the batch cache (%zu hits, %zu misses)", nhits_, nmisses_);
+	return true;
+}
+
+void convolution_cache::store(config_file &cf, tf_type type, bool shift, bool fix, bool flip, const DensityGrid<real_t> &top)
+{
+	if (!benabled_)
+		return;
+
+	const size_t nx = top.size(0), ny = top.size(1), nz = top.size(2);
+	int roll[3];
+	get_roll(cf, roll);
+
+	entry &e = entries_[key(cf, type, shift, fix, flip)];
+	std::vector<real_t> data(nx * ny * nz);
+
+#pragma omp parallel for
+	for (int i = 0; i < (int)nx; ++i)
+	{
+		size_t ii = ((i + roll[0]) % (int)nx + nx) % nx;
+		for (size_t j = 0; j < ny; ++j)
+		{
+			size_t jj = (((int)j + roll[1]) % (int)ny + ny) % ny;
+			for (size_t k = 0; k < nz; ++k)
+			{
+				size_t kk = (((int)k + roll[2]) % (int)nz + nz) % nz;
+				data[((size_t)i * ny + j) * nz + k] = top(ii, jj, kk);
+			}
+		}
+	}
+
+	size_t nbytes = data.size() * sizeof(real_t);
+	if (used_ + nbytes <= budget_)
+	{
+		e.data.swap(data);
+		used_ += nbytes;
+		return;
+	}
+
+	//... over the memory budget, keep it on disk
+	char fname[512];
+	snprintf(fname, 512, "%s/___ic_basecache_%d_%zu.bin", cache_dir_.c_str(), (int)getpid(), entries_.size());
+	e.spill_file = fname;
+
+	std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+	ofs.write(reinterpret_cast<const char *>(&data[0]), nbytes);
+	if (!ofs.good())
+		throw std::runtime_error(std::string("Could not write convolution cache file ") + fname);
+
+	music::ilog.Print("- Batch cache memory budget exhausted, base level kept in \'%s\'", fname);
+}
+
+std::string convolution_cache::level_key(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip, unsigned ilevel)
+{
+	std::stringstream ss;
+	ss << key(cf, type, shift, fix, flip) << "|real=" << sizeof(real_t);
+	ss << "|shift=" << cf.get_value<int>("setup", "shift_x") << "," << cf.get_value<int>("setup", "shift_y") << "," << cf.get_value<int>("setup", "shift_z");
+
+	unsigned levelmin = cf.get_value<unsigned>("setup", "levelmin");
+	unsigned levelmin_TF = cf.get_value_safe<unsigned>("setup", "levelmin_TF", levelmin);
+	for (unsigned l = levelmin_TF + 1; l <= ilevel; ++l)
+		ss << "|L" << l << ":" << refh.offset_abs(l, 0) << "," << refh.offset_abs(l, 1) << "," << refh.offset_abs(l, 2)
+			 << "," << refh.size(l, 0) << "," << refh.size(l, 1) << "," << refh.size(l, 2) << "," << refh.get_margin(l);
+
+	return ss.str();
+}
+
+std::string convolution_cache::level_filename(config_file &cf, const std::string &lkey, unsigned ilevel)
+{
+	std::string dir = cf.get_value_safe<std::string>("setup", "density_cache", "");
+	if (dir.empty())
+		return dir;
+
+	//... FNV-1a, stable between runs and compilers
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : lkey)
+	{
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ull;
+	}
+
+	char fname[64];
+	snprintf(fname, 64, "/music_L%02u_%016llx.bin", ilevel, (unsigned long long)hash);
+	return dir + fname;
+}
+
+bool convolution_cache::load_level(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip,
+																	 unsigned ilevel, DensityGrid<real_t> &grid)
+{
+	std::string lkey = level_key(cf, refh, type, shift, fix, flip, ilevel);
+	std::string fname = level_filename(cf, lkey, ilevel);
+	if (fname.empty())
+		return false;
+
+	std::ifstream ifs(fname.c_str(), std::ios::binary);
+	if (!ifs.good())
+		return false;
+
+	//... the full key is stored, a hash collision or a stale file is not used
+	char magic[8];
+	uint64_t keylen = 0, n[3];
+	ifs.read(magic, 8);
+	ifs.read(reinterpret_cast<char *>(&keylen), sizeof(uint64_t));
+	std::string fkey(keylen < (1ull << 20) ? keylen : 0, ' ');
+	ifs.read(&fkey[0], fkey.size());
+	ifs.read(reinterpret_cast<char *>(n), 3 * sizeof(uint64_t));
+
+	if (!ifs.good() || memcmp(magic, "MUSICLVL", 8) != 0 || fkey != lkey ||
+			n[0] != grid.size(0) || n[1] != grid.size(1) || n[2] != grid.size(2))
+	{
+		music::wlog.Print("Ignoring stale density cache file '%s'", fname.c_str());
+		return false;
+	}
+
+	std::vector<real_t> slab(n[1] * n[2]);
+	for (size_t i = 0; i < n[0]; ++i)
+	{
+		ifs.read(reinterpret_cast<char *>(&slab[0]), slab.size() * sizeof(real_t));
+		if (!ifs.good())
+		{
+			music::wlog.Print("Ignoring truncated density cache file '%s'", fname.c_str());
+			return false;
+		}
+		for (size_t j = 0; j < n[1]; ++j)
+			for (size_t k = 0; k < n[2]; ++k)
+				grid(i, j, k) = slab[j * n[2] + k];
+	}
+
+	music::ilog.Print("- Read convolved level %d from density cache '%s'", ilevel, fname.c_str());
+	return true;
+}
+
+void convolution_cache::store_level(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip,
+																		unsigned ilevel, const DensityGrid<real_t> &grid)
+{
+	std::string lkey = level_key(cf, refh, type, shift, fix, flip, ilevel);
+	std::string fname = level_filename(cf, lkey, ilevel);
+	if (fname.empty() || std::ifstream(fname.c_str()).good())
+		return;
+
+	//... write to a unique temporary name in the same directory first, so that neither an interrupted run
+	//... nor another run storing the same level at the same time leaves a partial or mixed file
+	std::vector<char> tmpl(fname.begin(), fname.end());
+	const char suffix[] = ".part.XXXXXX";
+	tmpl.insert(tmpl.end(), suffix, suffix + sizeof(suffix));
+	int fd = mkstemp(&tmpl[0]);
+	if (fd < 0)
+	{
+		music::wlog.Print("Could not write density cache file '%s': %s", fname.c_str(), strerror(errno));
+		return;
+	}
+	fchmod(fd, 0644);
+	close(fd);
+
+	std::string ftmp(&tmpl[0]);
+	std::ofstream ofs(ftmp.c_str(), std::ios::binary | std::ios::trunc);
+
+	uint64_t keylen = lkey.size(), n[3] = {grid.size(0), grid.size(1), grid.size(2)};
+	ofs.write("MUSICLVL", 8);
+	ofs.write(reinterpret_cast<const char *>(&keylen), sizeof(uint64_t));
+	ofs.write(lkey.data(), keylen);
+	ofs.write(reinterpret_cast<const char *>(n), 3 * sizeof(uint64_t));
+
+	std::vector<real_t> slab(n[1] * n[2]);
+	for (size_t i = 0; i < n[0]; ++i)
+	{
+		for (size_t j = 0; j < n[1]; ++j)
+			for (size_t k = 0; k < n[2]; ++k)
+				slab[j * n[2] + k] = grid(i, j, k);
+		ofs.write(reinterpret_cast<const char *>(&slab[0]), slab.size() * sizeof(real_t));
+	}
+	ofs.close();
+
+	if (!ofs.good() || rename(ftmp.c_str(), fname.c_str()) != 0)
+	{
+		remove(ftmp.c_str());
+		music::wlog.Print("Could not write density cache file '%s'", fname.c_str());
+	}
+}
+
+void convolution_cache::clear(void)
+{
+	for (auto &e : entries_)
+		if (!e.second.spill_file.empty())
+			remove(e.second.spill_file.c_str());
+
+	entries_.clear();
+	used_ = 0;
+}
+
+} // namespace music
@@ -0,0 +1,98 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <general.hh>
+#include <config_file.hh>
+#include <densities.hh>
+#include <density_grid.hh>
+#include <transfer_function.hh>
+
+namespace music
+{
+
+/*!
+ * @class convolution_cache
+ * @brief keeps the convolved base level of every transfer function across the targets of a batch run
+ *
+ * All targets of a batch ([batch] targets) share the periodic base level, only the
+ * coordinate shift that centres the zoom region differs. Since the shift is a periodic
+ * roll of the base grid, the convolved base level is stored unshifted and rolled into
+ * place for every target. Entries are kept in memory up to [batch] cache_memory (in MB),
+ * further entries go to files in [batch] cache_dir. An entry is only reused if the
+ * cosmology, the random numbers and the base grid set-up of the target are identical.
+ *
+ * Independently of batches, [setup] density_cache = <directory> memoises every convolved
+ * (and spliced) level on disk, keyed additionally by the coordinate shift and the exact
+ * geometry of the level and all coarser levels. A rerun that only changes the finer
+ * patches then reads the unchanged coarse levels back instead of convolving them.
+ */
+class convolution_cache
+{
+protected:
+	struct entry
+	{
+		std::vector<real_t> data; //!< unshifted convolved base grid, empty if spilled to disk
+		std::string spill_file;
+	};
+
+	static bool benabled_;
+	static size_t budget_, used_;
+	static std::string cache_dir_;
+	static std::map<std::string, entry> entries_;
+	static size_t nhits_, nmisses_;
+
+	static std::string key(config_file &cf, tf_type type, bool shift, bool fix, bool flip);
+
+	//! roll of the base grid, in base grid cells, due to the coordinate shift of this target
+	static void get_roll(config_file &cf, int roll[3]);
+
+	static std::string level_key(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip, unsigned ilevel);
+
+	//! file in the density cache directory that holds a level with this key, empty if the cache is off
+	static std::string level_filename(config_file &cf, const std::string &lkey, unsigned ilevel);
+
+public:
+	//! enable the cache for a batch run with the [batch] settings in cf
+	static void enable(config_file &cf);
+
+	static bool enabled(void) { return benabled_; }
+
+	//! copy the cached convolved base level into top, false if there is none for this target
+	static bool fetch(config_file &cf, tf_type type, bool shift, bool fix, bool flip, DensityGrid<real_t> &top);
+
+	//! store the convolved base level top of this target
+	static void store(config_file &cf, tf_type type, bool shift, bool fix, bool flip, const DensityGrid<real_t> &top);
+
+	//! drop all entries and remove spilled files
+	static void clear(void);
+
+	//! read the convolved level ilevel (with padding) from the density cache, false if not present
+	static bool load_level(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip,
+												 unsigned ilevel, DensityGrid<real_t> &grid);
+
+	//! write the convolved level ilevel (with padding) to the density cache, if enabled
+	static void store_level(config_file &cf, const refinement_hierarchy &refh, tf_type type, bool shift, bool fix, bool flip,
+													unsigned ilevel, const DensityGrid<real_t> &grid);
+};
+
+} // namespace music
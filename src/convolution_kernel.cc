@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <vector>
+
 #include <general.hh>
 #include <densities.hh>
 #include <convolution_kernel.hh>
@@ -63,12 +66,14 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 		double stagfact = pk->pcf_->get_value_safe<double>("setup", "baryon_staggering", 0.5);
 		int lmax = pk->pcf_->get_value<int>("setup", "levelmax");
 		double dxmax = boxlength / (1 << lmax);
-		double dxcur = cparam_.lx / cparam_.nx;
 		//std::cerr << "Performing staggering shift for SPH\n";
 		music::ulog.Print("Performing staggering shift for SPH");
-		dstag = stagfact * 2.0 * M_PI / cparam_.nx * dxmax / dxcur;
+		dstag = stagfact * dxmax;
 	}
 
+	//.. patches need not be cubic, so the fundamental mode differs between axes
+	const double kfx = 2.0 * M_PI / cparam_.lx, kfy = 2.0 * M_PI / cparam_.ly, kfz = 2.0 * M_PI / cparam_.lz;
+
 	//.............................................
 
 	std::complex<double> dcmode(RE(cdata[0]), IM(cdata[0]));
@@ -101,6 +106,10 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 					if (ky > cparam_.ny / 2)
 						ky -= cparam_.ny;
 
+					kx *= kfx;
+					ky *= kfy;
+					kz *= kfz;
+
 					kvec[k] = sqrt(kx * kx + ky * ky + kz * kz);
 					argvec[k] = (kx + ky + kz) * dstag;
 				}
@@ -157,6 +166,51 @@ void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip)
 
 void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip);
 
+int kernel_margin(transfer_function *ptf, tf_type type, double boxlength, unsigned ilevel, double tolerance, int maxmargin)
+{
+	const double nspec = ptf->cosmo_params_["n_s"];
+	const double dx = boxlength / (double)(1 << ilevel);
+	const double knyq = M_PI / dx;
+	const int nk = 8192;
+	const double dk = knyq / nk;
+
+	//... kernel in k-space up to the Nyquist wave number of the level, and its L2 norm (Parseval)
+	std::vector<double> kk(nk), wk(nk);
+	double norm = 0.0;
+	for (int i = 0; i < nk; ++i)
+	{
+		double k = (i + 0.5) * dk;
+		double Tk = pow(k, 0.5 * nspec) * ptf->compute(k, type);
+		kk[i] = k;
+		wk[i] = k * k * Tk * dk / (2.0 * M_PI * M_PI);
+		norm += Tk * wk[i];
+	}
+
+	if (!(norm > 0.0))
+		return -1;
+
+	//... accumulate the real space kernel in spherical shells at whole cell distances
+	double inside = 0.0;
+	for (int m = 0; m <= maxmargin; ++m)
+	{
+		double r = m * dx, W = 0.0;
+
+#pragma omp parallel for reduction(+ : W)
+		for (int i = 0; i < nk; ++i)
+		{
+			double x = kk[i] * r;
+			W += wk[i] * ((x > 1e-8) ? sin(x) / x : 1.0);
+		}
+
+		inside += W * W * ((m == 0) ? dx * dx * dx : 4.0 * M_PI * r * r * dx);
+
+		if (1.0 - inside / norm < tolerance)
+			return std::max(2, m + m % 2);
+	}
+
+	return -1;
+}
+
 /*****************************************************************************************/
 /***    SPECIFIC KERNEL IMPLEMENTATIONS      *********************************************/
 /*****************************************************************************************/
@@ -165,7 +219,7 @@ class kernel_k : public kernel
 {
 protected:
 	/**/
-	double boxlength_, patchlength_, nspec_, pnorm_, kfac_, kmax_;
+	double boxlength_, nspec_, pnorm_;
 	TransferFunction_k *tfk_;
 
 public:
@@ -175,8 +229,6 @@ public:
 		boxlength_ = pcf_->get_value<double>("setup", "boxlength");
 		nspec_ = ptf->cosmo_params_["n_s"];
 		pnorm_ = ptf->cosmo_params_["pnorm"];
-		kfac_ = 2.0 * M_PI / boxlength_;
-		kmax_ = kfac_ / 2;
 		tfk_ = new TransferFunction_k(type_, ptf_, nspec_, pnorm_);
 
 		cparam_.nx = 1;
@@ -186,7 +238,6 @@ public:
 		cparam_.ly = boxlength_;
 		cparam_.lz = boxlength_;
 		cparam_.pcf = pcf_;
-		patchlength_ = boxlength_;
 	}
 
 	kernel *fetch_kernel(int ilevel, bool isolated = false)
@@ -200,30 +251,22 @@ public:
 			cparam_.lx = (double)cparam_.nx / (double)(1 << ilevel) * boxlength_;
 			cparam_.ly = (double)cparam_.ny / (double)(1 << ilevel) * boxlength_;
 			cparam_.lz = (double)cparam_.nz / (double)(1 << ilevel) * boxlength_;
-
-			patchlength_ = cparam_.lx;
-			kfac_ = 2.0 * M_PI / patchlength_;
-			kmax_ = kfac_ * cparam_.nx / 2;
 		}
 		else
 		{
-			if( prefh_->get_margin() < 0 ){
+			if( prefh_->get_margin(ilevel) < 0 ){
 				cparam_.nx = 2 * prefh_->size(ilevel, 0);
 				cparam_.ny = 2 * prefh_->size(ilevel, 1);
 				cparam_.nz = 2 * prefh_->size(ilevel, 2);
 			}else{
-				cparam_.nx = prefh_->size(ilevel, 0) + 2*prefh_->get_margin();
-				cparam_.ny = prefh_->size(ilevel, 1) + 2*prefh_->get_margin();
-				cparam_.nz = prefh_->size(ilevel, 2) + 2*prefh_->get_margin();
+				cparam_.nx = prefh_->size(ilevel, 0) + 2*prefh_->get_margin(ilevel);
+				cparam_.ny = prefh_->size(ilevel, 1) + 2*prefh_->get_margin(ilevel);
+				cparam_.nz = prefh_->size(ilevel, 2) + 2*prefh_->get_margin(ilevel);
 			}
 
 			cparam_.lx = (double)cparam_.nx / (double)(1 << ilevel) * boxlength_;
 			cparam_.ly = (double)cparam_.ny / (double)(1 << ilevel) * boxlength_;
 			cparam_.lz = (double)cparam_.nz / (double)(1 << ilevel) * boxlength_;
-
-			patchlength_ = cparam_.lx;
-			kfac_ = 2.0 * M_PI / patchlength_;
-			kmax_ = kfac_ * cparam_.nx / 2;
 		}
 
 		return this;
@@ -237,8 +280,7 @@ public:
 	{
 		for (size_t i = 0; i < len; ++i)
 		{
-			double kk = kfac_ * in_k[i];
-			out_Tk[i] = tfk_->compute(kk);
+			out_Tk[i] = tfk_->compute(in_k[i]);
 		}
 	}
 
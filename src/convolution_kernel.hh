@@ -81,7 +81,7 @@ public:
 	//! purely virtual method to determine whether the kernel is k-sampled or not
 	virtual bool is_ksampled() = 0;
 
-	//! purely virtual vectorized method to compute the kernel value if is_ksampled
+	//! purely virtual vectorized method to compute the kernel value if is_ksampled, in_k are wave numbers in h/Mpc
 	virtual void at_k(size_t len, const double *in_k, double *out_Tk) = 0;
 
 	//! free memory
@@ -121,6 +121,10 @@ struct kernel_creator_concrete : public kernel_creator
 //! actual implementation of the FFT convolution (independent of the actual kernel)
 void perform(kernel *pk, void *pd, bool shift, bool fix, bool flip);
 
+//! smallest (even) margin in cells of level ilevel beyond which the real space transfer kernel
+//! holds less than a fraction 'tolerance' of its L2 norm, -1 (double padding) if none up to maxmargin
+int kernel_margin(transfer_function *ptf, tf_type type, double boxlength, unsigned ilevel, double tolerance, int maxmargin);
+
 } //namespace convolution
 
 #endif //__CONVOLUTION_KERNELS_HH
@@ -22,6 +22,7 @@
 #include "densities.hh"
 #include "random.hh"
 #include "convolution_kernel.hh"
+#include "convolution_cache.hh"
 
 //TODO: this should be a larger number by default, just to maintain consistency with old default
 #define DEF_RAN_CUBE_SIZE 32
@@ -114,20 +115,34 @@ void fft_coarsen(m1 &v, m2 &V)
 	FFTW_API(destroy_plan)(ipc);
 }
 
+//! margin of a padded coarse grid, the periodic base grid has none
+template <typename T>
+size_t grid_margin(const DensityGrid<T> &, int)
+{
+	return 0;
+}
+
+template <typename T>
+size_t grid_margin(const PaddedDensitySubGrid<T> &g, int idim)
+{
+	return g.margin(idim);
+}
+
 /* interpolate downwards in the hierarchy */
 template <typename m1, typename m2>
-void fft_interpolate(m1 &V, m2 &v, int margin, bool from_basegrid = false)
+void fft_interpolate(m1 &V, m2 &v, bool from_basegrid = false)
 {
 	int oxf = v.offset(0), oyf = v.offset(1), ozf = v.offset(2);
 	size_t nxf = v.size(0), nyf = v.size(1), nzf = v.size(2), nzfp = nzf + 2;
 	size_t mxf = v.margin(0), myf = v.margin(1), mzf = v.margin(2);
 
-	// adjust offsets to respect margins, all grids have 'margins' except basegrid (which is periodic)
+	// adjust offsets to respect margins, all grids have 'margins' except basegrid (which is periodic),
+	// margins can differ between levels
 	if (!from_basegrid)
 	{
-		oxf +=  mxf/2;
-		oyf +=  myf/2;
-		ozf +=  mzf/2;
+		oxf += (int)grid_margin(V, 0) - (int)mxf/2;
+		oyf += (int)grid_margin(V, 1) - (int)myf/2;
+		ozf += (int)grid_margin(V, 2) - (int)mzf/2;
 	}
 	else
 	{
@@ -138,6 +153,14 @@ void fft_interpolate(m1 &V, m2 &v, int margin, bool from_basegrid = false)
 
 	music::ulog.Print("FFT interpolate: offset=%d,%d,%d size=%d,%d,%d", oxf, oyf, ozf, nxf, nyf, nzf);
 
+	//... the fine patch with its margin has to lie inside the padded coarse grid
+	if (!from_basegrid && (oxf < 0 || oyf < 0 || ozf < 0 || (size_t)oxf + nxf / 2 > V.size(0) || (size_t)oyf + nyf / 2 > V.size(1) || (size_t)ozf + nzf / 2 > V.size(2)))
+	{
+		music::elog.Print("FFT interpolate: fine patch at (%d,%d,%d) with margins (%zu,%zu,%zu) does not fit into the coarse grid",
+											oxf, oyf, ozf, mxf, myf, mzf);
+		throw std::runtime_error("fft_interpolate: convolution margins of adjacent levels are incompatible");
+	}
+
 	// cut out piece of coarse grid that overlaps the fine:
 	assert(nxf % 2 == 0 && nyf % 2 == 0 && nzf % 2 == 0);
 
@@ -328,8 +351,6 @@ void GenerateDensityHierarchy(config_file &cf, const cosmology::calculator* cc,
 	unsigned levelmin = cf.get_value_safe<unsigned>("setup", "levelmin_TF", levelminPoisson);
 	unsigned levelmax = cf.get_value<unsigned>("setup", "levelmax");
 
-	unsigned margin =  cf.get_value_safe<unsigned>("setup", "convolution_margin", 4);
-
 	bool fix  = cf.get_value_safe<bool>("setup","fix_mode_amplitude",false);
 	bool flip = cf.get_value_safe<bool>("setup","flip_mode_amplitude",false);
 	bool fourier_splicing = true; //cf.get_value_safe<bool>("setup","fourier_splicing",true);
@@ -353,8 +374,15 @@ void GenerateDensityHierarchy(config_file &cf, const cosmology::calculator* cc,
 		// do coarse level
 		top = new DensityGrid<real_t>(nbase, nbase, nbase);
 		music::ilog.Print("Performing noise convolution on level %3d", levelmin);
-		rand.load(*top, levelmin);
-		convolution::perform(the_tf_kernel->fetch_kernel(levelmin, false), reinterpret_cast<void *>(top->get_data_ptr()), shift, fix, flip);
+		if (music::convolution_cache::fetch(cf, type, shift, fix, flip, *top))
+			music::convolution_cache::store_level(cf, refh, type, shift, fix, flip, levelmin, *top);
+		else if (!music::convolution_cache::load_level(cf, refh, type, shift, fix, flip, levelmin, *top))
+		{
+			rand.load(*top, levelmin);
+			convolution::perform(the_tf_kernel->fetch_kernel(levelmin, false), reinterpret_cast<void *>(top->get_data_ptr()), shift, fix, flip);
+			music::convolution_cache::store(cf, type, shift, fix, flip, *top);
+			music::convolution_cache::store_level(cf, refh, type, shift, fix, flip, levelmin, *top);
+		}
 
 		delta.create_base_hierarchy(levelmin);
 
@@ -371,29 +399,36 @@ void GenerateDensityHierarchy(config_file &cf, const cosmology::calculator* cc,
 			music::ilog.Print("   size  =(%5d,%5d,%5d)", refh.size(levelmin + i, 0),
 					refh.size(levelmin + i, 1), refh.size(levelmin + i, 2));
 
-			if( refh.get_margin() > 0 ){
+			const int lmargin = refh.get_margin(levelmin + i);
+			if( lmargin > 0 ){
 				fine = new PaddedDensitySubGrid<real_t>( refh.offset(levelmin + i, 0), refh.offset(levelmin + i, 1), refh.offset(levelmin + i, 2),
 																								 refh.size(levelmin + i, 0), refh.size(levelmin + i, 1), refh.size(levelmin + i, 2),
-																								 refh.get_margin(), refh.get_margin(), refh.get_margin() );
-				music::ilog.Print("    margin = %d",refh.get_margin());
+																								 lmargin, lmargin, lmargin );
+				music::ilog.Print("    margin = %d",lmargin);
 			}else{
 				fine = new PaddedDensitySubGrid<real_t>( refh.offset(levelmin + i, 0), refh.offset(levelmin + i, 1), refh.offset(levelmin + i, 2),
 																								 refh.size(levelmin + i, 0), refh.size(levelmin + i, 1), refh.size(levelmin + i, 2));
-				music::ilog.Print("    margin = %d",refh.size(levelmin + i, 0)/2);
+				music::ilog.Print("    margin = (%d,%d,%d)",refh.size(levelmin + i, 0)/2,refh.size(levelmin + i, 1)/2,refh.size(levelmin + i, 2)/2);
 			}
 			/////////////////////////////////////////////////////////////////////////
 
-			// load white noise for patch
-			rand.load(*fine, levelmin + i);
+			// an unchanged level (and unchanged coarser levels) can be read from the density cache
+			if (!music::convolution_cache::load_level(cf, refh, type, shift, fix, flip, levelmin + i, *fine))
+			{
+				// load white noise for patch
+				rand.load(*fine, levelmin + i);
+
+				convolution::perform(the_tf_kernel->fetch_kernel(levelmin + i, true),
+											 reinterpret_cast<void *>(fine->get_data_ptr()), shift, fix, flip);
 
-			convolution::perform(the_tf_kernel->fetch_kernel(levelmin + i, true),
-										 reinterpret_cast<void *>(fine->get_data_ptr()), shift, fix, flip);
+				if( fourier_splicing ){
+					if (i == 1)
+						fft_interpolate(*top, *fine, true);
+					else
+						fft_interpolate(*coarse, *fine, false);
+				}
 
-			if( fourier_splicing ){
-				if (i == 1)
-					fft_interpolate(*top, *fine, margin, true);
-				else
-					fft_interpolate(*coarse, *fine, margin, false);
+				music::convolution_cache::store_level(cf, refh, type, shift, fix, flip, levelmin + i, *fine);
 			}
 
 			delta.add_patch(refh.offset(levelmin + i, 0),
@@ -0,0 +1,71 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+
+namespace music
+{
+
+//! true if n has no prime factors larger than 7, i.e. FFTW handles it with its fast codelets
+inline bool is_fft_friendly(size_t n)
+{
+	if (n == 0)
+		return false;
+	for (size_t p : {2, 3, 5, 7})
+		while (n % p == 0)
+			n /= p;
+	return n == 1;
+}
+
+//! rough relative cost per element of a 1D FFT of length n
+/*! a radix-p pass costs about p operations per element; FFTW does prime factors larger
+ *  than 7 with Rader/Bluestein, i.e. several transforms of about twice the length, which
+ *  is modelled as 6 log2(2p)+4. Only meant to compare sizes, not to predict run times. */
+inline double fft_cost_per_element(size_t n)
+{
+	double c = 0.0;
+	for (size_t p = 2; p * p <= n; ++p)
+		while (n % p == 0)
+		{
+			c += (p <= 7) ? (double)p : 6.0 * std::log2(2.0 * p) + 4.0;
+			n /= p;
+		}
+	if (n > 1)
+		c += (n <= 7) ? (double)n : 6.0 * std::log2(2.0 * n) + 4.0;
+	return c;
+}
+
+//! rough relative cost of a 3D FFT of size nx*ny*nz
+inline double fft_cost_3d(size_t nx, size_t ny, size_t nz)
+{
+	return (double)nx * (double)ny * (double)nz * (fft_cost_per_element(nx) + fft_cost_per_element(ny) + fft_cost_per_element(nz));
+}
+
+//! smallest FFT friendly n' >= n that is a multiple of 'multiple'
+inline size_t fft_friendly_size(size_t n, size_t multiple = 1)
+{
+	size_t m = ((n + multiple - 1) / multiple) * multiple;
+	while (!is_fft_friendly(m))
+		m += multiple;
+	return m;
+}
+
+} // namespace music
@@ -0,0 +1,411 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <file_writer.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+io_backend file_writer::default_backend_ = io_backend::stream;
+size_t file_writer::default_buffer_size_ = 16ul << 20;
+bool file_writer::drop_cache_ = true;
+
+namespace
+{
+
+//! alignment required for O_DIRECT transfers (covers 512b and 4k sector devices)
+const size_t direct_io_alignment = 4096;
+
+/*!
+ * @class stream_file_writer
+ * @brief back-end that forwards to a buffered std::ofstream
+ */
+class stream_file_writer : public file_writer_impl
+{
+protected:
+	std::ofstream ofs_;
+
+public:
+	bool open(const std::string &fname)
+	{
+		ofs_.open(fname.c_str(), std::ios::binary | std::ios::trunc);
+		return ofs_.good();
+	}
+
+	void write(const char *data, size_t nbytes)
+	{
+		ofs_.write(data, nbytes);
+	}
+
+	void flush(void) { ofs_.flush(); }
+
+	void close(void)
+	{
+		if (ofs_.is_open())
+			ofs_.close();
+	}
+
+	bool good(void) const { return ofs_.good(); }
+
+	bool is_open(void) const { return ofs_.is_open(); }
+};
+
+/*!
+ * @class posix_file_writer
+ * @brief back-end writing large blocks with write(2)
+ *
+ * Data is collected in a buffer of size buffer_size_ and written in one
+ * system call. If drop_cache_ is set, the previously written block is
+ * synced and evicted from the page cache so that writing very large files
+ * does not push the working set of the code out of memory.
+ */
+class posix_file_writer : public file_writer_impl
+{
+protected:
+	int fd_;
+	bool good_;
+	bool drop_cache_;
+
+	char *buf_;
+	size_t buffer_size_;
+	size_t nbuf_;
+
+	off_t file_offset_;	 //!< bytes written to the file so far
+	off_t synced_offset_; //!< bytes already evicted from the page cache
+
+	//! write n bytes from p to the file, retrying on partial writes
+	void write_raw(const char *p, size_t n)
+	{
+		while (n > 0 && good_)
+		{
+			ssize_t nw = ::write(fd_, p, n);
+			if (nw < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				music::elog.Print("I/O error while writing to file: %s", strerror(errno));
+				good_ = false;
+				return;
+			}
+			p += nw;
+			n -= (size_t)nw;
+			file_offset_ += nw;
+		}
+	}
+
+	//! hand the range written since the last call to the kernel and evict the previous one
+	void release_written(void)
+	{
+		if (!drop_cache_ || file_offset_ <= synced_offset_)
+			return;
+#if defined(__linux__)
+		sync_file_range(fd_, synced_offset_, file_offset_ - synced_offset_,
+										SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		fdatasync(fd_);
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+		posix_fadvise(fd_, synced_offset_, file_offset_ - synced_offset_, POSIX_FADV_DONTNEED);
+#endif
+		synced_offset_ = file_offset_;
+	}
+
+	virtual void flush_buffer(void)
+	{
+		write_raw(buf_, nbuf_);
+		nbuf_ = 0;
+		release_written();
+	}
+
+	virtual int open_flags(void) const
+	{
+		return O_WRONLY | O_CREAT | O_TRUNC;
+	}
+
+	virtual void allocate_buffer(void)
+	{
+		buf_ = new char[buffer_size_];
+	}
+
+	virtual void free_buffer(void)
+	{
+		delete[] buf_;
+	}
+
+public:
+	posix_file_writer(size_t buffer_size, bool drop_cache)
+			: fd_(-1), good_(false), drop_cache_(drop_cache), buf_(nullptr),
+				buffer_size_(buffer_size), nbuf_(0), file_offset_(0), synced_offset_(0)
+	{
+	}
+
+	~posix_file_writer()
+	{
+		close();
+		if (buf_ != nullptr)
+			free_buffer();
+	}
+
+	bool open(const std::string &fname)
+	{
+		close();
+
+		fd_ = ::open(fname.c_str(), open_flags(), 0644);
+		if (fd_ < 0)
+		{
+			good_ = false;
+			return false;
+		}
+		if (buf_ == nullptr)
+			allocate_buffer();
+
+		good_ = true;
+		nbuf_ = 0;
+		file_offset_ = 0;
+		synced_offset_ = 0;
+		return true;
+	}
+
+	void write(const char *data, size_t nbytes)
+	{
+		if (!good_)
+			return;
+
+		//... large writes bypass the buffer once it is drained
+		while (nbytes > 0)
+		{
+			size_t ncopy = std::min(nbytes, buffer_size_ - nbuf_);
+			memcpy(buf_ + nbuf_, data, ncopy);
+			nbuf_ += ncopy;
+			data += ncopy;
+			nbytes -= ncopy;
+
+			if (nbuf_ == buffer_size_)
+				flush_buffer();
+		}
+	}
+
+	void flush(void)
+	{
+		if (good_ && nbuf_ > 0)
+			flush_buffer();
+	}
+
+	void close(void)
+	{
+		if (fd_ < 0)
+			return;
+
+		flush();
+		release_written();
+
+		if (::close(fd_) != 0)
+			good_ = false;
+		fd_ = -1;
+	}
+
+	bool good(void) const { return good_; }
+
+	bool is_open(void) const { return fd_ >= 0; }
+};
+
+/*!
+ * @class direct_file_writer
+ * @brief back-end writing with O_DIRECT from aligned buffers
+ *
+ * All but the last block are transferred directly from user memory to the
+ * device. O_DIRECT is cleared for the final partial block whose length is
+ * not a multiple of the alignment. Intermediate calls to flush() are
+ * deferred to keep all direct transfers aligned.
+ */
+class direct_file_writer : public posix_file_writer
+{
+protected:
+	int open_flags(void) const
+	{
+#if defined(O_DIRECT)
+		return posix_file_writer::open_flags() | O_DIRECT;
+#else
+		return posix_file_writer::open_flags();
+#endif
+	}
+
+	void allocate_buffer(void)
+	{
+		void *p = nullptr;
+		if (posix_memalign(&p, direct_io_alignment, buffer_size_) != 0)
+			throw std::runtime_error("direct_file_writer : could not allocate aligned I/O buffer");
+		buf_ = reinterpret_cast<char *>(p);
+	}
+
+	void free_buffer(void)
+	{
+		free(buf_);
+	}
+
+	void flush_buffer(void)
+	{
+		size_t naligned = nbuf_ - nbuf_ % direct_io_alignment;
+		write_raw(buf_, naligned);
+
+		if (naligned < nbuf_)
+		{
+#if defined(O_DIRECT)
+			fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+#endif
+			write_raw(buf_ + naligned, nbuf_ - naligned);
+		}
+		nbuf_ = 0;
+	}
+
+public:
+	explicit direct_file_writer(size_t buffer_size)
+			: posix_file_writer(std::max(direct_io_alignment, buffer_size - buffer_size % direct_io_alignment), false)
+	{
+	}
+
+	~direct_file_writer()
+	{
+		close();
+		if (buf_ != nullptr)
+		{
+			free_buffer();
+			buf_ = nullptr;
+		}
+	}
+
+	bool open(const std::string &fname)
+	{
+		if (!posix_file_writer::open(fname))
+			return false;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+		fcntl(fd_, F_NOCACHE, 1);
+#endif
+		return true;
+	}
+
+	void flush(void)
+	{
+		//... only complete aligned blocks can be written before close
+	}
+
+	void close(void)
+	{
+		if (fd_ < 0)
+			return;
+
+		if (good_ && nbuf_ > 0)
+			flush_buffer();
+
+		if (::close(fd_) != 0)
+			good_ = false;
+		fd_ = -1;
+	}
+};
+
+std::unique_ptr<file_writer_impl> create_file_writer_impl(io_backend backend, size_t buffer_size, bool drop_cache)
+{
+	switch (backend)
+	{
+	case io_backend::posix:
+		return std::make_unique<posix_file_writer>(buffer_size, drop_cache);
+	case io_backend::direct:
+		return std::make_unique<direct_file_writer>(buffer_size);
+	default:
+		return std::make_unique<stream_file_writer>();
+	}
+}
+
+} // namespace
+
+void file_writer::configure(config_file &cf)
+{
+	std::string backend = cf.get_value_safe<std::string>("output", "io_backend", "stream");
+
+	if (backend == "stream")
+		default_backend_ = io_backend::stream;
+	else if (backend == "posix")
+		default_backend_ = io_backend::posix;
+	else if (backend == "direct")
+		default_backend_ = io_backend::direct;
+	else
+	{
+		music::elog.Print("Unknown I/O back-end \'%s\' in [output] io_backend. Use one of stream, posix, direct.", backend.c_str());
+		throw std::runtime_error("Unknown I/O back-end");
+	}
+
+	default_buffer_size_ = cf.get_value_safe<size_t>("output", "io_buffer_size", 16) << 20;
+	drop_cache_ = cf.get_value_safe<bool>("output", "io_drop_cache", true);
+}
+
+std::string file_writer::backend_name(void)
+{
+	switch (default_backend_)
+	{
+	case io_backend::posix:
+		return "posix";
+	case io_backend::direct:
+		return "direct";
+	default:
+		return "stream";
+	}
+}
+
+file_writer::file_writer()
+		: impl_(create_file_writer_impl(default_backend_, default_buffer_size_, drop_cache_))
+{
+}
+
+file_writer::file_writer(const std::string &fname)
+		: file_writer()
+{
+	this->open(fname);
+}
+
+file_writer::~file_writer()
+{
+	impl_->close();
+}
+
+void file_writer::open(const std::string &fname)
+{
+	if (impl_->open(fname))
+		return;
+
+	//... not all file systems support O_DIRECT, retry with plain POSIX I/O
+	if (default_backend_ == io_backend::direct && errno == EINVAL)
+	{
+		music::wlog.Print("File system does not support O_DIRECT for \'%s\', using posix I/O back-end.", fname.c_str());
+		impl_ = create_file_writer_impl(io_backend::posix, default_buffer_size_, drop_cache_);
+		impl_->open(fname);
+	}
+}
+
+} // namespace music
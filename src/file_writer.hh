@@ -0,0 +1,120 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <ios>
+
+#include <config_file.hh>
+
+namespace music
+{
+
+//! the available file writing back-ends, selected by [output] io_backend
+enum class io_backend
+{
+	stream, //!< buffered std::ofstream (default)
+	posix,	//!< large-block POSIX write(2), written ranges are dropped from the page cache
+	direct	//!< O_DIRECT with aligned buffers, bypassing the page cache (falls back to posix)
+};
+
+/*!
+ * @class file_writer_impl
+ * @brief abstract base class for the file writing back-ends
+ */
+class file_writer_impl
+{
+public:
+	virtual ~file_writer_impl() {}
+
+	//! open file for writing, truncating it, returns false on failure
+	virtual bool open(const std::string &fname) = 0;
+
+	//! append nbytes from data to the file
+	virtual void write(const char *data, size_t nbytes) = 0;
+
+	//! write out any buffered data
+	virtual void flush(void) = 0;
+
+	//! flush and close the file
+	virtual void close(void) = 0;
+
+	//! true if no error occured so far
+	virtual bool good(void) const = 0;
+
+	//! true if a file is currently open
+	virtual bool is_open(void) const = 0;
+};
+
+/*!
+ * @class file_writer
+ * @brief sequential binary output file with a configurable I/O back-end
+ *
+ * Provides the subset of the std::ofstream interface used by the binary
+ * output plug-ins so that they can write through any of the back-ends in
+ * music::io_backend. The default back-end and buffer size are set once
+ * from the configuration by file_writer::configure.
+ */
+class file_writer
+{
+protected:
+	std::unique_ptr<file_writer_impl> impl_;
+
+	static io_backend default_backend_;
+	static size_t default_buffer_size_;
+	static bool drop_cache_;
+
+public:
+	//! read [output] io_backend, io_buffer_size and io_drop_cache from the config file
+	static void configure(config_file &cf);
+
+	//! return the name of the currently selected default back-end
+	static std::string backend_name(void);
+
+	file_writer();
+
+	explicit file_writer(const std::string &fname);
+
+	file_writer(const file_writer &) = delete;
+	file_writer &operator=(const file_writer &) = delete;
+
+	~file_writer();
+
+	//! open file for writing with the default back-end, truncating it
+	void open(const std::string &fname);
+
+	//! append n bytes to the file
+	file_writer &write(const char *data, std::streamsize n)
+	{
+		impl_->write(data, (size_t)n);
+		return *this;
+	}
+
+	void flush(void) { impl_->flush(); }
+
+	void close(void) { impl_->close(); }
+
+	bool good(void) const { return impl_->good(); }
+
+	bool bad(void) const { return !impl_->good(); }
+
+	bool is_open(void) const { return impl_->is_open(); }
+};
+
+} // namespace music
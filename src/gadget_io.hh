@@ -0,0 +1,52 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <file_writer.hh>
+
+namespace music
+{
+
+//! write the Gadget block of the contiguous particle IDs id0..id0+np-1, generated on all threads
+/*! The IDs are generated and written in pieces of at most buf_size, the block is framed by
+ *  its size in bytes as in every Gadget-1 format file. */
+template <typename id_t>
+void write_gadget_id_block(file_writer &ofs, size_t id0, size_t np, size_t buf_size)
+{
+	std::vector<id_t> ids(std::min<size_t>(buf_size, np));
+	int blksize = sizeof(id_t) * np;
+
+	ofs.write(reinterpret_cast<char *>(&blksize), sizeof(int));
+	for (size_t i0 = 0; i0 < np; i0 += ids.size())
+	{
+		const long long n = (long long)std::min(ids.size(), np - i0);
+
+#pragma omp parallel for
+		for (long long i = 0; i < n; ++i)
+			ids[i] = (id_t)(id0 + i0 + i);
+
+		ofs.write(reinterpret_cast<char *>(&ids[0]), n * sizeof(id_t));
+	}
+	ofs.write(reinterpret_cast<char *>(&blksize), sizeof(int));
+}
+
+} // namespace music
@@ -66,6 +66,7 @@ extern bool MPI_ok;
 // extern bool MPI_threads_ok;
 extern bool FFTW_threads_ok;
 extern int num_threads;
+extern bool FFT_friendly_sizes; //!< round padded FFT extents to 2^a 3^b 5^c 7^d
 } // namespace CONFIG
 
 //! compute square of argument
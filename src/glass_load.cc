@@ -0,0 +1,131 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glass_load.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+namespace
+{
+//! the leading part of the Gadget-1 header, up to the box length
+struct glass_header
+{
+	unsigned int npart[6];
+	double mass[6];
+	double time;
+	double redshift;
+	int flag_sfr;
+	int flag_feedback;
+	unsigned int npartTotal[6];
+	int flag_cooling;
+	int num_files;
+	double BoxSize;
+};
+
+const size_t header_bytes = 256;
+} // namespace
+
+glass_load::glass_load(const std::string &fname, int itype, size_t ntarget)
+		: boxlength_(1.0f), ntiles_(1)
+{
+	int fd = open(fname.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		music::elog.Print("could not open glass input file \'%s\'", fname.c_str());
+		throw std::runtime_error("could not open glass input file " + fname);
+	}
+
+	size_t fsize = (size_t)st.st_size;
+	void *map = (fsize > 0) ? mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED)
+		throw std::runtime_error("could not map glass input file " + fname + ": " + strerror(errno));
+	madvise(map, fsize, MADV_SEQUENTIAL);
+
+	//... [blksz][header][blksz] [blksz][positions...
+	const char *data = reinterpret_cast<const char *>(map);
+	const size_t pos_start = sizeof(unsigned) + header_bytes + 2 * sizeof(unsigned);
+
+	glass_header head;
+	unsigned blksz = 0;
+	if (fsize >= pos_start)
+	{
+		memcpy(&blksz, data, sizeof(unsigned));
+		memcpy(&head, data + sizeof(unsigned), sizeof(glass_header));
+	}
+
+	size_t nglass = (fsize >= pos_start) ? head.npart[itype] : 0;
+	if (blksz != header_bytes || pos_start + 3 * sizeof(float) * nglass > fsize)
+	{
+		munmap(map, fsize);
+		music::elog.Print("glass file \'%s\' is not a valid Gadget-1 file", fname.c_str());
+		throw std::runtime_error("invalid glass input file " + fname);
+	}
+
+	//... tile the glass if it is smaller than the load
+	if (nglass > 0)
+		ntiles_ = (unsigned)std::lround(std::cbrt((double)ntarget / (double)nglass));
+	if (nglass == 0 || ntiles_ < 1 || (size_t)ntiles_ * ntiles_ * ntiles_ * nglass != ntarget)
+	{
+		munmap(map, fsize);
+		music::elog.Print("glass file \'%s\' has %zu particles of type %d, which cannot be tiled to the %zu cells of the finest level",
+											fname.c_str(), nglass, itype, ntarget);
+		throw std::runtime_error("glass file does not fit the finest level");
+	}
+
+	const float *glass = reinterpret_cast<const float *>(data + pos_start);
+	const float lglass = (float)head.BoxSize;
+	const int nt = (int)ntiles_;
+
+	pos_.resize(3 * ntarget);
+	boxlength_ = lglass * ntiles_;
+
+#pragma omp parallel for collapse(3)
+	for (int ti = 0; ti < nt; ++ti)
+		for (int tj = 0; tj < nt; ++tj)
+			for (int tk = 0; tk < nt; ++tk)
+			{
+				size_t ip0 = ((size_t)(ti * nt + tj) * nt + tk) * nglass;
+				float dx[3] = {ti * lglass, tj * lglass, tk * lglass};
+
+				for (size_t ip = 0; ip < nglass; ++ip)
+					for (int c = 0; c < 3; ++c)
+						pos_[3 * (ip0 + ip) + c] = glass[3 * ip + c] + dx[c];
+			}
+
+	munmap(map, fsize);
+
+	if (ntiles_ > 1)
+		music::ilog.Print("Glass \'%s\' with %zu particles tiled %u times along each axis", fname.c_str(), nglass, ntiles_);
+	else
+		music::ulog.Print("Read %zu particles from glass \'%s\'", nglass, fname.c_str());
+}
+
+} // namespace music
@@ -0,0 +1,124 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <general.hh>
+#include <mesh.hh>
+
+namespace music
+{
+
+/*!
+ * @class glass_load
+ * @brief particle load from a glass file, for particle plug-ins that place the finest level on a glass
+ *
+ * The glass is a Gadget-1 format file ([output] glass_file_cdm). It is read once (memory mapped)
+ * when the object is created, and all components of positions and velocities are then interpolated
+ * from the kept positions. A glass with fewer particles than the finest level has cells is tiled
+ * periodically n times along each axis, if n^3 copies give exactly the number of cells.
+ *
+ * As the Gadget plug-ins always did, the particles of a type are taken from the start of the
+ * position block, their number from the header entry of that type.
+ *
+ * Only the gadget2_2comp plug-in places particles on a glass ([output] glass = yes), the other
+ * particle plug-ins use the Cartesian load. A load takes 12 bytes per particle, the plug-in frees
+ * it after the last component of its particle type.
+ */
+class glass_load
+{
+protected:
+	std::vector<float> pos_; //!< positions in units of the tiled glass box, 3 per particle
+	float boxlength_;				 //!< box length of the tiled glass
+	unsigned ntiles_;				 //!< copies of the glass along each axis
+
+public:
+	//! read the particles of type itype from fname and tile them to ntarget particles
+	glass_load(const std::string &fname, int itype, size_t ntarget);
+
+	size_t size(void) const { return pos_.size() / 3; }
+
+	float boxlength(void) const { return boxlength_; }
+
+	unsigned tiles(void) const { return ntiles_; }
+
+	//! CIC interpolation of the periodic grid that covers the glass box to the particles [ip0,ip0+np), in parallel
+	/*! The value of a particle starts from start(x), x being its three coordinates, the weighted
+	 *  cell values are added to it, and finish(value) is stored in out[ip-ip0]. */
+	template <typename T, class Start, class Finish>
+	void interpolate(const MeshvarBnd<real_t> &grid, size_t ip0, size_t np, Start start, Finish finish, T *out) const
+	{
+		const size_t N = grid.size(0);
+		const float l = boxlength_;
+
+#pragma omp parallel for
+		for (size_t ip = ip0; ip < ip0 + np; ++ip)
+		{
+			const float *x = &pos_[3 * ip];
+			float u, v, w;
+
+			u = x[0] / l * (float)N;
+			v = x[1] / l * (float)N;
+			w = x[2] / l * (float)N;
+
+			int i, j, k;
+
+			i = (((int)u) + N) % N;
+			j = (((int)v) + N) % N;
+			k = (((int)w) + N) % N;
+
+			u -= (float)i;
+			v -= (float)j;
+			w -= (float)k;
+
+			int i1, j1, k1;
+			i1 = (i + 1 + N) % N;
+			j1 = (j + 1 + N) % N;
+			k1 = (k + 1 + N) % N;
+
+			double f1, f2, f3, f4, f5, f6, f7, f8;
+
+			f1 = (1.f - u) * (1.f - v) * (1.f - w);
+			f2 = (1.f - u) * (1.f - v) * (w);
+			f3 = (1.f - u) * (v) * (1.f - w);
+			f4 = (1.f - u) * (v) * (w);
+			f5 = (u) * (1.f - v) * (1.f - w);
+			f6 = (u) * (1.f - v) * (w);
+			f7 = (u) * (v) * (1.f - w);
+			f8 = (u) * (v) * (w);
+
+			float val = start(x);
+
+			val += f1 * grid(i, j, k);
+			val += f2 * grid(i, j, k1);
+			val += f3 * grid(i, j1, k);
+			val += f4 * grid(i, j1, k1);
+			val += f5 * grid(i1, j, k);
+			val += f6 * grid(i1, j, k1);
+			val += f7 * grid(i1, j1, k);
+			val += f8 * grid(i1, j1, k1);
+
+			out[ip - ip0] = finish(val);
+		}
+	}
+};
+
+} // namespace music
@@ -0,0 +1,143 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <grid_compression.hh>
+
+namespace music
+{
+
+namespace
+{
+
+//! IEEE layout of float and double
+template <typename T>
+struct ieee_traits;
+
+template <>
+struct ieee_traits<float>
+{
+	using uint_t = uint32_t;
+	static const int mantissa_bits = 23;
+	static const int exponent_mask = 0xff;
+	static const int exponent_bias = 126; //!< such that biased exponent - bias is the exponent of frexp
+};
+
+template <>
+struct ieee_traits<double>
+{
+	using uint_t = uint64_t;
+	static const int mantissa_bits = 52;
+	static const int exponent_mask = 0x7ff;
+	static const int exponent_bias = 1022;
+};
+
+template <typename T>
+void round_to_error_bound_impl(T *data, size_t n, double abs_err)
+{
+	using traits = ieee_traits<T>;
+	using uint_t = typename traits::uint_t;
+
+	if (!(abs_err > 0.0))
+		return;
+
+	//... a value x = f * 2^e with 0.5 <= f < 1 that keeps m mantissa bits is rounded
+	//... to a multiple of 2^(e-1-m), i.e. the error is at most 2^(e-2-m). With
+	//... m >= e - 2 - floor(log2(abs_err)) this is below abs_err.
+	const int log2err = (int)std::floor(std::log2(abs_err));
+	const T zero_below = (T)abs_err;
+
+#pragma omp parallel for
+	for (long long i = 0; i < (long long)n; ++i)
+	{
+		T x = data[i];
+		if (std::fabs(x) <= zero_below)
+		{
+			data[i] = std::copysign((T)0, x);
+			continue;
+		}
+
+		uint_t bits;
+		memcpy(&bits, &x, sizeof(T));
+
+		int ebiased = (int)((bits >> traits::mantissa_bits) & traits::exponent_mask);
+		if (ebiased == traits::exponent_mask)
+			continue; // inf or nan
+
+		int e = ebiased - traits::exponent_bias;
+		int keep = e - 2 - log2err;
+		if (keep >= traits::mantissa_bits)
+			continue;
+		if (keep < 0)
+			keep = 0;
+
+		//... round half up on the magnitude, a carry into the exponent is fine
+		int drop = traits::mantissa_bits - keep;
+		bits += (uint_t)1 << (drop - 1);
+		bits &= ~(((uint_t)1 << drop) - 1);
+
+		memcpy(&data[i], &bits, sizeof(T));
+	}
+}
+
+} // namespace
+
+grid_error_bounds::grid_error_bounds(config_file &cf)
+{
+	double all = cf.get_value_safe<double>("output", "grid_error_bound", 0.0);
+
+	bound_[static_cast<int>(grid_field_kind::density)] = cf.get_value_safe<double>("output", "grid_error_bound_density", all);
+	bound_[static_cast<int>(grid_field_kind::potential)] = cf.get_value_safe<double>("output", "grid_error_bound_potential", all);
+	bound_[static_cast<int>(grid_field_kind::velocity)] = cf.get_value_safe<double>("output", "grid_error_bound_velocity", all);
+	bound_[static_cast<int>(grid_field_kind::displacement)] = cf.get_value_safe<double>("output", "grid_error_bound_displacement", all);
+}
+
+bool grid_error_bounds::lossless(void) const
+{
+	for (int i = 0; i < 4; ++i)
+		if (bound_[i] > 0.0)
+			return false;
+	return true;
+}
+
+void round_to_error_bound(float *data, size_t n, double abs_err)
+{
+	round_to_error_bound_impl(data, n, abs_err);
+}
+
+void round_to_error_bound(double *data, size_t n, double abs_err)
+{
+	round_to_error_bound_impl(data, n, abs_err);
+}
+
+void round_to_error_bound(long double *data, size_t n, double abs_err)
+{
+	if (!(abs_err > 0.0))
+		return;
+
+	const long double dx = 2.0L * abs_err;
+
+#pragma omp parallel for
+	for (long long i = 0; i < (long long)n; ++i)
+		if (std::isfinite(data[i]))
+			data[i] = std::round(data[i] / dx) * dx;
+}
+
+} // namespace music
@@ -0,0 +1,72 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+#include <config_file.hh>
+
+namespace music
+{
+
+//! kinds of grid fields that can be given separate error bounds
+enum class grid_field_kind
+{
+	density,
+	potential,
+	velocity,
+	displacement
+};
+
+/*!
+ * @class grid_error_bounds
+ * @brief absolute error bounds for lossy grid output, per kind of field
+ *
+ * Read from [output] grid_error_bound (all fields, default 0 = lossless) and
+ * grid_error_bound_density, _potential, _velocity, _displacement, which
+ * override it for one kind of field. Bounds are in the units of the values
+ * as they are stored in the output file.
+ */
+class grid_error_bounds
+{
+protected:
+	double bound_[4];
+
+public:
+	explicit grid_error_bounds(config_file &cf);
+
+	double get(grid_field_kind kind) const
+	{
+		return bound_[static_cast<int>(kind)];
+	}
+
+	bool lossless(void) const;
+};
+
+//! round every value to the float/double with the fewest mantissa bits that is within abs_err
+/*! values below abs_err become zero, inf and nan are left alone. The result is a normal IEEE
+ *  array that any reader understands, but its trailing mantissa bits are zero, so that
+ *  shuffle+deflate (or any external compressor) can remove them. Runs on all threads. */
+void round_to_error_bound(float *data, size_t n, double abs_err);
+
+void round_to_error_bound(double *data, size_t n, double abs_err);
+
+//! long double has no portable layout, values are rounded to multiples of 2*abs_err instead
+void round_to_error_bound(long double *data, size_t n, double abs_err);
+
+} // namespace music
@@ -0,0 +1,224 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <grid_pager.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+bool grid_pager::benabled_ = false;
+bool grid_pager::bwarned_ = false;
+size_t grid_pager::budget_ = 0;
+int grid_pager::fd_ = -1;
+size_t grid_pager::file_size_ = 0;
+size_t grid_pager::page_size_ = 4096;
+std::map<size_t, size_t> grid_pager::free_;
+std::vector<grid_pager::client *> grid_pager::clients_;
+uint64_t grid_pager::clock_ = 0;
+size_t grid_pager::nspills_ = 0;
+size_t grid_pager::nfaults_ = 0;
+size_t grid_pager::bytes_spilled_ = 0;
+
+size_t grid_pager::region_length(size_t bytes)
+{
+	return ((bytes + page_size_ - 1) / page_size_) * page_size_;
+}
+
+void grid_pager::enable(config_file &cf)
+{
+	double budget_mb = cf.get_value_safe<double>("execution", "grid_memory_budget", 0.0);
+	if (!(budget_mb > 0.0))
+		return;
+
+	std::string dir = cf.get_value_safe<std::string>("execution", "paging_dir", ".");
+	char fname[512];
+	snprintf(fname, 512, "%s/___ic_gridpage_%d.bin", dir.c_str(), (int)getpid());
+
+	fd_ = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd_ < 0)
+	{
+		music::elog.Print("Could not create grid paging file \'%s\': %s", fname, strerror(errno));
+		throw std::runtime_error("Could not create grid paging file");
+	}
+	unlink(fname);
+
+	long ps = sysconf(_SC_PAGESIZE);
+	page_size_ = (ps > 0) ? (size_t)ps : 4096;
+	budget_ = (size_t)(budget_mb * 1024.0 * 1024.0);
+	file_size_ = 0;
+	free_.clear();
+	nspills_ = nfaults_ = bytes_spilled_ = 0;
+	bwarned_ = false;
+	benabled_ = true;
+
+	music::ilog.Print("- Paging inactive grid levels to \'%s\' above %.0f MB", dir.c_str(), budget_mb);
+}
+
+void grid_pager::disable(void)
+{
+	if (!benabled_)
+		return;
+
+	music::ulog.Print("Grid paging : %zu levels paged out (%.1f MB), %zu paged back in, scratch file peaked at %.1f MB",
+										nspills_, bytes_spilled_ / 1048576.0, nfaults_, file_size_ / 1048576.0);
+
+	close(fd_);
+	fd_ = -1;
+	free_.clear();
+	file_size_ = 0;
+	benabled_ = false;
+}
+
+void grid_pager::add(client *c)
+{
+	clients_.push_back(c);
+}
+
+void grid_pager::remove(client *c)
+{
+	clients_.erase(std::remove(clients_.begin(), clients_.end(), c), clients_.end());
+}
+
+void grid_pager::make_room(size_t bytes)
+{
+	if (!benabled_)
+		return;
+
+	size_t resident = 0;
+	for (auto c : clients_)
+		resident += c->paging_resident_bytes();
+
+	while (resident + bytes > budget_)
+	{
+		client *coldest = nullptr;
+		unsigned ilevel = 0;
+		uint64_t stamp = UINT64_MAX;
+
+		for (auto c : clients_)
+		{
+			unsigned il;
+			uint64_t st;
+			if (c->paging_oldest_inactive(il, st) && st < stamp)
+			{
+				coldest = c;
+				ilevel = il;
+				stamp = st;
+			}
+		}
+
+		if (coldest == nullptr)
+		{
+			if (!bwarned_)
+				music::wlog.Print("Grid memory budget exceeded by %.1f MB, but no inactive level is left to page out",
+													(resident + bytes - budget_) / 1048576.0);
+			bwarned_ = true;
+			break;
+		}
+
+		resident -= std::min(resident, coldest->paging_spill(ilevel));
+	}
+}
+
+size_t grid_pager::store(const void *data, size_t bytes)
+{
+	size_t len = region_length(bytes), offset = file_size_;
+
+	//... first fit among the freed regions, else append to the file
+	auto it = std::find_if(free_.begin(), free_.end(), [len](const std::pair<const size_t, size_t> &r)
+												 { return r.second >= len; });
+	if (it != free_.end())
+	{
+		offset = it->first;
+		if (it->second > len)
+			free_[offset + len] = it->second - len;
+		free_.erase(it);
+	}
+	else
+	{
+		if (ftruncate(fd_, (off_t)(file_size_ + len)) != 0)
+		{
+			music::elog.Print("Could not grow grid paging file to %.1f MB: %s", (file_size_ + len) / 1048576.0, strerror(errno));
+			throw std::runtime_error("Could not grow grid paging file");
+		}
+		file_size_ += len;
+	}
+
+	void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, (off_t)offset);
+	if (map == MAP_FAILED)
+		throw std::runtime_error(std::string("Could not map grid paging file: ") + strerror(errno));
+
+	memcpy(map, data, bytes);
+	munmap(map, len);
+
+	++nspills_;
+	bytes_spilled_ += bytes;
+	return offset;
+}
+
+void grid_pager::load(size_t handle, void *data, size_t bytes)
+{
+	size_t len = region_length(bytes);
+
+	void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd_, (off_t)handle);
+	if (map == MAP_FAILED)
+		throw std::runtime_error(std::string("Could not map grid paging file: ") + strerror(errno));
+
+	madvise(map, len, MADV_SEQUENTIAL);
+	memcpy(data, map, bytes);
+	munmap(map, len);
+
+	++nfaults_;
+}
+
+void grid_pager::release(size_t handle, size_t bytes)
+{
+	size_t len = region_length(bytes);
+
+	//... merge with the neighbouring free regions
+	auto next = free_.find(handle + len);
+	if (next != free_.end())
+	{
+		len += next->second;
+		free_.erase(next);
+	}
+
+	auto prev = free_.lower_bound(handle);
+	if (prev != free_.begin())
+	{
+		--prev;
+		if (prev->first + prev->second == handle)
+		{
+			prev->second += len;
+			return;
+		}
+	}
+
+	free_[handle] = len;
+}
+
+} // namespace music
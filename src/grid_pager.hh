@@ -0,0 +1,107 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <config_file.hh>
+
+namespace music
+{
+
+/*!
+ * @class grid_pager
+ * @brief moves grid hierarchy levels that are not in use to a scratch file
+ *
+ * With [execution] grid_memory_budget > 0 (in MB) the level data of all grid
+ * hierarchies is kept below this budget by writing the least recently used
+ * levels that the driver has marked inactive (GridHierarchy::hint_inactive)
+ * to a memory mapped scratch file in [execution] paging_dir. Such a level is
+ * read back on the next access through GridHierarchy::get_grid, or for all
+ * levels at once by any operation on the whole hierarchy. Levels that are not
+ * marked inactive are never paged out, the budget can then be exceeded.
+ *
+ * The scratch file is unlinked right after it is created, so that it is
+ * removed by the operating system however the code terminates.
+ */
+class grid_pager
+{
+public:
+	//! interface of an object whose levels can be paged out, implemented by GridHierarchy
+	class client
+	{
+	public:
+		virtual ~client() {}
+
+		//! bytes of level data currently in memory
+		virtual size_t paging_resident_bytes(void) const = 0;
+
+		//! least recently used level in memory that is marked inactive, false if there is none
+		virtual bool paging_oldest_inactive(unsigned &ilevel, uint64_t &stamp) const = 0;
+
+		//! write level ilevel to the scratch file and free its memory, returns the bytes freed
+		virtual size_t paging_spill(unsigned ilevel) = 0;
+	};
+
+protected:
+	static bool benabled_, bwarned_;
+	static size_t budget_;
+	static int fd_;
+	static size_t file_size_, page_size_;
+	static std::map<size_t, size_t> free_; //!< offset -> length of unused regions of the scratch file
+	static std::vector<client *> clients_;
+	static uint64_t clock_;
+	static size_t nspills_, nfaults_, bytes_spilled_;
+
+	//! length of the file region holding bytes bytes
+	static size_t region_length(size_t bytes);
+
+public:
+	//! enable paging with the [execution] settings in cf, does nothing if no budget is set
+	static void enable(config_file &cf);
+
+	//! close the scratch file and report
+	static void disable(void);
+
+	static bool enabled(void) { return benabled_; }
+
+	static void add(client *c);
+
+	static void remove(client *c);
+
+	//! time stamp for least recently used bookkeeping
+	static uint64_t tick(void) { return ++clock_; }
+
+	//! page out inactive levels until bytes more fit into the budget
+	static void make_room(size_t bytes);
+
+	//! copy bytes from data into the scratch file, returns the handle to get it back
+	static size_t store(const void *data, size_t bytes);
+
+	//! copy the region handle back into data
+	static void load(size_t handle, void *data, size_t bytes);
+
+	//! give the region handle free for reuse
+	static void release(size_t handle, size_t bytes);
+};
+
+} // namespace music
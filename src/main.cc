@@ -18,9 +18,24 @@
 #include <stdio.h>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <algorithm>
 #include <math.h>
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
@@ -41,6 +56,7 @@ extern "C"
 #include <general.hh>
 #include <defaults.hh>
 #include <output.hh>
+#include <file_writer.hh>
 
 #include <config_file.hh>
 
@@ -51,6 +67,10 @@ extern "C"
 #include <densities.hh>
 
 #include <convolution_kernel.hh>
+#include <convolution_cache.hh>
+#include <grid_pager.hh>
+#include <memory_governor.hh>
+#include <fft_sizes.hh>
 #include <perturbation_theory.hh>
 #include <cosmology_parameters.hh>
 #include <cosmology_calculator.hh>
@@ -68,6 +88,7 @@ bool MPI_ok = false;
 // bool MPI_threads_ok = false;
 bool FFTW_threads_ok = false;
 int  num_threads = 1;
+bool FFT_friendly_sizes = false;
 }
 
 
@@ -93,6 +114,7 @@ tf_type TransferFunction_k::type_;
 real_t TransferFunction_k::nspec_ = -1.0;
 
 std::unique_ptr<cosmology::calculator>  the_cosmo_calc;
+std::string the_cosmo_key;
 
 //... prototypes for routines used in main driver routine
 void splash(void);
@@ -138,9 +160,76 @@ void modify_grid_for_TF(const refinement_hierarchy &rh_full, refinement_hierarch
 
 	unsigned pad = overlap;
 
+	//... choose the convolution margin of every level from the real space extent of the transfer kernel
+	double margin_tol = cf.get_value_safe<double>("setup", "convolution_margin_tolerance", 0.0);
+	if (margin_tol > 0.0)
+	{
+		transfer_function *ptf = the_cosmo_calc->transfer_function_.get();
+		double boxlength = cf.get_value<double>("setup", "boxlength");
+
+		std::vector<tf_type> types{delta_cdm};
+		if (ptf->tf_has_velocities())
+			types.push_back(theta_cdm);
+		if (cf.get_value<bool>("setup", "baryons") && ptf->tf_is_distinct())
+		{
+			types.push_back(delta_baryon);
+			if (ptf->tf_has_velocities())
+				types.push_back(theta_baryon);
+		}
+
+		for (unsigned i = lbase + 1; i <= lmax; ++i)
+		{
+			//... beyond half the patch size, doubling the patch is just as good
+			int maxmargin = 0;
+			for (int j = 0; j < 3; ++j)
+				maxmargin = std::max(maxmargin, (int)(rh_full.size(i, j) + 2 * pad) / 2);
+
+			int margin = 0;
+			for (auto type : types)
+			{
+				int mtype = convolution::kernel_margin(ptf, type, boxlength, i, margin_tol, maxmargin);
+				margin = (margin < 0 || mtype < 0) ? -1 : std::max(margin, mtype);
+			}
+
+			rh_TF.set_margin(i, margin);
+		}
+
+		//... fft_interpolate places the fine patch with half its margin inside the padded coarse patch,
+		//... so a coarse margin has to be at least half the finer one (double padding if that one is)
+		for (unsigned i = lmax; i > lbase + 1; --i)
+		{
+			int mf = rh_TF.get_margin(i), mc = rh_TF.get_margin(i - 1);
+			if (mf < 0 && mc >= 0)
+				rh_TF.set_margin(i - 1, -1);
+			else if (mc >= 0 && mc < mf / 2)
+				rh_TF.set_margin(i - 1, (mf / 2 + 1) / 2 * 2);
+		}
+
+		for (unsigned i = lbase + 1; i <= lmax; ++i)
+			music::ilog.Print("- Level %2d convolution margin = %d (kernel tolerance %g)", i, rh_TF.get_margin(i), margin_tol);
+	}
+
+	//... by default the convolution patches are cubes, anisotropic patches only pad each axis
+	bool banisotropic = cf.get_value_safe<bool>("setup", "anisotropic_patches", false);
+	double ncubic = 0.0, nactual = 0.0;
+
+	//... the convolution transforms the patch with its margin (or twice the patch if margin < 0), the
+	//... splicing with the coarser level also half of that
+	int margin = rh_TF.get_margin();
+	auto fft_extent = [&margin](int n) { return (margin < 0) ? 2 * n : n + 2 * margin; };
+	auto fft_cost = [&](const int *n) { return music::fft_cost_3d(fft_extent(n[0]), fft_extent(n[1]), fft_extent(n[2])) + music::fft_cost_3d(fft_extent(n[0]) / 2, fft_extent(n[1]) / 2, fft_extent(n[2]) / 2); };
+	auto friendly_extent = [&](int n, int nmax) {
+		for (int m = n; m <= nmax; m += 4)
+			if (music::is_fft_friendly(fft_extent(m)) && music::is_fft_friendly(fft_extent(m) / 2))
+				return m;
+		return n;
+	};
+	double cost_before = 0.0, cost_after = 0.0;
+
 	for (unsigned i = lbase + 1; i <= lmax; ++i)
 	{
 		int x0[3], lx[3], lxmax = 0;
+		margin = rh_TF.get_margin(i);
 
 		for (int j = 0; j < 3; ++j)
 		{
@@ -153,20 +242,65 @@ void modify_grid_for_TF(const refinement_hierarchy &rh_full, refinement_hierarch
 
 		//... make sure that grids are divisible by 4 for convolution.
 		lxmax += lxmax % 4;
+		ncubic += pow((double)lxmax, 3);
 
 		for (int j = 0; j < 3; ++j)
 		{
-			double dl = 0.5 * ((double)(lxmax - lx[j]));
+			int lxnew = banisotropic ? (lx[j] + 3) / 4 * 4 : lxmax;
+			double dl = 0.5 * ((double)(lxnew - lx[j]));
 			int add_left = (int)ceil(dl);
 
-			lx[j] = lxmax;
+			lx[j] = lxnew;
 			x0[j] -= add_left;
 			x0[j] += x0[j] % 2;
 		}
 
+		//... grow the patch (keeping it centred) until the FFTs have no prime factors > 7, the grown
+		//... patch has to stay inside the (already adjusted) parent level, otherwise keep the old size
+		int lxf[3], x0f[3];
+		for (int j = 0; j < 3; ++j)
+		{
+			lxf[j] = friendly_extent(lx[j], std::max(lx[j], 1 << i));
+			x0f[j] = x0[j] - (lxf[j] - lx[j]) / 2;
+			x0f[j] += x0f[j] % 2;
+
+			int pl = 2 * rh_TF.offset_abs(i - 1, j), pr = pl + 2 * (int)rh_TF.size(i - 1, j);
+			if (lxf[j] != lx[j] && (x0f[j] < pl || x0f[j] + lxf[j] > pr))
+			{
+				lxf[j] = lx[j];
+				x0f[j] = x0[j];
+			}
+		}
+
+		cost_before += fft_cost(lx);
+		cost_after += fft_cost(lxf);
+
+		if (CONFIG::FFT_friendly_sizes)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				x0[j] = x0f[j];
+				lx[j] = lxf[j];
+			}
+			music::ilog.Print("- Level %2d convolution patch (%d,%d,%d), FFT size (%d,%d,%d)", i, lx[0], lx[1], lx[2],
+												fft_extent(lx[0]), fft_extent(lx[1]), fft_extent(lx[2]));
+		}
+
+		nactual += (double)lx[0] * (double)lx[1] * (double)lx[2];
 		rh_TF.adjust_level(i, lx[0], lx[1], lx[2], x0[0], x0[1], x0[2]);
 	}
 
+	if (cost_before > 0.0 && cost_after < cost_before)
+	{
+		if (CONFIG::FFT_friendly_sizes)
+			music::ilog.Print("- FFT friendly patch sizes reduce the estimated convolution FFT cost by %.0f%%", 100.0 * (1.0 - cost_after / cost_before));
+		else if (cost_after < 0.9 * cost_before)
+			music::ilog.Print("- Setting [setup] fft_friendly_sizes = yes would reduce the estimated convolution FFT cost by %.0f%%", 100.0 * (1.0 - cost_after / cost_before));
+	}
+
+	if (banisotropic && ncubic > 0.0)
+		music::ilog.Print("- Anisotropic convolution patches use %.1f%% of the cells of cubic patches", 100.0 * nactual / ncubic);
+
 	if (lbaseTF > lbase)
 	{
 		music::ilog << "- Will use levelmin = " << lbaseTF << " to compute density field...\n";
@@ -324,6 +458,25 @@ void add_constant_value( grid_hierarchy &u, const double val )
 	}
 }
 
+//! component icoord of the gradient of u, on the finest level with the hybrid step from the source f if bdefd
+void compute_gradient(poisson_plugin *solver, int icoord, grid_hierarchy &u, grid_hierarchy &f, bool bdefd,
+											unsigned grad_order, bool decic, grid_hierarchy &data)
+{
+	if (bdefd)
+	{
+		data.zero();
+		*data.get_grid(data.levelmax()) = *f.get_grid(f.levelmax());
+		poisson_hybrid(*data.get_grid(data.levelmax()), icoord, grad_order,
+									 data.levelmin() == data.levelmax(), decic);
+		*data.get_grid(data.levelmax()) /= 1 << f.levelmax();
+		solver->gradient_add(icoord, u, data);
+	}
+	else
+		solver->gradient(icoord, u, data);
+	u.hint_inactive();
+	f.hint_inactive();
+}
+
 #include <system_stat.hh>
 void output_system_info()
 {
@@ -355,6 +508,9 @@ void output_system_info()
 	auto kinfo = kern.get_kernel_info();
 	music::ilog << std::setw(32) << std::left << "OS/Kernel version" << " : " << kinfo.kernel << " version " << kinfo.major << "." << kinfo.minor << " build " << kinfo.build_number << std::endl;
 
+	// I/O related infos
+	music::ilog << std::setw(32) << std::left << "Binary output I/O back-end" << " : " << music::file_writer::backend_name() << std::endl;
+
 	// FFTW related infos
 	music::ilog << std::setw(32) << std::left << "FFTW version" << " : " << FFTW_API(version) << std::endl;
 	music::ilog << std::setw(32) << std::left << "FFTW supports multi-threading" << " : " << (CONFIG::FFTW_threads_ok? "yes" : "no") << std::endl;
@@ -374,69 +530,102 @@ void output_system_info()
 
 region_generator_plugin *the_region_generator;
 
-int main(int argc, const char *argv[])
+//! the entries of a comma separated list, without surrounding blanks
+static std::vector<std::string> split_list(const std::string &list)
 {
-	const unsigned nbnd = 4;
-
-	unsigned lbase, lmax, lbaseTF;
+	std::vector<std::string> entries;
+	std::stringstream ss(list);
+	std::string entry;
+	while (std::getline(ss, entry, ','))
+	{
+		entry.erase(0, entry.find_first_not_of(" \t"));
+		entry.erase(entry.find_last_not_of(" \t") + 1);
+		if (!entry.empty())
+			entries.push_back(entry);
+	}
+	return entries;
+}
 
-#if defined(NDEBUG)
-	music::logger::set_level(music::log_level::info);
-#else
-	music::logger::set_level(music::log_level::debug);
-#endif
+//! the outputs written in addition to [output] filename: the paired realisation ([setup] paired) and the further redshifts of a zstart list
+/*! All fields are computed for the first redshift. At redshift z the linear parts are scaled with D+(z)/D+(z0), the
+ *  2LPT parts with its square, velocities in addition with vfact(z)/vfact(z0). */
+static std::vector<std::unique_ptr<output_set>> create_output_sets(config_file &cf, const std::vector<std::string> &zstarts, bool velocity_units)
+{
+	std::vector<std::unique_ptr<output_set>> sets;
+	const bool bpaired = cf.get_value_safe<bool>("setup", "paired", false);
+	const std::string fname = cf.get_value<std::string>("output", "filename");
+	std::vector<std::string> fnames(1, fname);
 
-	//------------------------------------------------------------------------------
-	//... parse command line options
-	//------------------------------------------------------------------------------
+	const real_t a0 = 1.0 / (1.0 + std::stod(zstarts[0]));
+	const double D0 = the_cosmo_calc->get_growth_factor(a0), vfact0 = the_cosmo_calc->get_vfact(a0);
 
-	
-	if (argc != 2)
+	for (size_t iz = 0; iz < zstarts.size(); ++iz)
 	{
-		splash();
-		std::cout << " This version is compiled with the following plug-ins:\n";
+		const real_t a = 1.0 / (1.0 + std::stod(zstarts[iz]));
+		const double D = the_cosmo_calc->get_growth_factor(a) / D0;
+		const double V = D * the_cosmo_calc->get_vfact(a) / vfact0;
+		const double vfact = velocity_units ? 1.0 : the_cosmo_calc->get_vfact(a);
 
-		cosmology::print_ParameterSets();
-		print_region_generator_plugins();
-		print_transfer_function_plugins();
-		print_RNG_plugins();
-		print_output_plugins();
+		std::map<std::string, std::string> overrides;
+		if (iz > 0)
+		{
+			char tmpstr[128];
+			overrides["setup/zstart"] = zstarts[iz];
+			snprintf(tmpstr, 128, "%.12g", the_cosmo_calc->get_growth_factor(a) / the_cosmo_calc->get_growth_factor(1.0));
+			overrides["cosmology/dplus"] = tmpstr;
+			snprintf(tmpstr, 128, "%.12g", vfact);
+			overrides["cosmology/vfact"] = tmpstr;
+			overrides["output/filename"] = output_filename_with_suffix(fname, "_z" + zstarts[iz]);
+			fnames.push_back(overrides["output/filename"]);
+			sets.emplace_back(new output_set(cf, (int)sets.size() + 1, overrides, {D, D * D, V, V * D}, vfact));
+		}
 
-		std::cerr << "\n In order to run, you need to specify a parameter file!\n\n";
-		exit(0);
+		if (bpaired)
+		{
+			std::string fpaired = output_filename_with_suffix((iz > 0) ? fnames.back() : fname, "_paired");
+			if (iz == 0)
+				fpaired = cf.get_value_safe<std::string>("output", "filename_paired", fpaired);
+			overrides["output/filename"] = fpaired;
+			fnames.push_back(fpaired);
+			sets.emplace_back(new output_set(cf, (int)sets.size() + 1, overrides, {-D, D * D, -V, V * D}, vfact));
+		}
 	}
 
-	//------------------------------------------------------------------------------
-	//... open log file
-	//------------------------------------------------------------------------------
+	std::sort(fnames.begin(), fnames.end());
+	if (std::adjacent_find(fnames.begin(), fnames.end()) != fnames.end())
+		throw std::runtime_error("Output file names of the zstart list and of the paired output are not distinct");
 
-	char logfname[128];
-	snprintf(logfname, 128, "%s_log.txt", argv[1]);
-	music::logger::set_output(logfname);
-	time_t ltime = time(NULL);
+	if (zstarts.size() > 1)
+		music::ilog.Print("- Writing %zu outputs, rescaled from zstart=%s", fnames.size(), zstarts[0].c_str());
+	return sets;
+}
 
-	splash();
-	music::ilog.Print("Opening log file \'%s\'.", logfname);
-	music::ulog.Print("Running %s, version %s", THE_CODE_NAME, THE_CODE_VERSION);
-	music::ulog.Print("Log is for run started %s", asctime(localtime(&ltime)));
+//! everything the cosmology calculator and the transfer function plug-ins are set up from
+static std::string cosmology_key(config_file &cf)
+{
+	std::stringstream ss;
+	for (auto &kv : cf.get_section("cosmology"))
+		ss << kv.first << '=' << kv.second << ';';
+	ss << "zstart=" << cf.get_value<std::string>("setup", "zstart") << ';'
+		 << "boxlength=" << cf.get_value<std::string>("setup", "boxlength") << ';'
+		 << "levelmax=" << cf.get_value<std::string>("setup", "levelmax") << ';';
+
+	//... file names of the transfer function plug-ins may be relative
+	char cwd[1024];
+	if (getcwd(cwd, sizeof(cwd)) != NULL)
+		ss << "cwd=" << cwd;
+	return ss.str();
+}
 
-	//------------------------------------------------------------------------------
-	//... read and interpret config file
-	//------------------------------------------------------------------------------
-	config_file cf(argv[1]);
+//! generate one set of initial conditions for the parameters in cf, returns false on a fatal error
+bool run_music(config_file &cf)
+{
+	const unsigned nbnd = 4;
+
+	unsigned lbase, lmax, lbaseTF;
 	std::string tfname, randfname, temp;
 	bool force_shift(false);
 
-	//------------------------------------------------------------------------------
-	//... init multi-threading
-	//------------------------------------------------------------------------------
-	CONFIG::FFTW_threads_ok = FFTW_API(init_threads)();
-	CONFIG::num_threads = cf.get_value_safe<unsigned>("execution", "NumThreads",std::thread::hardware_concurrency());
-
-	music::ilog << "-------------------------------------------------------------------------------" << std::endl;
-	output_system_info();
-	music::ilog << "-------------------------------------------------------------------------------" << std::endl;
-  
 	//------------------------------------------------------------------------------
 	//... initialize some parameters about grid set-up
 	//------------------------------------------------------------------------------
@@ -445,6 +634,24 @@ int main(int argc, const char *argv[])
 	lmax = cf.get_value<unsigned>("setup", "levelmax");
 	lbaseTF = cf.get_value_safe<unsigned>("setup", "levelmin_TF", lbase);
 
+	//... zstart may be a list, all fields are computed for the first redshift and rescaled to the others
+	std::vector<std::string> zstarts = split_list(cf.get_value<std::string>("setup", "zstart"));
+	for (auto &z : zstarts)
+	{
+		char *end;
+		double zval = strtod(z.c_str(), &end);
+		if (*end != '\0' || !(zval > -1.0))
+		{
+			music::elog.Print("[setup] zstart: \'%s\' is not a valid redshift", z.c_str());
+			throw std::runtime_error("Invalid zstart");
+		}
+	}
+	if (zstarts.size() > 1)
+	{
+		cf.insert_value("setup", "zstart_list", cf.get_value<std::string>("setup", "zstart"));
+		cf.insert_value("setup", "zstart", zstarts[0]);
+	}
+
 	if (lbase == lmax && !force_shift)
 		cf.insert_value("setup", "no_shift", "yes");
 
@@ -469,7 +676,16 @@ int main(int argc, const char *argv[])
 			do_LLA = cf.get_value_safe<bool>("setup", "use_LLA", false),
 			do_counter_mode = cf.get_value_safe<bool>("setup", "zero_zoom_velocity", false);
 
-	the_cosmo_calc              = std::make_unique<cosmology::calculator>(cf);
+	//... the calculator and its transfer function tables are kept as long as the cosmology is unchanged,
+	//... i.e. between batch targets and between the jobs of a resident server (--serve)
+	std::string cosmo_key = cosmology_key(cf);
+	if (!the_cosmo_calc || cosmo_key != the_cosmo_key)
+	{
+		the_cosmo_calc = std::make_unique<cosmology::calculator>(cf);
+		the_cosmo_key = cosmo_key;
+	}
+	else
+		music::ilog << "- Reusing cosmology and transfer function of the previous run" << std::endl;
 
 	bool tf_has_velocities = the_cosmo_calc.get()->transfer_function_.get()->tf_has_velocities();
 	//--------------------------------------------------------------------------------------------------------
@@ -533,6 +749,14 @@ int main(int argc, const char *argv[])
 
 	refinement_hierarchy rh_TF(rh_Poisson);
 	modify_grid_for_TF(rh_Poisson, rh_TF, cf);
+
+	//... choose the memory hungry options such that the run fits into [execution] memory_budget
+	music::memory_plan mplan = music::plan_memory(cf, rh_Poisson, rh_TF, tf_has_velocities);
+	if (mplan.regrid)
+	{
+		rh_TF = rh_Poisson;
+		modify_grid_for_TF(rh_Poisson, rh_TF, cf);
+	}
 	// rh_TF.output();
 
 	music::ulog.Print("Grid structure for Poisson solver:");
@@ -548,6 +772,13 @@ int main(int argc, const char *argv[])
 	outfname = cf.get_value<std::string>("output", "filename");
 	output_plugin *the_output_plugin = select_output_plugin(cf);
 
+	//... further outputs from the same fields: the paired realisation and the other redshifts of a zstart list
+	const bool velocity_units = the_cosmo_calc->transfer_function_->tf_velocity_units() && do_baryons;
+	std::vector<std::unique_ptr<output_set>> output_sets = create_output_sets(cf, zstarts, velocity_units);
+	const bool bsets = !output_sets.empty();
+	if (zstarts.size() > 1 && do_baryons)
+		music::wlog.Print("CDM and baryon fields of the zstart list are rescaled with the growth factor of the total matter");
+
 	//------------------------------------------------------------------------------
 	//... initialize the random numbers
 	//------------------------------------------------------------------------------
@@ -560,7 +791,7 @@ int main(int argc, const char *argv[])
 	//------------------------------------------------------------------------------
 	//... initialize the Poisson solver
 	//------------------------------------------------------------------------------
-	bool bdefd = true; // we set this by default and don't allow it to be changed outside any more
+	bool bdefd = mplan.hybrid; // we set this by default and don't allow it to be changed outside any more, only the memory governor may
 	bool bglass = cf.get_value_safe<bool>("output", "glass", false);
 	bool bsph = cf.get_value_safe<bool>("setup", "do_SPH", false) && do_baryons;
 	bool bbshift = bsph && !bglass;
@@ -599,12 +830,21 @@ int main(int argc, const char *argv[])
 	// .. e.g. PANPHASIA wants false, while MUSIC RNG wants true
 	const bool use_fourier_coarsening = cf.get_value_safe<bool>("setup", "fourier_splicing", true);
 
+	//... page out grid levels the driver does not need for a while if over [execution] grid_memory_budget
+	music::grid_pager::enable(cf);
+
 	//---------------------------------------------------------------------------------
 	//... THIS IS THE MAIN DRIVER BRANCHING TREE RUNNING THE VARIOUS PARTS OF THE CODE
 	//---------------------------------------------------------------------------------
 	bool bfatal = false;
 	try
 	{
+		//... components of particle fields are passed on one by one or all three at once
+		vector_field_output dm_position_output(the_output_plugin, vector_field_output::dm_position);
+		vector_field_output dm_velocity_output(the_output_plugin, vector_field_output::dm_velocity);
+		vector_field_output gas_position_output(the_output_plugin, vector_field_output::gas_position);
+		vector_field_output gas_velocity_output(the_output_plugin, vector_field_output::gas_velocity);
+
 		if (!do_2LPT)
 		{
 			music::ulog.Print("Entering 1LPT branch");
@@ -631,6 +871,11 @@ int main(int argc, const char *argv[])
 			music::ulog.Print("Writing CDM data");
 			the_output_plugin->write_dm_mass(f);
 			the_output_plugin->write_dm_density(f);
+			for (auto &s : output_sets)
+			{
+				s->write_linear(output_set::dm_mass, f);
+				s->write_linear(output_set::dm_density, f);
+			}
 
 			grid_hierarchy u(f);
 			u.zero();
@@ -641,6 +886,8 @@ int main(int argc, const char *argv[])
 
 			music::ulog.Print("Writing CDM potential");
 			the_output_plugin->write_dm_potential(u);
+			for (auto &s : output_sets)
+				s->write_linear(output_set::dm_potential, u);
 
 			//------------------------------------------------------------------------------
 			//... DM displacements
@@ -661,6 +908,9 @@ int main(int argc, const char *argv[])
 					else
 						//... displacement
 						the_poisson_solver->gradient(icoord, u, data_forIO);
+					//... the potential and source are idle until the next component, they may be paged out meanwhile
+					u.hint_inactive();
+					f.hint_inactive();
 					double dispmax = compute_finest_absmax(data_forIO);
 					music::ilog.Print("\t - max. %c-displacement of HR particles is %f [mean dx]", 'x' + icoord, dispmax * (double)(1ll << data_forIO.levelmax()));
 					coarsen_density(rh_Poisson, data_forIO, false);
@@ -670,7 +920,10 @@ int main(int argc, const char *argv[])
 					if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord] );
 					
 					music::ulog.Print("Writing CDM displacements");
-					the_output_plugin->write_dm_position(icoord, data_forIO);
+					dm_position_output.write(icoord, data_forIO);
+					//... all fields are linear in the white noise, the paired ones are just negated
+					for (auto &s : output_sets)
+						s->write_linear(vector_field_output::dm_position, icoord, data_forIO);
 				}
 				if (do_baryons)
 					u.deallocate();
@@ -695,6 +948,8 @@ int main(int argc, const char *argv[])
 				{
 					music::ulog.Print("Writing baryon density");
 					the_output_plugin->write_gas_density(f);
+					for (auto &s : output_sets)
+						s->write_linear(output_set::gas_density, f);
 				}
 
 				if (bsph)
@@ -721,10 +976,14 @@ int main(int argc, const char *argv[])
 						else
 							//... displacement
 							the_poisson_solver->gradient(icoord, u, data_forIO);
+						u.hint_inactive();
+						f.hint_inactive();
 
 						coarsen_density(rh_Poisson, data_forIO, false);
 						music::ulog.Print("Writing baryon displacements");
-						the_output_plugin->write_gas_position(icoord, data_forIO);
+						gas_position_output.write(icoord, data_forIO);
+						for (auto &s : output_sets)
+							s->write_linear(vector_field_output::gas_position, icoord, data_forIO);
 					}
 					u.deallocate();
 					data_forIO.deallocate();
@@ -737,6 +996,15 @@ int main(int argc, const char *argv[])
 					u.zero();
 					the_poisson_solver->solve(f, u);
 					compute_LLA_density(u, f, grad_order);
+					//... the LLA density is not linear, it is computed from the potential of each set
+					for (auto &s : output_sets)
+					{
+						grid_hierarchy us(u), fs(f);
+						us *= s->linear();
+						compute_LLA_density(us, fs, grad_order);
+						normalize_density(fs);
+						s->write(output_set::gas_density, fs);
+					}
 					u.deallocate();
 					normalize_density(f);
 					music::ulog.Print("Writing baryon density");
@@ -785,6 +1053,8 @@ int main(int argc, const char *argv[])
 					}
 					else
 						the_poisson_solver->gradient(icoord, u, data_forIO);
+					u.hint_inactive();
+					f.hint_inactive();
 
 					//... multiply to get velocity
 					data_forIO *= cosmo_vfact;
@@ -806,12 +1076,16 @@ int main(int argc, const char *argv[])
 					if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord]*cosmo_vfact );
 
 					music::ulog.Print("Writing CDM velocities");
-					the_output_plugin->write_dm_velocity(icoord, data_forIO);
+					dm_velocity_output.write(icoord, data_forIO);
+					for (auto &s : output_sets)
+						s->write_linear(vector_field_output::dm_velocity, icoord, data_forIO);
 
 					if (do_baryons)
 					{
 						music::ulog.Print("Writing baryon velocities");
-						the_output_plugin->write_gas_velocity(icoord, data_forIO);
+						gas_velocity_output.write(icoord, data_forIO);
+						for (auto &s : output_sets)
+							s->write_linear(vector_field_output::gas_velocity, icoord, data_forIO);
 					}
 				}
 
@@ -856,6 +1130,8 @@ int main(int argc, const char *argv[])
 					}
 					else
 						the_poisson_solver->gradient(icoord, u, data_forIO);
+					u.hint_inactive();
+					f.hint_inactive();
 
 					//... multiply to get velocity
 					data_forIO *= cosmo_vfact;
@@ -875,7 +1151,9 @@ int main(int argc, const char *argv[])
 					if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord]*cosmo_vfact );
 
 					music::ulog.Print("Writing CDM velocities");
-					the_output_plugin->write_dm_velocity(icoord, data_forIO);
+					dm_velocity_output.write(icoord, data_forIO);
+					for (auto &s : output_sets)
+						s->write_linear(vector_field_output::dm_velocity, icoord, data_forIO);
 				}
 				u.deallocate();
 				data_forIO.deallocate();
@@ -914,6 +1192,8 @@ int main(int argc, const char *argv[])
 					}
 					else
 						the_poisson_solver->gradient(icoord, u, data_forIO);
+					u.hint_inactive();
+					f.hint_inactive();
 
 					//... multiply to get velocity
 					data_forIO *= cosmo_vfact;
@@ -933,7 +1213,9 @@ int main(int argc, const char *argv[])
 					if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord]*cosmo_vfact );
 
 					music::ulog.Print("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);
+					gas_velocity_output.write(icoord, data_forIO);
+					for (auto &s : output_sets)
+						s->write_linear(vector_field_output::gas_velocity, icoord, data_forIO);
 				}
 				u.deallocate();
 				f.deallocate();
@@ -950,6 +1232,7 @@ int main(int argc, const char *argv[])
 			music::ulog.Print("Entering 2LPT branch");
 
 			grid_hierarchy f(nbnd), u1(nbnd), u2LPT(nbnd), f2LPT(nbnd);
+			grid_hierarchy data_q(nbnd), data_set(nbnd); // 2LPT part of a field and the field of an output set
 
 			tf_type my_tf_type = theta_cdm;
 			bool dm_only = !do_baryons;
@@ -976,6 +1259,11 @@ int main(int argc, const char *argv[])
 			{
 				the_output_plugin->write_dm_density(f);
 				the_output_plugin->write_dm_mass(f);
+				for (auto &s : output_sets)
+				{
+					s->write_linear(output_set::dm_density, f);
+					s->write_linear(output_set::dm_mass, f);
+				}
 			}
 
 			u1 = f;
@@ -1010,7 +1298,7 @@ int main(int argc, const char *argv[])
 				f2LPT *= 6.0 / 7.0 / vfac2lpt;
 				f += f2LPT;
 
-				if (!dm_only)
+				if (!dm_only && !bsets)
 					f2LPT.deallocate();
 			}
 
@@ -1018,6 +1306,13 @@ int main(int argc, const char *argv[])
 			u2LPT *= 6.0 / 7.0 / vfac2lpt;
 			u1 += u2LPT;
 
+			//... without baryons the 2LPT terms are only needed again for the displacements
+			if (dm_only)
+			{
+				u2LPT.hint_inactive();
+				f2LPT.hint_inactive();
+			}
+
 			grid_hierarchy data_forIO(u1);
 			for (int icoord = 0; icoord < 3; ++icoord)
 			{
@@ -1032,6 +1327,8 @@ int main(int argc, const char *argv[])
 				}
 				else
 					the_poisson_solver->gradient(icoord, u1, data_forIO);
+				u1.hint_inactive();
+				f.hint_inactive();
 
 				data_forIO *= cosmo_vfact;
 
@@ -1053,15 +1350,42 @@ int main(int argc, const char *argv[])
 				if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord] );
 
 				music::ulog.Print("Writing CDM velocities");
-				the_output_plugin->write_dm_velocity(icoord, data_forIO);
+				dm_velocity_output.write(icoord, data_forIO);
 
 				if (do_baryons && !tf_has_velocities && !bsph)
 				{
 					music::ulog.Print("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);
+					gas_velocity_output.write(icoord, data_forIO);
+				}
+
+				//... the other output sets combine the linear and the 2LPT part of the field in one pass
+				if (bsets)
+				{
+					compute_gradient(the_poisson_solver, icoord, u2LPT, f2LPT, bdefd, grad_order, decic_DM, data_q);
+					data_q *= cosmo_vfact;
+					coarsen_density(rh_Poisson, data_q, false);
+
+					for (auto &s : output_sets)
+					{
+						s->combine(vector_field_output::dm_velocity, data_forIO, data_q, data_set);
+
+						//... data_forIO has the counter mode of the run removed, each set gets its own
+						if( do_counter_mode )
+						{
+							double mean = compute_finest_mean(data_set);
+							s->counter_mode_amp[icoord] = mean + s->linear(vector_field_output::dm_velocity) * counter_mode_amp[icoord];
+							add_constant_value( data_set, -mean );
+						}
+
+						s->write(vector_field_output::dm_velocity, icoord, data_set);
+						if (do_baryons && !tf_has_velocities && !bsph)
+							s->write(vector_field_output::gas_velocity, icoord, data_set);
+					}
 				}
 			}
 			data_forIO.deallocate();
+			data_q.deallocate();
+			data_set.deallocate();
 			if (!dm_only)
 				u1.deallocate();
 
@@ -1088,6 +1412,8 @@ int main(int argc, const char *argv[])
 
 				music::ilog.Print("Writing baryon potential");
 				the_output_plugin->write_gas_potential(u1);
+				for (auto &s : output_sets)
+					s->write_linear(output_set::gas_potential, u1);
 
 				//... compute 2LPT term
 				u2LPT = f;
@@ -1106,13 +1432,15 @@ int main(int argc, const char *argv[])
 					f2LPT *= 6.0 / 7.0 / vfac2lpt;
 					f += f2LPT;
 
-					f2LPT.deallocate();
+					if (!bsets)
+						f2LPT.deallocate();
 				}
 
 				//... add the 2LPT contribution
 				u2LPT *= 6.0 / 7.0 / vfac2lpt;
 				u1 += u2LPT;
-				u2LPT.deallocate();
+				if (!bsets)
+					u2LPT.deallocate();
 
 				// grid_hierarchy data_forIO(u1);
 				data_forIO = u1;
@@ -1129,6 +1457,8 @@ int main(int argc, const char *argv[])
 					}
 					else
 						the_poisson_solver->gradient(icoord, u1, data_forIO);
+					u1.hint_inactive();
+					f.hint_inactive();
 
 					data_forIO *= cosmo_vfact;
 
@@ -1149,10 +1479,32 @@ int main(int argc, const char *argv[])
 					if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord] );
 
 					music::ulog.Print("Writing baryon velocities");
-					the_output_plugin->write_gas_velocity(icoord, data_forIO);
+					gas_velocity_output.write(icoord, data_forIO);
+
+					if (bsets)
+					{
+						compute_gradient(the_poisson_solver, icoord, u2LPT, f2LPT, bdefd, grad_order, decic_baryons, data_q);
+						data_q *= cosmo_vfact;
+						coarsen_density(rh_Poisson, data_q, false);
+
+						for (auto &s : output_sets)
+						{
+							s->combine(vector_field_output::gas_velocity, data_forIO, data_q, data_set);
+							if( do_counter_mode ) add_constant_value( data_set, s->linear(vector_field_output::gas_velocity) * counter_mode_amp[icoord] - s->counter_mode_amp[icoord] );
+							s->write(vector_field_output::gas_velocity, icoord, data_set);
+						}
+					}
 				}
 				data_forIO.deallocate();
 				u1.deallocate();
+				if (bsets)
+				{
+					u2LPT.deallocate();
+					if (bdefd)
+						f2LPT.deallocate();
+					data_q.deallocate();
+					data_set.deallocate();
+				}
 			}
 
 			music::ilog << "===============================================================================" << std::endl;
@@ -1177,6 +1529,11 @@ int main(int argc, const char *argv[])
 				music::ulog.Print("Writing CDM data");
 				the_output_plugin->write_dm_density(f);
 				the_output_plugin->write_dm_mass(f);
+				for (auto &s : output_sets)
+				{
+					s->write_linear(output_set::dm_density, f);
+					s->write_linear(output_set::dm_mass, f);
+				}
 				u1 = f;
 				u1.zero();
 
@@ -1201,12 +1558,14 @@ int main(int argc, const char *argv[])
 				{
 					f2LPT *= 3.0 / 7.0;
 					f += f2LPT;
-					f2LPT.deallocate();
+					if (!bsets)
+						f2LPT.deallocate();
 				}
 
 				u2LPT *= 3.0 / 7.0;
 				u1 += u2LPT;
-				u2LPT.deallocate();
+				if (!bsets)
+					u2LPT.deallocate();
 			}
 			else
 			{
@@ -1218,13 +1577,15 @@ int main(int argc, const char *argv[])
 
 				u2LPT *= 0.5;
 				u1 -= u2LPT;
-				u2LPT.deallocate();
+				if (!bsets)
+					u2LPT.deallocate();
 
 				if (bdefd)
 				{
 					f2LPT *= 0.5;
 					f -= f2LPT;
-					f2LPT.deallocate();
+					if (!bsets)
+						f2LPT.deallocate();
 				}
 			}
 
@@ -1244,6 +1605,8 @@ int main(int argc, const char *argv[])
 				}
 				else
 					the_poisson_solver->gradient(icoord, u1, data_forIO);
+				u1.hint_inactive();
+				f.hint_inactive();
 
 				double dispmax = compute_finest_absmax(data_forIO);
 				music::ilog.Print("\t - max. %c-displacement of HR particles is %f [mean dx]", 'x' + icoord, dispmax * (double)(1ll << data_forIO.levelmax()));
@@ -1254,11 +1617,32 @@ int main(int argc, const char *argv[])
 				if( do_counter_mode ) add_constant_value( data_forIO, -counter_mode_amp[icoord]/cosmo_vfact );
 
 				music::ulog.Print("Writing CDM displacements");
-				the_output_plugin->write_dm_position(icoord, data_forIO);
+				dm_position_output.write(icoord, data_forIO);
+
+				if (bsets)
+				{
+					compute_gradient(the_poisson_solver, icoord, u2LPT, f2LPT, bdefd, grad_order, decic_DM, data_q);
+					coarsen_density(rh_Poisson, data_q, false);
+
+					for (auto &s : output_sets)
+					{
+						s->combine(vector_field_output::dm_position, data_forIO, data_q, data_set);
+						if( do_counter_mode ) add_constant_value( data_set, s->linear(vector_field_output::dm_position) * counter_mode_amp[icoord]/cosmo_vfact - s->counter_mode_amp[icoord]/s->vfact );
+						s->write(vector_field_output::dm_position, icoord, data_set);
+					}
+				}
 			}
 
 			data_forIO.deallocate();
 			u1.deallocate();
+			if (bsets)
+			{
+				u2LPT.deallocate();
+				if (bdefd)
+					f2LPT.deallocate();
+				data_q.deallocate();
+				data_set.deallocate();
+			}
 
 			if (do_baryons && !bsph)
 			{
@@ -1273,7 +1657,11 @@ int main(int argc, const char *argv[])
 				normalize_density(f);
 
 				if (!do_LLA)
+				{
 					the_output_plugin->write_gas_density(f);
+					for (auto &s : output_sets)
+						s->write_linear(output_set::gas_density, f);
+				}
 				else
 				{
 					u1 = f;
@@ -1294,13 +1682,27 @@ int main(int argc, const char *argv[])
 					the_poisson_solver->solve(f2LPT, u2LPT);
 					u2LPT *= 3.0 / 7.0;
 					u1 += u2LPT;
-					u2LPT.deallocate();
+					if (!bsets)
+						u2LPT.deallocate();
 
 					compute_LLA_density(u1, f, grad_order);
 					normalize_density(f);
 
 					music::ulog.Print("Writing baryon density");
 					the_output_plugin->write_gas_density(f);
+
+					//... the LLA density is not linear, it is computed from the potential of each set
+					for (auto &s : output_sets)
+					{
+						s->combine(u1, u2LPT, data_set);
+						data_q = f;
+						compute_LLA_density(data_set, data_q, grad_order);
+						normalize_density(data_q);
+						s->write(output_set::gas_density, data_q);
+					}
+					u2LPT.deallocate();
+					data_q.deallocate();
+					data_set.deallocate();
 				}
 			}
 			else if (do_baryons && bsph)
@@ -1317,6 +1719,8 @@ int main(int argc, const char *argv[])
 
 				music::ulog.Print("Writing baryon density");
 				the_output_plugin->write_gas_density(f);
+				for (auto &s : output_sets)
+					s->write_linear(output_set::gas_density, f);
 				u1 = f;
 				u1.zero();
 
@@ -1341,12 +1745,14 @@ int main(int argc, const char *argv[])
 				{
 					f2LPT *= 3.0 / 7.0;
 					f += f2LPT;
-					f2LPT.deallocate();
+					if (!bsets)
+						f2LPT.deallocate();
 				}
 
 				u2LPT *= 3.0 / 7.0;
 				u1 += u2LPT;
-				u2LPT.deallocate();
+				if (!bsets)
+					u2LPT.deallocate();
 
 				data_forIO = u1;
 
@@ -1364,6 +1770,8 @@ int main(int argc, const char *argv[])
 					}
 					else
 						the_poisson_solver->gradient(icoord, u1, data_forIO);
+					u1.hint_inactive();
+					f.hint_inactive();
 
 					coarsen_density(rh_Poisson, data_forIO, false);
 
@@ -1372,8 +1780,25 @@ int main(int argc, const char *argv[])
 
 
 					music::ulog.Print("Writing baryon displacements");
-					the_output_plugin->write_gas_position(icoord, data_forIO);
+					gas_position_output.write(icoord, data_forIO);
+
+					if (bsets)
+					{
+						compute_gradient(the_poisson_solver, icoord, u2LPT, f2LPT, bdefd, grad_order, decic_baryons, data_q);
+						coarsen_density(rh_Poisson, data_q, false);
+
+						for (auto &s : output_sets)
+						{
+							s->combine(vector_field_output::gas_position, data_forIO, data_q, data_set);
+							if( do_counter_mode ) add_constant_value( data_set, s->linear(vector_field_output::gas_position) * counter_mode_amp[icoord]/cosmo_vfact - s->counter_mode_amp[icoord]/s->vfact );
+							s->write(vector_field_output::gas_position, icoord, data_set);
+						}
+					}
 				}
+				u2LPT.deallocate();
+				f2LPT.deallocate();
+				data_q.deallocate();
+				data_set.deallocate();
 			}
 		}
 
@@ -1383,6 +1808,9 @@ int main(int argc, const char *argv[])
 
 		the_output_plugin->finalize();
 		delete the_output_plugin;
+
+		for (auto &s : output_sets)
+			s->finalize();
 	}
 	catch (std::runtime_error &excp)
 	{
@@ -1398,6 +1826,11 @@ int main(int argc, const char *argv[])
 	{
 		music::ilog << " - Wrote output file \'" << outfname << "\'\n     using plugin \'" << outformat << "\'...\n";
 		music::ulog.Print("Wrote output file \'%s\'.", outfname.c_str());
+		for (auto &s : output_sets)
+		{
+			music::ilog << " - Wrote output file \'" << s->filename() << "\'\n";
+			music::ulog.Print("Wrote output file \'%s\'.", s->filename().c_str());
+		}
 	}
 
 
@@ -1406,7 +1839,377 @@ int main(int argc, const char *argv[])
 	//... clean up
 	//------------------------------------------------------------------------------
 	// delete the_transfer_function_plugin;
+	music::grid_pager::disable();
 	delete the_poisson_solver;
+	delete the_region_generator;
+	the_region_generator = nullptr;
+
+	return !bfatal;
+}
+
+//! run the parameter file fname (read into cf), or every target of its batch, returns false if a run failed
+static bool run_parameter_file(config_file &cf, const std::string &fname)
+{
+	//------------------------------------------------------------------------------
+	//... init multi-threading
+	//------------------------------------------------------------------------------
+	CONFIG::num_threads = cf.get_value_safe<unsigned>("execution", "NumThreads",std::thread::hardware_concurrency());
+	CONFIG::FFT_friendly_sizes = cf.get_value_safe<bool>("setup", "fft_friendly_sizes", false);
+
+	//------------------------------------------------------------------------------
+	//... select the back-end used by the binary output plug-ins
+	//------------------------------------------------------------------------------
+	music::file_writer::configure(cf);
+
+	music::ilog << "-------------------------------------------------------------------------------" << std::endl;
+	output_system_info();
+	music::ilog << "-------------------------------------------------------------------------------" << std::endl;
+  
+	//------------------------------------------------------------------------------
+	//... run, or run every target of a batch with the base level shared between them
+	//------------------------------------------------------------------------------
+	std::vector<std::string> targets = split_list(cf.get_value_safe<std::string>("batch", "targets", ""));
+
+	if (targets.empty())
+		return run_music(cf);
+
+	bool bok = true;
+	music::convolution_cache::enable(cf);
+
+	for (auto &target : targets)
+	{
+		//... every target starts from the parameter file, its section overrides '<section>/<key>' entries
+		config_file cft(fname);
+		for (auto &kv : cf.get_section(target))
+			cft.insert_value(kv.first, kv.second);
+
+		music::ilog << "===============================================================================" << std::endl;
+		music::ilog << "   BATCH TARGET \'" << target << "\'\n";
+		music::ilog << "-------------------------------------------------------------------------------" << std::endl;
+		music::file_writer::configure(cft);
+
+		if (!run_music(cft))
+		{
+			music::elog.Print("Batch target \'%s\' failed, continuing with the next one.", target.c_str());
+			bok = false;
+		}
+	}
+
+	music::convolution_cache::clear();
+	return bok;
+}
+
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+
+//------------------------------------------------------------------------------
+//... resident server mode (MUSIC --serve <socket path>)
+//
+//    Parameter files are submitted as text lines on a Unix domain socket, e.g.
+//    with 'echo "run /path/ics.conf /path/outdir" | nc -U <socket path>':
+//
+//      run <parameter file> [<output directory>]   queue a job, the server answers
+//                                                   'queued <id> <jobs ahead>' and,
+//                                                   once it has run, 'done <id> ok|failed'
+//      status                                       'running <id>|idle, <n> queued'
+//      shutdown                                     run the queued jobs, then exit
+//
+//    Relative paths are taken relative to the directory the server was started
+//    in. A job runs in its output directory (default: the directory of the
+//    parameter file, created if it does not exist), which receives its output,
+//    temporary files and '<parameter file>_log.txt'. Jobs run one at a time; the
+//    process and with it the plug-in registries, the FFTW wisdom, the heap and,
+//    for an unchanged cosmology, the cosmology calculator with its transfer
+//    function tables stay warm between jobs.
+//------------------------------------------------------------------------------
+
+namespace
+{
+struct serve_job
+{
+	unsigned id;
+	int fd;							 //!< connection of the client that submitted the job
+	std::string parfile; //!< absolute path of the parameter file
+	std::string outdir;	 //!< absolute path of the directory the job runs in
+};
+
+std::mutex serve_mutex;
+std::condition_variable serve_cv;
+std::deque<serve_job> serve_queue;
+unsigned serve_running = 0; //!< id of the job that is running, 0 if idle
+bool serve_stop = false;
+} // namespace
+
+static void serve_reply(int fd, const std::string &msg)
+{
+	std::string line = msg + "\n";
+	//... the client may have gone already, this must not raise SIGPIPE
+	ssize_t nw = send(fd, line.c_str(), line.size(), MSG_NOSIGNAL);
+	(void)nw;
+}
+
+static std::string serve_read_line(int fd)
+{
+	std::string line;
+	char c;
+	while (line.size() < 4096 && read(fd, &c, 1) == 1 && c != '\n')
+		line.push_back(c);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	return line;
+}
+
+static std::string absolute_path(const std::string &path, const std::string &basedir)
+{
+	return (path.empty() || path[0] == '/') ? path : basedir + "/" + path;
+}
+
+//! accepts requests on the listening socket lfd until it is shut down, does not log since the worker owns the log
+static void serve_accept(int lfd, std::string basedir)
+{
+	unsigned next_id = 1;
+
+	while (true)
+	{
+		int fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		std::stringstream ss(serve_read_line(fd));
+		std::string cmd, parfile, outdir;
+		ss >> cmd >> parfile >> outdir;
+
+		std::lock_guard<std::mutex> lock(serve_mutex);
+		if (cmd == "run" && !parfile.empty() && !serve_stop)
+		{
+			char *rp = realpath(absolute_path(parfile, basedir).c_str(), NULL);
+			if (rp == NULL)
+			{
+				serve_reply(fd, "error cannot open parameter file \'" + parfile + "\': " + strerror(errno));
+				close(fd);
+				continue;
+			}
+			parfile = rp;
+			free(rp);
+
+			outdir = outdir.empty() ? parfile.substr(0, std::max<size_t>(1, parfile.find_last_of('/')))
+															: absolute_path(outdir, basedir);
+
+			serve_queue.push_back({next_id, fd, parfile, outdir});
+			serve_reply(fd, "queued " + std::to_string(next_id) + " " + std::to_string(serve_queue.size() - 1 + (serve_running > 0)));
+			++next_id;
+			serve_cv.notify_one();
+			continue;
+		}
+
+		if (cmd == "status")
+			serve_reply(fd, (serve_running > 0 ? "running " + std::to_string(serve_running) : std::string("idle")) + ", " + std::to_string(serve_queue.size()) + " queued");
+		else if (cmd == "shutdown")
+		{
+			serve_stop = true;
+			serve_reply(fd, "shutting down after " + std::to_string(serve_queue.size()) + " queued jobs");
+			serve_cv.notify_one();
+		}
+		else if (serve_stop)
+			serve_reply(fd, "error server is shutting down");
+		else
+			serve_reply(fd, "error unknown request, use: run <parameter file> [<output directory>] | status | shutdown");
+		close(fd);
+	}
+}
+
+//! keep freed memory in the heap, so that the grids of the next job reuse pages that are already mapped
+static void keep_heap_warm(void)
+{
+#if defined(__GLIBC__)
+	mallopt(M_MMAP_MAX, 0);
+	mallopt(M_TRIM_THRESHOLD, -1);
+	music::ilog.Print("- Freed memory is kept in the heap between jobs");
+#endif
+}
+
+//! run one job in its output directory with its own log file
+static bool serve_run(const serve_job &job, const std::string &basedir)
+{
+	if (mkdir(job.outdir.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		music::elog.Print("Job %u: cannot create output directory \'%s\': %s", job.id, job.outdir.c_str(), strerror(errno));
+		return false;
+	}
+	if (chdir(job.outdir.c_str()) != 0)
+	{
+		music::elog.Print("Job %u: cannot change to output directory \'%s\': %s", job.id, job.outdir.c_str(), strerror(errno));
+		return false;
+	}
+
+	std::string logfname = job.parfile.substr(job.parfile.find_last_of('/') + 1) + "_log.txt";
+	music::logger::set_output(logfname);
+	time_t ltime = time(NULL);
+
+	splash();
+	music::ilog.Print("Opening log file \'%s\'.", logfname.c_str());
+	music::ulog.Print("Running %s, version %s, job %u of a resident server", THE_CODE_NAME, THE_CODE_VERSION, job.id);
+	music::ulog.Print("Log is for run started %s", asctime(localtime(&ltime)));
+
+	bool bok = false;
+	try
+	{
+		config_file cf(job.parfile);
+		bok = run_parameter_file(cf, job.parfile);
+
+		ltime = time(NULL);
+		music::ulog.Print("Run finished %s on %s", bok ? "succesfully" : "with errors", asctime(localtime(&ltime)));
+		cf.dump_to_log();
+	}
+	catch (std::exception &excp)
+	{
+		//... errors outside of the guarded part of run_music, the server carries on with the next job
+		music::elog.Print("Job %u failed: %s", job.id, excp.what());
+		music::grid_pager::disable();
+	}
+
+	//... the next job chooses its own temporary storage
+	music::temp_storage::reset();
+
+	music::logger::unset_output();
+	if (chdir(basedir.c_str()) != 0)
+		throw std::runtime_error("Cannot change back to the server directory " + basedir);
+	return bok;
+}
+
+static int serve(const std::string &path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("Socket path too long: " + path);
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path.c_str());
+
+	//... the server runs whatever parameter file it is given, only its owner may connect, so the
+	//... socket is created with these permissions rather than changed after it exists
+	mode_t oldmask = umask(077);
+	bool bbound = lfd >= 0 && bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+	umask(oldmask);
+	if (!bbound || listen(lfd, 64) != 0)
+		throw std::runtime_error("Cannot listen on socket " + path + ": " + strerror(errno));
+
+	char cwd[1024];
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		throw std::runtime_error(std::string("Cannot determine the working directory: ") + strerror(errno));
+	std::string basedir(cwd);
+
+	splash();
+	music::ulog.Print("Running %s, version %s, as resident server", THE_CODE_NAME, THE_CODE_VERSION);
+	music::ilog.Print("- Listening for jobs on socket \'%s\'", path.c_str());
+	keep_heap_warm();
+
+	CONFIG::FFTW_threads_ok = FFTW_API(init_threads)();
+
+	std::thread acceptor(serve_accept, lfd, basedir);
+
+	while (true)
+	{
+		serve_job job;
+		{
+			std::unique_lock<std::mutex> lock(serve_mutex);
+			serve_cv.wait(lock, []
+										{ return !serve_queue.empty() || serve_stop; });
+			if (serve_queue.empty())
+				break;
+			job = serve_queue.front();
+			serve_queue.pop_front();
+			serve_running = job.id;
+		}
+
+		music::ilog.Print("Job %u : running \'%s\' in \'%s\'", job.id, job.parfile.c_str(), job.outdir.c_str());
+		double tstart = get_wtime();
+		bool bok = serve_run(job, basedir);
+		music::ilog.Print("Job %u : %s after %.1fs", job.id, bok ? "done" : "failed", get_wtime() - tstart);
+
+		{
+			std::lock_guard<std::mutex> lock(serve_mutex);
+			serve_running = 0;
+		}
+		serve_reply(job.fd, "done " + std::to_string(job.id) + (bok ? " ok" : " failed"));
+		close(job.fd);
+	}
+
+	shutdown(lfd, SHUT_RDWR);
+	acceptor.join();
+	close(lfd);
+	unlink(path.c_str());
+
+	if (CONFIG::FFTW_threads_ok)
+		FFTW_API(cleanup_threads)();
+
+	music::ilog << " - Server stopped." << std::endl;
+	return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+#if defined(NDEBUG)
+	music::logger::set_level(music::log_level::info);
+#else
+	music::logger::set_level(music::log_level::debug);
+#endif
+
+	//------------------------------------------------------------------------------
+	//... parse command line options
+	//------------------------------------------------------------------------------
+
+	bool bserve = (argc == 3 && std::string(argv[1]) == "--serve");
+	
+	if (argc != 2 && !bserve)
+	{
+		splash();
+		std::cout << " This version is compiled with the following plug-ins:\n";
+
+		cosmology::print_ParameterSets();
+		print_region_generator_plugins();
+		print_transfer_function_plugins();
+		print_RNG_plugins();
+		print_output_plugins();
+
+		std::cerr << "\n In order to run, you need to specify a parameter file!\n";
+		std::cerr << " (or start a resident server for parameter files with: " << argv[0] << " --serve <socket path>)\n\n";
+		exit(0);
+	}
+
+	if (bserve)
+		return serve(argv[2]);
+
+	//------------------------------------------------------------------------------
+	//... open log file
+	//------------------------------------------------------------------------------
+
+	char logfname[128];
+	snprintf(logfname, 128, "%s_log.txt", argv[1]);
+	music::logger::set_output(logfname);
+	time_t ltime = time(NULL);
+
+	splash();
+	music::ilog.Print("Opening log file \'%s\'.", logfname);
+	music::ulog.Print("Running %s, version %s", THE_CODE_NAME, THE_CODE_VERSION);
+	music::ulog.Print("Log is for run started %s", asctime(localtime(&ltime)));
+
+	//------------------------------------------------------------------------------
+	//... read and interpret config file
+	//------------------------------------------------------------------------------
+	config_file cf(argv[1]);
+
+	CONFIG::FFTW_threads_ok = FFTW_API(init_threads)();
+
+	bool bok = run_parameter_file(cf, argv[1]);
 
 	if( CONFIG::FFTW_threads_ok )
 		FFTW_API(cleanup_threads)();
@@ -1414,13 +2217,14 @@ int main(int argc, const char *argv[])
 	//------------------------------------------------------------------------------
 	//... we are done !
 	//------------------------------------------------------------------------------
-	music::ilog << " - Done!" << std::endl << std::endl;
+	if (bok)
+		music::ilog << " - Done!" << std::endl << std::endl;
 
 	ltime = time(NULL);
 
-	music::ulog.Print("Run finished succesfully on %s", asctime(localtime(&ltime)));
+	music::ulog.Print("Run finished %s on %s", bok ? "succesfully" : "with errors", asctime(localtime(&ltime)));
 
 	cf.dump_to_log();
 
-	return 0;
+	return bok ? 0 : 1;
 }
@@ -0,0 +1,404 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <logger.hh>
+#include <memory_governor.hh>
+#include <output.hh>
+
+namespace music
+{
+
+namespace
+{
+
+const size_t nbnd = 4; //!< ghost zones of the hierarchies in the driver
+
+//! one phase of the driver
+struct phase
+{
+	const char *name;
+	double fixed;	 //!< bytes outside of grid hierarchies: white noise, convolution and FFT buffers
+	double grids;	 //!< bytes of all grid hierarchies alive
+	double active; //!< bytes of the hierarchies in use, which can not be paged out
+	int count;		 //!< how often the phase occurs, for the I/O estimate
+	int npaging;	 //!< how often the pageable hierarchies are paged out and in again per occurrence
+};
+
+//! peak memory of the driver for a memory_plan
+class footprint_model
+{
+protected:
+	const refinement_hierarchy &rhP_, &rhTF_;
+	unsigned lbase_, lmax_, lbaseTF_, overlap_;
+	bool banisotropic_, b2LPT_, bbaryons_, bsph_, btfvel_, bmusic_rng_, bunigrid_, bsets_;
+	int margin0_;
+	double hier_, finest_, hybrid_buffer_, fft_buffer_, glass_;
+
+	static double padded(size_t nx, size_t ny, size_t nz)
+	{
+		return (double)nx * (double)ny * (double)(nz + 2) * sizeof(real_t);
+	}
+
+	static double with_ghosts(size_t nx, size_t ny, size_t nz)
+	{
+		return (double)(nx + 2 * nbnd) * (double)(ny + 2 * nbnd) * (double)(nz + 2 * nbnd) * sizeof(real_t);
+	}
+
+	//! size n and FFT extent e of the convolution patch of level ilevel > levelmin_TF
+	void tf_patch(const memory_plan &plan, unsigned ilevel, size_t n[3], size_t e[3]) const
+	{
+		if (ilevel > lbaseTF_)
+		{
+			for (int j = 0; j < 3; ++j)
+				n[j] = rhTF_.size(ilevel, j);
+		}
+		else
+		{
+			//... these levels are full in rh_TF, redo the padding of modify_grid_for_TF
+			size_t lxmax = 0;
+			for (int j = 0; j < 3; ++j)
+			{
+				n[j] = rhP_.size(ilevel, j) + 2 * overlap_;
+				lxmax = std::max(lxmax, n[j]);
+			}
+			lxmax += lxmax % 4;
+			for (int j = 0; j < 3; ++j)
+				n[j] = banisotropic_ ? (n[j] + 3) / 4 * 4 : lxmax;
+		}
+
+		int margin = (plan.margin == margin0_) ? rhTF_.get_margin(ilevel) : plan.margin;
+		for (int j = 0; j < 3; ++j)
+			e[j] = (margin < 0) ? 2 * n[j] : n[j] + 2 * margin;
+	}
+
+public:
+	footprint_model(config_file &cf, const refinement_hierarchy &rh_Poisson, const refinement_hierarchy &rh_TF, bool tf_has_velocities)
+			: rhP_(rh_Poisson), rhTF_(rh_TF)
+	{
+		lbase_ = rh_Poisson.levelmin();
+		lmax_ = rh_Poisson.levelmax();
+		lbaseTF_ = cf.get_value_safe<unsigned>("setup", "levelmin_TF", lbase_);
+		overlap_ = cf.get_value_safe<unsigned>("setup", "overlap", 4);
+		banisotropic_ = cf.get_value_safe<bool>("setup", "anisotropic_patches", false);
+		b2LPT_ = cf.get_value_safe<bool>("setup", "use_2LPT", false);
+		bbaryons_ = cf.get_value<bool>("setup", "baryons");
+		bsph_ = cf.get_value_safe<bool>("setup", "do_SPH", false) && bbaryons_;
+		btfvel_ = tf_has_velocities;
+		bmusic_rng_ = cf.get_value_safe<std::string>("random", "generator", "MUSIC") == "MUSIC";
+		bunigrid_ = (lbase_ == lmax_);
+		bsets_ = num_outputs(cf) > 1;
+		margin0_ = rh_TF.get_margin();
+
+		hier_ = 0.0;
+		for (unsigned i = 0; i <= lmax_; ++i)
+			hier_ += with_ghosts(rh_Poisson.size(i, 0), rh_Poisson.size(i, 1), rh_Poisson.size(i, 2));
+
+		size_t n[3] = {rh_Poisson.size(lmax_, 0), rh_Poisson.size(lmax_, 1), rh_Poisson.size(lmax_, 2)};
+		finest_ = with_ghosts(n[0], n[1], n[2]);
+
+		//... poisson_hybrid works on the finest level with doubled padding, the k-space solver
+		//... (unigrid only) on a padded copy of the grid
+		hybrid_buffer_ = bunigrid_ ? 0.0 : padded(2 * n[0], 2 * n[1], 2 * n[2]);
+		fft_buffer_ = bunigrid_ ? padded(n[0], n[1], n[2]) : 0.0;
+
+		//... the glass loads of the gadget2_2comp plug-in (3 floats per finest particle and type) are kept
+		//... while the particle components are written, once for every output of the run
+		glass_ = 0.0;
+		auto formats = output_formats(cf);
+		if (cf.get_value_safe<bool>("output", "glass", false) && std::find(formats.begin(), formats.end(), "gadget2_2comp") != formats.end())
+			glass_ = 3.0 * sizeof(float) * (double)n[0] * n[1] * n[2] * (bbaryons_ ? 2 : 1) * num_outputs(cf);
+	}
+
+	bool music_rng(void) const { return bmusic_rng_; }
+	bool unigrid(void) const { return bunigrid_; }
+	unsigned levelmin(void) const { return lbase_; }
+	unsigned levelmin_TF(void) const { return lbaseTF_; }
+	int margin(void) const { return margin0_; }
+
+	//! bytes of all white noise fields (the base level and every patch with its margin), and of the largest one
+	double noise_bytes(const memory_plan &plan, double &noise_max) const
+	{
+		const size_t N = (size_t)1 << plan.levelmin_TF;
+		double noise = (double)N * N * N * sizeof(real_t);
+		noise_max = noise;
+		for (unsigned i = plan.levelmin_TF + 1; i <= lmax_; ++i)
+		{
+			size_t n[3], e[3];
+			tf_patch(plan, i, n, e);
+			double level = (double)e[0] * e[1] * e[2] * sizeof(real_t);
+			noise += level;
+			noise_max = std::max(noise_max, level);
+		}
+		return noise;
+	}
+
+	//! phases of the driver with their footprint
+	std::vector<phase> phases(const memory_plan &plan) const
+	{
+		const double H = hier_;
+		const bool hybrid = plan.hybrid && !bunigrid_;
+		const size_t N = (size_t)1 << plan.levelmin_TF;
+
+		double noise_max, noise = noise_bytes(plan, noise_max);
+		const double noise_mem = (bmusic_rng_ && !plan.disk_cached) ? noise : 0.0;
+
+		//... density: the hierarchy being built, the coarse patch and the fine patch with its kernel
+		double D = 0.0;
+		for (unsigned i = 0; i <= plan.levelmin_TF; ++i)
+			D += with_ghosts((size_t)1 << i, (size_t)1 << i, (size_t)1 << i);
+		double Pcoarse = padded(N, N, N), G = D + 2.0 * Pcoarse;
+		for (unsigned i = plan.levelmin_TF + 1; i <= lmax_; ++i)
+		{
+			size_t n[3], e[3];
+			tf_patch(plan, i, n, e);
+			D += with_ghosts(n[0], n[1], n[2]);
+			double Pfine = padded(e[0], e[1], e[2]);
+			G = std::max(G, D + Pcoarse + 2.0 * Pfine);
+			Pcoarse = Pfine;
+		}
+
+		const double hyb = hybrid ? hybrid_buffer_ : 0.0;
+		const double loop_fixed = noise_mem + std::max(hyb, fft_buffer_) + glass_;
+		const double loop_active = 2.0 * H + (hybrid ? finest_ : 0.0);
+		const int nloop = 2 + (bbaryons_ ? 1 : 0);
+		//... further outputs (paired, zstart list): the scaled copy handed over, or with 2LPT the kept 2LPT potential
+		//... (and source), its gradient and the combined field
+		const double sets = bsets_ ? (b2LPT_ ? (hybrid ? 4.0 : 3.0) : 1.0) * H : 0.0;
+
+		std::vector<phase> ph;
+		ph.push_back({"white noise", noise_mem + 2.0 * noise_max, 0.0, 0.0, 1, 0});
+
+		if (!b2LPT_)
+		{
+			int ngen = 1 + (bbaryons_ ? 1 : 0) + ((bbaryons_ || btfvel_) ? 1 : 0) + ((bbaryons_ && btfvel_) ? 1 : 0);
+			//... without baryons the potential is kept (and idle) while the velocity source is computed
+			double live = (!bbaryons_ && btfvel_) ? H : 0.0;
+			ph.push_back({"density", noise_mem + G, live, 0.0, ngen, 1});
+			ph.push_back({"Poisson solver", noise_mem + fft_buffer_, 2.0 * H, 2.0 * H, ngen, 0});
+			ph.push_back({"displacements/velocities", loop_fixed, (hybrid ? 3.0 : 2.0) * H + sets, loop_active, nloop, 3});
+		}
+		else
+		{
+			const bool dm_only = !bbaryons_;
+			int ngen = dm_only ? 1 : 3 + (bsph_ ? 1 : 0);
+			ph.push_back({"density", noise_mem + G, 0.0, 0.0, 1, 0});
+			if (!dm_only)
+				ph.push_back({"density with 2LPT terms", noise_mem + G, (hybrid ? 1.0 : 2.0) * H, (hybrid ? 1.0 : 2.0) * H, ngen - 1, 0});
+			ph.push_back({"Poisson solver", noise_mem + fft_buffer_, 2.0 * H, 2.0 * H, ngen, 0});
+			ph.push_back({"2LPT term", noise_mem + fft_buffer_, (hybrid ? 4.0 : 3.0) * H, (hybrid ? 4.0 : 3.0) * H, ngen, 0});
+			double nvel = 3.0 + (hybrid ? 1.0 : 0.0) + ((dm_only || !hybrid) ? 1.0 : 0.0);
+			ph.push_back({"velocities", loop_fixed, nvel * H + sets, loop_active, nloop - 1, 3});
+			ph.push_back({"displacements", loop_fixed, (hybrid ? 3.0 : 2.0) * H + sets, loop_active, 1, 3});
+		}
+
+		return ph;
+	}
+
+	//! fill in the peak and the extra I/O of plan, returns the phase of the peak
+	const char *predict(memory_plan &plan) const
+	{
+		auto ph = phases(plan);
+		const double grid_budget = plan.paging_mb * 1048576.0;
+		const char *peak_phase = "";
+
+		//... white noise is written once and read by every density computation
+		plan.peak = 0.0;
+		plan.io_bytes = 0.0;
+		if (bmusic_rng_ && plan.disk_cached)
+		{
+			double noise_max, noise = noise_bytes(plan, noise_max);
+			int ngen = 0;
+			for (auto &p : ph)
+				if (std::string(p.name).find("density") == 0)
+					ngen += p.count;
+			plan.io_bytes += noise * (1 + ngen);
+		}
+
+		for (auto &p : ph)
+		{
+			double resident = p.grids;
+			if (grid_budget > 0.0 && p.grids > grid_budget)
+			{
+				resident = std::max(p.active, grid_budget);
+				plan.io_bytes += 2.0 * (p.grids - resident) * p.count * std::max(p.npaging, 1);
+			}
+
+			if (p.fixed + resident > plan.peak)
+			{
+				plan.peak = p.fixed + resident;
+				peak_phase = p.name;
+			}
+		}
+		return peak_phase;
+	}
+
+	//! largest footprint outside of the hierarchies, what remains of the budget can be paged
+	double max_fixed(const memory_plan &plan) const
+	{
+		double f = 0.0;
+		for (auto &p : phases(plan))
+			if (p.grids > 0.0)
+				f = std::max(f, p.fixed);
+		return f;
+	}
+};
+
+} // namespace
+
+memory_plan plan_memory(config_file &cf, refinement_hierarchy &rh_Poisson, const refinement_hierarchy &rh_TF, bool tf_has_velocities)
+{
+	footprint_model model(cf, rh_Poisson, rh_TF, tf_has_velocities);
+
+	memory_plan plan;
+	plan.disk_cached = cf.get_value_safe<bool>("random", "disk_cached", true);
+	plan.paging_mb = cf.get_value_safe<double>("execution", "grid_memory_budget", 0.0);
+	plan.margin = model.margin();
+	plan.levelmin_TF = model.levelmin_TF();
+	plan.hybrid = true;
+	plan.regrid = false;
+	plan.peak = plan.io_bytes = 0.0;
+	plan.ndegrade = 0;
+
+	const double budget = cf.get_value_safe<double>("execution", "memory_budget", 0.0) * 1048576.0;
+	if (!(budget > 0.0))
+		return plan;
+
+	//... options that do not change the result, unless they are set explicitly
+	std::vector<bool> disk_choices{plan.disk_cached};
+	if (model.music_rng() && !cf.contains_key("random", "disk_cached") && !cf.get_value_safe<bool>("random", "restart", false))
+		disk_choices = {false, true};
+	const bool bpaging_free = !cf.contains_key("execution", "grid_memory_budget");
+
+	//... result changing steps, taken one after the other if nothing else fits and they are allowed
+	const bool bdegrade = cf.get_value_safe<bool>("execution", "memory_budget_degrade", false);
+	std::vector<memory_plan> steps{plan};
+	if (bdegrade)
+	{
+		memory_plan p(plan);
+		if (cf.get_value_safe<double>("setup", "convolution_margin_tolerance", 0.0) <= 0.0 && (p.margin < 0 || p.margin > 4))
+		{
+			p.margin = 4;
+			steps.push_back(p);
+		}
+		if (cf.get_section("constraints").empty())
+			while (p.levelmin_TF > model.levelmin())
+			{
+				--p.levelmin_TF;
+				steps.push_back(p);
+			}
+		if (!model.unigrid())
+		{
+			p.hybrid = false;
+			steps.push_back(p);
+		}
+	}
+
+	bool bfound = false;
+	memory_plan best(plan), smallest(plan);
+	smallest.peak = 1e300;
+
+	for (size_t istep = 0; istep < steps.size() && !bfound; ++istep)
+		for (bool disk : disk_choices)
+			for (int ipaging = 0; ipaging < (bpaging_free ? 2 : 1); ++ipaging)
+			{
+				memory_plan p(steps[istep]);
+				p.disk_cached = disk;
+				if (ipaging == 1)
+				{
+					p.paging_mb = (budget - model.max_fixed(p)) / 1048576.0;
+					if (!(p.paging_mb > 0.0))
+						continue;
+				}
+				p.ndegrade = (int)istep;
+				model.predict(p);
+
+				if (istep == 0 && p.peak < smallest.peak)
+					smallest = p;
+
+				if (p.peak <= budget && (!bfound || p.io_bytes < best.io_bytes || (p.io_bytes == best.io_bytes && p.peak < best.peak)))
+				{
+					best = p;
+					bfound = true;
+				}
+			}
+
+	if (!bfound && !bdegrade)
+	{
+		music::elog.Print("Memory governor: no configuration fits the budget of %.0f MB, the run needs at least %.0f MB",
+											budget / 1048576.0, smallest.peak / 1048576.0);
+		music::elog.Print("Raise [execution] memory_budget, or allow a lower accuracy with [execution] memory_budget_degrade = yes");
+		throw std::runtime_error("Memory governor: memory budget too small");
+	}
+	else if (!bfound)
+	{
+		best = smallest;
+		music::wlog.Print("Memory governor: no configuration fits the budget of %.0f MB, the smallest needs %.0f MB",
+											budget / 1048576.0, best.peak / 1048576.0);
+	}
+
+	const char *peak_phase = model.predict(best);
+
+	//... apply the choices
+	char tmpstr[128];
+	if (model.music_rng())
+		cf.insert_value("random", "disk_cached", best.disk_cached ? "yes" : "no");
+
+	if (best.paging_mb > 0.0)
+	{
+		snprintf(tmpstr, 128, "%.0f", best.paging_mb);
+		cf.insert_value("execution", "grid_memory_budget", tmpstr);
+	}
+
+	if (best.margin != plan.margin)
+	{
+		snprintf(tmpstr, 128, "%d", best.margin);
+		cf.insert_value("setup", "convolution_margin", tmpstr);
+		for (unsigned i = 0; i <= rh_Poisson.levelmax(); ++i)
+			rh_Poisson.set_margin(i, best.margin);
+		music::wlog.Print("Memory governor: convolution margin reduced from %d to %d to fit the budget", plan.margin, best.margin);
+		best.regrid = true;
+	}
+
+	if (best.levelmin_TF != plan.levelmin_TF)
+	{
+		snprintf(tmpstr, 128, "%u", best.levelmin_TF);
+		cf.insert_value("setup", "levelmin_TF", tmpstr);
+		music::wlog.Print("Memory governor: levelmin_TF reduced from %u to %u to fit the budget", plan.levelmin_TF, best.levelmin_TF);
+		best.regrid = true;
+	}
+
+	if (!best.hybrid)
+		music::wlog.Print("Memory governor: hybrid deconvolution of the finest level switched off to fit the budget");
+
+	music::ilog.Print("- Memory governor: budget %.0f MB, predicted peak %.0f MB (%s)", budget / 1048576.0, best.peak / 1048576.0, peak_phase);
+	music::ilog.Print("  white noise %s, grid paging %s, extra I/O %.0f MB", best.disk_cached ? "on disk" : "in memory",
+										(best.paging_mb > 0.0) ? "on" : "off", best.io_bytes / 1048576.0);
+
+	for (auto &p : model.phases(best))
+		music::ulog.Print("Memory governor: phase %-26s %9.1f MB in buffers, %9.1f MB in grids (%.1f MB in use)", p.name,
+											p.fixed / 1048576.0, p.grids / 1048576.0, p.active / 1048576.0);
+
+	return best;
+}
+
+} // namespace music
@@ -0,0 +1,53 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <config_file.hh>
+#include <mesh.hh>
+
+namespace music
+{
+
+//! the memory relevant choices of a run
+struct memory_plan
+{
+	bool disk_cached;		 //!< [random] disk_cached, white noise in files instead of memory
+	double paging_mb;		 //!< [execution] grid_memory_budget handed to the grid pager, 0 = no paging
+	int margin;					 //!< [setup] convolution_margin, -1 = doubled patches
+	unsigned levelmin_TF; //!< [setup] levelmin_TF
+	bool hybrid;				 //!< keep the source for the hybrid deconvolution of the finest level (bdefd)
+	bool regrid;				 //!< levelmin_TF or the margin changed, the density grid has to be set up again
+
+	double peak;		 //!< predicted peak footprint in bytes
+	double io_bytes; //!< predicted extra I/O in bytes for white noise files and paging
+	int ndegrade;		 //!< number of result changing steps taken to fit the budget
+};
+
+//! choose the fastest configuration whose predicted peak memory fits [execution] memory_budget (in MB)
+/*! The peak is modelled for the hierarchies, white noise fields, FFT buffers and glass loads that are alive in every
+ *  phase of the driver (1LPT or 2LPT branch). Options that leave the result unchanged (white noise in
+ *  memory or on disk, grid paging) are chosen freely unless they are set in the parameter file, the one
+ *  with the least extra I/O wins. If no such configuration fits, the run fails with the predicted minimum,
+ *  unless [execution] memory_budget_degrade is set: then the convolution margin, levelmin_TF and the
+ *  hybrid step are given up one after the other, with a warning.
+ *
+ *  Without a budget nothing is changed. The choices are written to cf and to the margins of rh_Poisson,
+ *  if plan.regrid is set, rh_TF has to be derived from rh_Poisson again. */
+memory_plan plan_memory(config_file &cf, refinement_hierarchy &rh_Poisson, const refinement_hierarchy &rh_TF, bool tf_has_velocities);
+
+} // namespace music
@@ -27,8 +27,10 @@
 #include <general.hh>
 #include <config_file.hh>
 #include <region_generator.hh>
+#include <grid_pager.hh>
 
 #include <array>
+#include <atomic>
 using index_t = ptrdiff_t;
 using index3_t = std::array<index_t, 3>;
 using vec3_t = std::array<double, 3>;
@@ -518,8 +520,13 @@ public:
 };
 
 //! class that subsumes a nested grid collection
+/*! with [execution] grid_memory_budget set, levels that the driver marks with hint_inactive()
+ *  can be paged out to a scratch file by music::grid_pager, they are paged back in by
+ *  get_grid() or by any operation on the whole hierarchy. Pointers to the level data that
+ *  were obtained before hint_inactive() must not be used afterwards.
+ */
 template <typename T>
-class GridHierarchy
+class GridHierarchy : public music::grid_pager::client
 {
 public:
 	//! number of ghost cells on boundary
@@ -540,6 +547,92 @@ public:
 	bool bhave_refmask;
 
 protected:
+	//! paging state of one level
+	/*! the flags are read without a lock by page_in(), they are atomic so that a thread that sees a
+	 *  level as not spilled also sees the data pointer stored before */
+	struct page_state
+	{
+		std::atomic<bool> inactive{false}; //!< may be paged out
+		std::atomic<bool> spilled{false};	 //!< data is in the scratch file
+		size_t handle = 0;								 //!< region of the scratch file
+		uint64_t stamp = 0;								 //!< time of the last use
+
+		page_state() = default;
+
+		page_state(const page_state &ps)
+				: inactive(ps.inactive.load()), spilled(ps.spilled.load()), handle(ps.handle), stamp(ps.stamp)
+		{
+		}
+	};
+
+	mutable std::vector<page_state> m_page;
+	bool m_bpaging;
+
+	page_state &get_page_state(unsigned ilevel) const
+	{
+		if (m_page.size() < m_pgrids.size())
+			m_page.resize(m_pgrids.size());
+		return m_page[ilevel];
+	}
+
+	size_t level_bytes(unsigned ilevel) const
+	{
+		const Meshvar<T> *g = m_pgrids[ilevel];
+		return g->m_nx * g->m_ny * g->m_nz * sizeof(T);
+	}
+
+	//! read a paged out level back and mark it as in use
+	void page_in(unsigned ilevel) const
+	{
+		if (ilevel >= m_page.size())
+			return;
+
+		//... get_grid is also called inside parallel loops, only the first access pages in
+		page_state &ps = m_page[ilevel];
+		if (!ps.spilled.load(std::memory_order_acquire) && !ps.inactive.load(std::memory_order_acquire))
+			return;
+
+		#pragma omp critical(grid_paging)
+		{
+			if (ps.spilled.load(std::memory_order_relaxed))
+			{
+				size_t bytes = level_bytes(ilevel);
+				music::grid_pager::make_room(bytes);
+
+				Meshvar<T> *g = m_pgrids[ilevel];
+				g->m_pdata = new T[g->m_nx * g->m_ny * g->m_nz];
+				music::grid_pager::load(ps.handle, g->m_pdata, bytes);
+				music::grid_pager::release(ps.handle, bytes);
+				ps.spilled.store(false, std::memory_order_release);
+			}
+			ps.stamp = music::grid_pager::tick();
+			ps.inactive.store(false, std::memory_order_release);
+		}
+	}
+
+	//! read all paged out levels back, needed before any operation on the whole hierarchy
+	void page_in_all(void) const
+	{
+		for (unsigned i = 0; i < m_page.size(); ++i)
+			page_in(i);
+	}
+
+	//! forget the paged out copies, the levels themselves are about to be freed or replaced
+	void page_discard_all(void)
+	{
+		for (unsigned i = 0; i < m_page.size(); ++i)
+			if (m_page[i].spilled)
+				music::grid_pager::release(m_page[i].handle, level_bytes(i));
+		m_page.clear();
+	}
+
+	void register_pager(void)
+	{
+		m_bpaging = music::grid_pager::enabled();
+		if (m_bpaging)
+			music::grid_pager::add(this);
+	}
+
 	//! check whether a given grid has identical hierarchy, dimensions to this
 	bool is_consistent(const GridHierarchy<T> &gh)
 	{
@@ -571,6 +664,7 @@ public:
 			music::elog.Print("Attempt to access level %d but maxlevel = %d", ilevel, m_pgrids.size() - 1);
 			throw std::runtime_error("Fatal: attempt to access non-existent grid");
 		}
+		page_in(ilevel);
 		return m_pgrids[ilevel];
 	}
 
@@ -582,10 +676,60 @@ public:
 			music::elog.Print("Attempt to access level %d but maxlevel = %d", ilevel, m_pgrids.size() - 1);
 			throw std::runtime_error("Fatal: attempt to access non-existent grid");
 		}
-
+		page_in(ilevel);
 		return m_pgrids[ilevel];
 	}
 
+	//! the levels will not be used for a while and may be paged out (see music::grid_pager)
+	void hint_inactive(void)
+	{
+		if (!m_bpaging)
+			return;
+
+		for (unsigned i = 0; i < m_pgrids.size(); ++i)
+			get_page_state(i).inactive = true;
+		music::grid_pager::make_room(0);
+	}
+
+	//! the levels are about to be used, read back all paged out levels now
+	void hint_active(void)
+	{
+		page_in_all();
+	}
+
+	size_t paging_resident_bytes(void) const
+	{
+		size_t bytes = 0;
+		for (unsigned i = 0; i < m_pgrids.size(); ++i)
+			if (static_cast<const Meshvar<T> *>(m_pgrids[i])->m_pdata != NULL)
+				bytes += level_bytes(i);
+		return bytes;
+	}
+
+	bool paging_oldest_inactive(unsigned &ilevel, uint64_t &stamp) const
+	{
+		bool bfound = false;
+		for (unsigned i = 0; i < m_page.size() && i < m_pgrids.size(); ++i)
+			if (m_page[i].inactive && !m_page[i].spilled && static_cast<const Meshvar<T> *>(m_pgrids[i])->m_pdata != NULL &&
+					(!bfound || m_page[i].stamp < stamp))
+			{
+				ilevel = i;
+				stamp = m_page[i].stamp;
+				bfound = true;
+			}
+		return bfound;
+	}
+
+	size_t paging_spill(unsigned ilevel)
+	{
+		size_t bytes = level_bytes(ilevel);
+		page_state &ps = get_page_state(ilevel);
+		ps.handle = music::grid_pager::store(m_pgrids[ilevel]->get_ptr(), bytes);
+		ps.spilled = true;
+		m_pgrids[ilevel]->deallocate();
+		return bytes;
+	}
+
 	//! constructor for a collection of rectangular grids representing a multi-level hierarchy
 	/*! creates an empty hierarchy, levelmin is initially zero, no grids are stored
 	 * @param nbnd number of ghost zones added at the boundary
@@ -594,11 +738,14 @@ public:
 			: m_nbnd(nbnd), m_levelmin(0), bhave_refmask(false)
 	{
 		m_pgrids.clear();
+		register_pager();
 	}
 
 	//! copy constructor
 	explicit GridHierarchy(const GridHierarchy<T> &gh)
 	{
+		register_pager();
+
 		for (unsigned i = 0; i <= gh.levelmax(); ++i)
 			m_pgrids.push_back(new MeshvarBnd<T>(*gh.get_grid(i)));
 
@@ -623,11 +770,14 @@ public:
 	~GridHierarchy()
 	{
 		this->deallocate();
+		if (m_bpaging)
+			music::grid_pager::remove(this);
 	}
 
 	//! free all memory occupied by the grid hierarchy
 	void deallocate()
 	{
+		page_discard_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			delete m_pgrids[i];
 		m_pgrids.clear();
@@ -864,6 +1014,7 @@ public:
 	//! sets the values of all grids on all levels to zero
 	void zero(void)
 	{
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			m_pgrids[i]->zero();
 	}
@@ -936,6 +1087,7 @@ public:
 	//! multiply entire grid hierarchy by a constant
 	GridHierarchy<T> &operator*=(T x)
 	{
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) *= x;
 		return *this;
@@ -944,6 +1096,7 @@ public:
 	//! divide entire grid hierarchy by a constant
 	GridHierarchy<T> &operator/=(T x)
 	{
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) /= x;
 		return *this;
@@ -952,6 +1105,7 @@ public:
 	//! add a constant to the entire grid hierarchy
 	GridHierarchy<T> &operator+=(T x)
 	{
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) += x;
 		return *this;
@@ -960,6 +1114,7 @@ public:
 	//! subtract a constant from the entire grid hierarchy
 	GridHierarchy<T> &operator-=(T x)
 	{
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) -= x;
 		return *this;
@@ -973,6 +1128,7 @@ public:
 			music::elog.Print("GridHierarchy::operator*= : attempt to operate on incompatible data");
 			throw std::runtime_error("GridHierarchy::operator*= : attempt to operate on incompatible data");
 		}
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) *= *gh.get_grid(i);
 		return *this;
@@ -986,6 +1142,7 @@ public:
 			music::elog.Print("GridHierarchy::operator/= : attempt to operate on incompatible data");
 			throw std::runtime_error("GridHierarchy::operator/= : attempt to operate on incompatible data");
 		}
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) /= *gh.get_grid(i);
 		return *this;
@@ -997,6 +1154,7 @@ public:
 		if (!is_consistent(gh))
 			throw std::runtime_error("GridHierarchy::operator+= : attempt to operate on incompatible data");
 
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) += *gh.get_grid(i);
 		return *this;
@@ -1010,6 +1168,7 @@ public:
 			music::elog.Print("GridHierarchy::operator-= : attempt to operate on incompatible data");
 			throw std::runtime_error("GridHierarchy::operator-= : attempt to operate on incompatible data");
 		}
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) -= *gh.get_grid(i);
 		return *this;
@@ -1028,6 +1187,7 @@ public:
 
 		if (!is_consistent(gh))
 		{
+			page_discard_all();
 			for (unsigned i = 0; i < m_pgrids.size(); ++i)
 				delete m_pgrids[i];
 			m_pgrids.clear();
@@ -1044,6 +1204,7 @@ public:
 			return *this;
 		} // throw std::runtime_error("GridHierarchy::operator= : attempt to operate on incompatible data");
 
+		page_in_all();
 		for (unsigned i = 0; i < m_pgrids.size(); ++i)
 			(*m_pgrids[i]) = *gh.get_grid(i);
 		return *this;
@@ -1081,6 +1242,7 @@ public:
 	 */
 	void add_patch(unsigned xoff, unsigned yoff, unsigned zoff, unsigned nx, unsigned ny, unsigned nz)
 	{
+		music::grid_pager::make_room((size_t)(nx + 2 * m_nbnd) * (ny + 2 * m_nbnd) * (nz + 2 * m_nbnd) * sizeof(T));
 		m_pgrids.push_back(new MeshvarBnd<T>(m_nbnd, nx, ny, nz, xoff, yoff, zoff));
 		m_pgrids.back()->zero();
 
@@ -1106,6 +1268,8 @@ public:
 	{
 		unsigned dx, dy, dz, dxtop, dytop, dztop;
 
+		page_in_all();
+
 		dx = xoff - m_xoffabs[ilevel];
 		dy = yoff - m_yoffabs[ilevel];
 		dz = zoff - m_zoffabs[ilevel];
@@ -1263,6 +1427,7 @@ class refinement_hierarchy
 			gridding_unit_;		//!< internal blocking factor of grids, necessary for Panphasia
 
 	int margin_; //!< number of cells used for additional padding for convolutions with isolated boundaries (-1 = double padding)
+	std::vector<int> level_margin_; //!< margins per level, if they were set individually
 
 	config_file &cf_; //!< reference to config_file
 
@@ -1739,6 +1904,7 @@ public:
 		absoffsets_ = o.absoffsets_;
 		len_ = o.len_;
 		margin_ = o.margin_;
+		level_margin_ = o.level_margin_;
 
 		return *this;
 	}
@@ -1854,6 +2020,22 @@ public:
 		return margin_;
 	}
 
+	//! get the margin reserved for isolated convolutions on level ilevel (-1=double pad)
+	int get_margin(unsigned ilevel) const
+	{
+		if (ilevel < level_margin_.size())
+			return level_margin_[ilevel];
+		return margin_;
+	}
+
+	//! set the margin for isolated convolutions on level ilevel (-1=double pad)
+	void set_margin(unsigned ilevel, int margin)
+	{
+		if (level_margin_.size() <= levelmax_)
+			level_margin_.resize(levelmax_ + 1, margin_);
+		level_margin_[ilevel] = margin;
+	}
+
 	//! get the total shift of the coordinate system in box coordinates
 	const double *get_coord_shift(void) const
 	{
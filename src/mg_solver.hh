@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
@@ -43,6 +44,25 @@ namespace opt
 	};
 }
 
+//! read access to a box of a coarse level, indexed like the whole level
+class coarse_window
+{
+protected:
+	const MeshvarBnd<real_t> &m_box;
+	int m_ox, m_oy, m_oz;
+
+public:
+	coarse_window(const MeshvarBnd<real_t> &box, int ox, int oy, int oz)
+			: m_box(box), m_ox(ox), m_oy(oy), m_oz(oz)
+	{
+	}
+
+	inline const real_t &operator()(int ix, int iy, int iz) const
+	{
+		return m_box(ix - m_ox, iy - m_oy, iz - m_oz);
+	}
+};
+
 //! actual implementation of FAS adaptive multigrid solver
 template <class S, class I, class O>
 class solver
@@ -285,34 +305,49 @@ void solver<S, I, O>::twoGrid(unsigned ilevel)
 			oyp = uf->offset(1),
 			ozp = uf->offset(2);
 
-	meshvar_bnd tLu(*uc, false);
+	//... the FAS correction and the coarse grid correction are only needed where the fine level
+	//... covers the coarse level, the temporaries are restricted to that box (all of it on the top levels)
+	int
+			nxc = nx / 2,
+			nyc = ny / 2,
+			nzc = nz / 2;
+
+	meshvar_bnd tLu(0, nxc, nyc, nzc, oxp, oyp, ozp);
 	#pragma omp parallel for
-	for (int ix = 0; ix < nx / 2; ++ix)
+	for (int ix = 0; ix < nxc; ++ix)
 	{
 		int iix = 2 * ix;
-		for (int iy = 0, iiy = 0; iy < ny / 2; ++iy, iiy += 2)
+		for (int iy = 0, iiy = 0; iy < nyc; ++iy, iiy += 2)
 
-			for (int iz = 0, iiz = 0; iz < nz / 2; ++iz, iiz += 2)
-				tLu(ix + oxp, iy + oyp, iz + ozp) = 0.125 * (m_scheme.apply((*uf), iix, iiy, iiz) + m_scheme.apply((*uf), iix, iiy, iiz + 1) + m_scheme.apply((*uf), iix, iiy + 1, iiz) + m_scheme.apply((*uf), iix, iiy + 1, iiz + 1) + m_scheme.apply((*uf), iix + 1, iiy, iiz) + m_scheme.apply((*uf), iix + 1, iiy, iiz + 1) + m_scheme.apply((*uf), iix + 1, iiy + 1, iiz) + m_scheme.apply((*uf), iix + 1, iiy + 1, iiz + 1)) / h2;
+			for (int iz = 0, iiz = 0; iz < nzc; ++iz, iiz += 2)
+				tLu(ix, iy, iz) = 0.125 * (m_scheme.apply((*uf), iix, iiy, iiz) + m_scheme.apply((*uf), iix, iiy, iiz + 1) + m_scheme.apply((*uf), iix, iiy + 1, iiz) + m_scheme.apply((*uf), iix, iiy + 1, iiz + 1) + m_scheme.apply((*uf), iix + 1, iiy, iiz) + m_scheme.apply((*uf), iix + 1, iiy, iiz + 1) + m_scheme.apply((*uf), iix + 1, iiy + 1, iiz) + m_scheme.apply((*uf), iix + 1, iiy + 1, iiz + 1)) / h2;
 	}
 
 	//... restrict source term
 	m_gridop.restrict(*ff, *fc);
 
-	int oi, oj, ok;
-	oi = ff->offset(0);
-	oj = ff->offset(1);
-	ok = ff->offset(2);
-
 #pragma omp parallel for collapse(3)
-	for (int ix = oi; ix < oi + (int)ff->size(0) / 2; ++ix)
-		for (int iy = oj; iy < oj + (int)ff->size(1) / 2; ++iy)
-			for (int iz = ok; iz < ok + (int)ff->size(2) / 2; ++iz)
-				(*fc)(ix, iy, iz) += ((tLu(ix, iy, iz) - (m_scheme.apply(*uc, ix, iy, iz) / (4.0 * h2))));
+	for (int ix = 0; ix < nxc; ++ix)
+		for (int iy = 0; iy < nyc; ++iy)
+			for (int iz = 0; iz < nzc; ++iz)
+				(*fc)(ix + oxp, iy + oyp, iz + ozp) += ((tLu(ix, iy, iz) - (m_scheme.apply(*uc, ix + oxp, iy + oyp, iz + ozp) / (4.0 * h2))));
 
 	tLu.deallocate();
 
-	meshvar_bnd ucsave(*uc, true);
+	//... the prolongation stencils reach up to 2 coarse cells beyond the fine patch, the saved state and the
+	//... correction are kept on a halo of that width around the box, as far as it lies inside the coarse level
+	const int nhalo = std::max(uc->m_nbnd, 2);
+	const int
+			hxl = std::max(-nhalo, -oxp), hxr = std::min(nxc + nhalo, (int)uc->size(0) - oxp),
+			hyl = std::max(-nhalo, -oyp), hyr = std::min(nyc + nhalo, (int)uc->size(1) - oyp),
+			hzl = std::max(-nhalo, -ozp), hzr = std::min(nzc + nhalo, (int)uc->size(2) - ozp);
+
+	meshvar_bnd ucsave(nhalo, nxc, nyc, nzc, oxp, oyp, ozp);
+#pragma omp parallel for collapse(3)
+	for (int ix = hxl; ix < hxr; ++ix)
+		for (int iy = hyl; iy < hyr; ++iy)
+			for (int iz = hzl; iz < hzr; ++iz)
+				ucsave(ix, iy, iz) = (*uc)(ix + oxp, iy + oyp, iz + ozp);
 
 	//... have we reached the end of the recursion or do we need to go up one level?
 	if (ilevel == 1)
@@ -323,21 +358,20 @@ void solver<S, I, O>::twoGrid(unsigned ilevel)
 	else
 		twoGrid(ilevel - 1);
 
-	meshvar_bnd cc(*uc, false);
+	//... compute correction on coarse grid, in place of the saved state
+	meshvar_bnd &cc = ucsave;
 
-//... compute correction on coarse grid
 #pragma omp parallel for collapse(3)
-	for (int ix = 0; ix < (int)cc.size(0); ++ix)
-		for (int iy = 0; iy < (int)cc.size(1); ++iy)
-			for (int iz = 0; iz < (int)cc.size(2); ++iz)
-				cc(ix, iy, iz) = (*uc)(ix, iy, iz) - ucsave(ix, iy, iz);
-
-	ucsave.deallocate();
+	for (int ix = hxl; ix < hxr; ++ix)
+		for (int iy = hyl; iy < hyr; ++iy)
+			for (int iz = hzl; iz < hzr; ++iz)
+				cc(ix, iy, iz) = (*uc)(ix + oxp, iy + oyp, iz + ozp) - cc(ix, iy, iz);
 
 	if (m_bperiodic && ilevel <= m_ilevelmin)
 		make_periodic(&cc);
 
-	m_gridop.prolong_add(cc, *uf);
+	m_gridop.prolong_add(coarse_window(cc, oxp, oyp, ozp), *uf);
+	cc.deallocate();
 
 	//... interpolate and apply coarse-fine boundary conditions on fine level
 	if (m_bperiodic && ilevel <= m_ilevelmin)
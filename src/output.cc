@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <sstream>
+
 #include "output.hh"
 
 
@@ -63,5 +66,218 @@ output_plugin *select_output_plugin( config_file& cf )
 	return the_output_plugin;
 }
 
+void vector_field_output::write( int icoord, const grid_hierarchy& gh )
+{
+	if( !plugin_->supports_vector_fields() )
+	{
+		switch( type_ )
+		{
+			case dm_position:  plugin_->write_dm_position( icoord, gh ); break;
+			case dm_velocity:  plugin_->write_dm_velocity( icoord, gh ); break;
+			case gas_position: plugin_->write_gas_position( icoord, gh ); break;
+			case gas_velocity: plugin_->write_gas_velocity( icoord, gh ); break;
+		}
+		return;
+	}
+	
+	//... keep a copy of the first two components, the third one is passed on directly
+	if( icoord < 2 )
+	{
+		comp_[icoord].reset( new grid_hierarchy( gh ) );
+		return;
+	}
+	
+	if( !comp_[0] || !comp_[1] )
+		throw std::runtime_error("vector_field_output: components have to be written in the order x, y, z");
+	
+	switch( type_ )
+	{
+		case dm_position:  plugin_->write_dm_positions( *comp_[0], *comp_[1], gh ); break;
+		case dm_velocity:  plugin_->write_dm_velocities( *comp_[0], *comp_[1], gh ); break;
+		case gas_position: plugin_->write_gas_positions( *comp_[0], *comp_[1], gh ); break;
+		case gas_velocity: plugin_->write_gas_velocities( *comp_[0], *comp_[1], gh ); break;
+	}
+	
+	comp_[0].reset();
+	comp_[1].reset();
+}
+
+
+
+
+unsigned num_outputs( config_file& cf )
+{
+	//... the driver keeps the list as zstart_list once it has set zstart to the first entry
+	std::string zlist = cf.get_value_safe<std::string>( "setup", "zstart_list", cf.get_value_safe<std::string>( "setup", "zstart", "" ) );
+	unsigned nz = 1 + (unsigned)std::count( zlist.begin(), zlist.end(), ',' );
+	
+	return nz * (cf.get_value_safe<bool>( "setup", "paired", false ) ? 2 : 1);
+}
+
+std::vector<std::string> output_formats( config_file& cf )
+{
+	std::string format = cf.get_value<std::string>( "output", "format" );
+	if( format != "multi" )
+		return { format };
+	
+	std::vector<std::string> formats;
+	std::stringstream ss( cf.get_value<std::string>( "output", "formats" ) );
+	std::string item;
+	while( std::getline( ss, item, ',' ) )
+	{
+		item.erase( 0, item.find_first_not_of( " \t" ) );
+		item.erase( item.find_last_not_of( " \t" ) + 1 );
+		if( !item.empty() )
+			formats.push_back( item );
+	}
+	return formats;
+}
+
+std::string output_filename_with_suffix( const std::string& fname, const std::string& suffix )
+{
+	size_t idot = fname.find_last_of( '.' ), islash = fname.find_last_of( '/' );
+	
+	if( idot == std::string::npos || idot == 0 || (islash != std::string::npos && idot < islash) )
+		return fname + suffix;
+	return fname.substr( 0, idot ) + suffix + fname.substr( idot );
+}
+
+output_set::output_set( config_file& cf, int id, const std::map<std::string, std::string>& overrides, const scaling& scale, double vf )
+: cf_( cf ), id_( id ), overrides_( overrides ), scale_( scale ), plugin_( create_plugin() ),
+	dm_position_( plugin_, vector_field_output::dm_position ), dm_velocity_( plugin_, vector_field_output::dm_velocity ),
+	gas_position_( plugin_, vector_field_output::gas_position ), gas_velocity_( plugin_, vector_field_output::gas_velocity ),
+	vfact( vf )
+{
+	for( int i=0; i<3; ++i )
+		counter_mode_amp[i] = 0.0;
+}
 
+output_set::~output_set()
+{
+	delete plugin_;
+}
 
+template< typename F >
+void output_set::call( F f )
+{
+	//... swap in the entries of this set, the plug-ins may read them at any time
+	std::map<std::string, std::string> saved;
+	for( auto& kv : overrides_ )
+	{
+		saved[kv.first] = cf_.get_value<std::string>( kv.first.substr( 0, kv.first.find('/') ), kv.first.substr( kv.first.find('/') + 1 ) );
+		cf_.insert_value( kv.first, kv.second );
+	}
+	music::temp_storage::select_set( id_ );
+	
+	auto restore = [&](){
+		music::temp_storage::select_set( 0 );
+		for( auto& kv : saved )
+			cf_.insert_value( kv.first, kv.second );
+	};
+	
+	try{
+		f();
+	}catch(...){
+		restore();
+		throw;
+	}
+	restore();
+}
+
+output_plugin *output_set::create_plugin( void )
+{
+	output_plugin *plugin = nullptr;
+	call( [&](){ plugin = select_output_plugin( cf_ ); } );
+	return plugin;
+}
+
+std::string output_set::filename( void ) const
+{
+	return overrides_.at( "output/filename" );
+}
+
+double output_set::linear( vector_field_output::field_type type ) const
+{
+	if( type == vector_field_output::dm_velocity || type == vector_field_output::gas_velocity )
+		return scale_.vlin;
+	return scale_.xlin;
+}
+
+void output_set::combine( vector_field_output::field_type type, const grid_hierarchy& full, const grid_hierarchy& q, grid_hierarchy& out ) const
+{
+	const bool bvel = (type == vector_field_output::dm_velocity || type == vector_field_output::gas_velocity);
+	const double a = bvel ? scale_.vlin : scale_.xlin;
+	const double b = (bvel ? scale_.v2lpt : scale_.x2lpt) - a;
+	
+	out = full;
+	for( unsigned ilevel=0; ilevel<=out.levelmax(); ++ilevel )
+	{
+		MeshvarBnd<real_t>& o = *out.get_grid( ilevel );
+		const MeshvarBnd<real_t>& g = *q.get_grid( ilevel );
+		const size_t nb = 2 * o.m_nbnd, n = (o.size(0) + nb) * (o.size(1) + nb) * (o.size(2) + nb);
+		real_t *po = o[0];
+		const real_t *pq = g[0];
+		
+		#pragma omp parallel for
+		for( size_t i=0; i<n; ++i )
+			po[i] = a * po[i] + b * pq[i];
+	}
+}
+
+void output_set::write_linear( field_type type, const grid_hierarchy& gh )
+{
+	if( type == dm_mass || scale_.xlin == 1.0 )
+	{
+		write( type, gh );
+		return;
+	}
+	
+	grid_hierarchy scaled( gh );
+	scaled *= scale_.xlin;
+	write( type, scaled );
+}
+
+void output_set::write_linear( vector_field_output::field_type type, int icoord, const grid_hierarchy& gh )
+{
+	if( linear( type ) == 1.0 )
+	{
+		write( type, icoord, gh );
+		return;
+	}
+	
+	grid_hierarchy scaled( gh );
+	scaled *= linear( type );
+	write( type, icoord, scaled );
+}
+
+void output_set::write( field_type type, const grid_hierarchy& gh )
+{
+	call( [&](){
+		switch( type )
+		{
+			case dm_mass:       plugin_->write_dm_mass( gh ); break;
+			case dm_density:    plugin_->write_dm_density( gh ); break;
+			case dm_potential:  plugin_->write_dm_potential( gh ); break;
+			case gas_density:   plugin_->write_gas_density( gh ); break;
+			case gas_potential: plugin_->write_gas_potential( gh ); break;
+		}
+	} );
+}
+
+void output_set::write( vector_field_output::field_type type, int icoord, const grid_hierarchy& gh )
+{
+	call( [&](){
+		switch( type )
+		{
+			case vector_field_output::dm_position:  dm_position_.write( icoord, gh ); break;
+			case vector_field_output::dm_velocity:  dm_velocity_.write( icoord, gh ); break;
+			case vector_field_output::gas_position: gas_position_.write( icoord, gh ); break;
+			case vector_field_output::gas_velocity: gas_velocity_.write( icoord, gh ); break;
+		}
+	} );
+}
+
+void output_set::finalize( void )
+{
+	call( [&](){ plugin_->finalize(); } );
+}
@@ -20,9 +20,12 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 #include "general.hh"
 #include "mesh.hh"
+#include "temp_storage.hh"
 
 
 /*!
@@ -91,6 +94,9 @@ public:
 		query_grid_prop( "size", 0, std::back_inserter(sizex_) );
 		query_grid_prop( "size", 1, std::back_inserter(sizey_) );
 		query_grid_prop( "size", 2, std::back_inserter(sizez_) );
+
+		//... decide where plug-ins keep their temporary particle files
+		music::temp_storage::init( cf_ );
 	}
 	
 	//! destructor
@@ -123,6 +129,47 @@ public:
 	
 	//! purely virtual prototype to write the baryon gravitational potential (from which displacements are computed in 1LPT)
 	virtual void write_gas_potential( const grid_hierarchy& gh )  = 0;
+
+	//! plug-ins that implement the vector field interface below natively return true
+	/*! the driver then keeps all three components of a field in memory and hands them over at once */
+	virtual bool supports_vector_fields( void ) const
+	{ return false; }
+
+	//! write all three components of the dark matter particle positions, defaults to one call per component
+	virtual void write_dm_positions( const grid_hierarchy& x, const grid_hierarchy& y, const grid_hierarchy& z )
+	{
+		write_dm_position( 0, x );
+		write_dm_position( 1, y );
+		write_dm_position( 2, z );
+	}
+
+	//! write all three components of the dark matter particle velocities, defaults to one call per component
+	virtual void write_dm_velocities( const grid_hierarchy& vx, const grid_hierarchy& vy, const grid_hierarchy& vz )
+	{
+		write_dm_velocity( 0, vx );
+		write_dm_velocity( 1, vy );
+		write_dm_velocity( 2, vz );
+	}
+
+	//! write all three components of the baryon coordinates, defaults to one call per component
+	virtual void write_gas_positions( const grid_hierarchy& x, const grid_hierarchy& y, const grid_hierarchy& z )
+	{
+		write_gas_position( 0, x );
+		write_gas_position( 1, y );
+		write_gas_position( 2, z );
+	}
+
+	//! write all three components of the baryon velocities, defaults to one call per component
+	virtual void write_gas_velocities( const grid_hierarchy& vx, const grid_hierarchy& vy, const grid_hierarchy& vz )
+	{
+		write_gas_velocity( 0, vx );
+		write_gas_velocity( 1, vy );
+		write_gas_velocity( 2, vz );
+	}
+	
+	//! plug-ins that write through the HDF5 library return true, they are never run concurrently
+	virtual bool writes_hdf5( void ) const
+	{ return false; }
 	
 	//! purely virtual prototype for all things to be done at the very end
 	virtual void finalize( void ) = 0;
@@ -168,4 +215,134 @@ struct output_plugin_creator_concrete : public output_plugin_creator
 //! failsafe version to select the output plug-in
 output_plugin *select_output_plugin( config_file& cf );
 
+/*!
+ * @class vector_field_output
+ * @brief passes the components of a particle field to an output plug-in
+ *
+ * The driver computes the components of positions and velocities one after
+ * the other. For plug-ins without native vector field support each component
+ * is written right away, as before. Otherwise the first two components are
+ * kept until the third one is available and all three are written at once.
+ */
+class vector_field_output
+{
+public:
+	enum field_type { dm_position, dm_velocity, gas_position, gas_velocity };
+
+protected:
+	output_plugin *plugin_;
+	field_type type_;
+	std::unique_ptr<grid_hierarchy> comp_[2];
+
+public:
+	vector_field_output( output_plugin *plugin, field_type type )
+	: plugin_( plugin ), type_( type )
+	{ }
+
+	//! hand over component icoord (0,1,2, in this order) of the field
+	void write( int icoord, const grid_hierarchy& gh );
+};
+
+/*!
+ * @class output_set
+ * @brief an additional output written from the fields of the run
+ *
+ * Every field the driver writes is the sum of a part linear in the white
+ * noise and, with 2LPT, a second order part. An output set writes
+ *
+ *   lin * (linear part) + second * (second order part)
+ *
+ * with its own pair of coefficients for positions (and densities,
+ * potentials) and for velocities. This gives the paired realisation
+ * ([setup] paired, lin = -1, second = 1) and the outputs at the further
+ * redshifts of a [setup] zstart list (growth rescaling) without computing
+ * any field again.
+ *
+ * Each set has its own instance of the output plug-in and its own set of
+ * temporary files. The configuration entries in which it differs from
+ * the run (file name, zstart, ...) are in effect during every call into
+ * the plug-in.
+ */
+class output_set
+{
+public:
+	enum field_type { dm_mass, dm_density, dm_potential, gas_density, gas_potential };
+
+	//! coefficients of the linear and the second order part
+	struct scaling
+	{
+		double xlin, x2lpt; //!< positions, densities and potentials
+		double vlin, v2lpt; //!< velocities
+	};
+
+protected:
+	config_file& cf_;
+	int id_;
+	std::map<std::string, std::string> overrides_;
+	scaling scale_;
+	output_plugin *plugin_;
+	vector_field_output dm_position_, dm_velocity_, gas_position_, gas_velocity_;
+
+	//! call f with the configuration and the temporary files of this set
+	template< typename F >
+	void call( F f );
+
+	output_plugin *create_plugin( void );
+
+public:
+	//! velocity factor at the redshift of this set (cosmo_vfact of the driver)
+	double vfact;
+
+	//! zero_zoom_velocity counter mode of this set, in velocity units
+	double counter_mode_amp[3];
+
+	/*! @param id number of the set (1,2,...), keeps its temporary files apart
+	 *  @param overrides 'section/key' entries of cf in which the set differs, at least 'output/filename'
+	 *  @param scale coefficients of the linear and second order parts
+	 *  @param vf velocity factor at the redshift of the set */
+	output_set( config_file& cf, int id, const std::map<std::string, std::string>& overrides, const scaling& scale, double vf );
+	
+	~output_set();
+	
+	//! name of the output file of this set
+	std::string filename( void ) const;
+	
+	//! coefficient of the linear part of a particle field
+	double linear( vector_field_output::field_type type ) const;
+	
+	//! coefficient of the linear part of a density or potential
+	double linear( void ) const
+	{ return scale_.xlin; }
+	
+	//! out = lin * (full - q) + second * q, for the full particle field and its second order part q, in one pass
+	void combine( vector_field_output::field_type type, const grid_hierarchy& full, const grid_hierarchy& q, grid_hierarchy& out ) const;
+	
+	//! as above, for a potential
+	void combine( const grid_hierarchy& full, const grid_hierarchy& q, grid_hierarchy& out ) const
+	{ combine( vector_field_output::dm_position, full, q, out ); }
+	
+	//! write a field that is linear in the white noise, gh being the field of the run
+	void write_linear( field_type type, const grid_hierarchy& gh );
+	
+	//! write component icoord of a particle field that is linear in the white noise, gh being the field of the run
+	void write_linear( vector_field_output::field_type type, int icoord, const grid_hierarchy& gh );
+	
+	//! write a field of this set
+	void write( field_type type, const grid_hierarchy& gh );
+	
+	//! write component icoord of a particle field of this set
+	void write( vector_field_output::field_type type, int icoord, const grid_hierarchy& gh );
+	
+	void finalize( void );
+};
+
+//! number of outputs a run writes, one per entry of the [setup] zstart list, twice that with [setup] paired
+unsigned num_outputs( config_file& cf );
+
+//! the formats a run writes, the [output] formats list for the 'multi' plug-in, else [output] format
+std::vector<std::string> output_formats( config_file& cf );
+
+//! fname with suffix inserted before the extension, ics.dat -> ics<suffix>.dat, ics -> ics<suffix>
+std::string output_filename_with_suffix( const std::string& fname, const std::string& suffix );
+
 #endif // __OUTPUT_HH
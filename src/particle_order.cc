@@ -0,0 +1,203 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include <particle_order.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+namespace
+{
+
+//... tables of the Peano-Hilbert curve as used in Gadget-2 (peano.c), so that
+//... keys agree with those of the domain decomposition of Gadget and its descendants
+const int quadrants[24][2][2][2] = {
+		/* rotx=0, roty=0-3 */
+		{{{0, 7}, {1, 6}}, {{3, 4}, {2, 5}}},
+		{{{7, 4}, {6, 5}}, {{0, 3}, {1, 2}}},
+		{{{4, 3}, {5, 2}}, {{7, 0}, {6, 1}}},
+		{{{3, 0}, {2, 1}}, {{4, 7}, {5, 6}}},
+		/* rotx=1, roty=0-3 */
+		{{{1, 0}, {6, 7}}, {{2, 3}, {5, 4}}},
+		{{{0, 3}, {7, 4}}, {{1, 2}, {6, 5}}},
+		{{{3, 2}, {4, 5}}, {{0, 1}, {7, 6}}},
+		{{{2, 1}, {5, 6}}, {{3, 0}, {4, 7}}},
+		/* rotx=2, roty=0-3 */
+		{{{6, 1}, {7, 0}}, {{5, 2}, {4, 3}}},
+		{{{1, 2}, {0, 3}}, {{6, 5}, {7, 4}}},
+		{{{2, 5}, {3, 4}}, {{1, 6}, {0, 7}}},
+		{{{5, 6}, {4, 7}}, {{2, 1}, {3, 0}}},
+		/* rotx=3, roty=0-3 */
+		{{{7, 6}, {0, 1}}, {{4, 5}, {3, 2}}},
+		{{{6, 5}, {1, 2}}, {{7, 4}, {0, 3}}},
+		{{{5, 4}, {2, 3}}, {{6, 7}, {1, 0}}},
+		{{{4, 7}, {3, 0}}, {{5, 6}, {2, 1}}},
+		{{{6, 7}, {5, 4}}, {{1, 0}, {2, 3}}},
+		{{{7, 0}, {4, 3}}, {{6, 1}, {5, 2}}},
+		{{{0, 1}, {3, 2}}, {{7, 6}, {4, 5}}},
+		{{{1, 6}, {2, 5}}, {{0, 7}, {3, 4}}},
+		{{{2, 3}, {1, 0}}, {{5, 4}, {6, 7}}},
+		{{{3, 4}, {0, 7}}, {{2, 5}, {1, 6}}},
+		{{{4, 5}, {7, 6}}, {{3, 2}, {0, 1}}},
+		{{{5, 2}, {6, 1}}, {{4, 3}, {7, 0}}}};
+
+const int rotxmap_table[24] = {4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 17, 18, 19, 16, 23, 20, 21, 22};
+const int rotymap_table[24] = {1, 2, 3, 0, 16, 17, 18, 19, 11, 8, 9, 10, 22, 23, 20, 21, 14, 15, 12, 13, 4, 5, 6, 7};
+const int rotx_table[8] = {3, 0, 0, 2, 2, 0, 0, 1};
+const int roty_table[8] = {0, 1, 1, 2, 2, 3, 3, 0};
+const int sense_table[8] = {-1, -1, -1, +1, +1, -1, -1, -1};
+
+bool compare_key(const leaf_cell_order::cell &a, const leaf_cell_order::cell &b)
+{
+	return a.key < b.key;
+}
+
+} // namespace
+
+particle_ordering get_particle_ordering(config_file &cf)
+{
+	std::string order = cf.get_value_safe<std::string>("output", "particle_order", "none");
+
+	if (order == "none")
+		return particle_ordering::none;
+	if (order == "slab")
+		return particle_ordering::slab;
+	if (order == "morton")
+		return particle_ordering::morton;
+	if (order == "hilbert" || order == "peano-hilbert")
+		return particle_ordering::hilbert;
+
+	music::elog.Print("Unknown particle ordering \'%s\' in [output] particle_order. Use one of none, slab, morton, hilbert.", order.c_str());
+	throw std::runtime_error("Unknown particle ordering");
+}
+
+std::string particle_ordering_name(particle_ordering order)
+{
+	switch (order)
+	{
+	case particle_ordering::slab:
+		return "slab";
+	case particle_ordering::morton:
+		return "morton";
+	case particle_ordering::hilbert:
+		return "hilbert";
+	default:
+		return "none";
+	}
+}
+
+uint64_t morton_key(uint32_t x, uint32_t y, uint32_t z, int bits)
+{
+	uint64_t key = 0;
+	for (int i = bits - 1; i >= 0; --i)
+	{
+		key <<= 3;
+		key |= (uint64_t)(((x >> i) & 1) << 2 | ((y >> i) & 1) << 1 | ((z >> i) & 1));
+	}
+	return key;
+}
+
+uint64_t peano_hilbert_key(uint32_t x, uint32_t y, uint32_t z, int bits)
+{
+	uint32_t mask = 1u << (bits - 1);
+	uint64_t key = 0;
+	int rotation = 0, sense = 1;
+
+	for (int i = 0; i < bits; ++i, mask >>= 1)
+	{
+		int bitx = (x & mask) ? 1 : 0;
+		int bity = (y & mask) ? 1 : 0;
+		int bitz = (z & mask) ? 1 : 0;
+
+		int quad = quadrants[rotation][bitx][bity][bitz];
+
+		key <<= 3;
+		key += (sense == 1) ? quad : (7 - quad);
+
+		int rotx = rotx_table[quad];
+		int roty = roty_table[quad];
+		sense *= sense_table[quad];
+
+		while (rotx-- > 0)
+			rotation = rotxmap_table[rotation];
+
+		while (roty-- > 0)
+			rotation = rotymap_table[rotation];
+	}
+
+	return key;
+}
+
+uint64_t particle_key(particle_ordering order, uint32_t x, uint32_t y, uint32_t z, int bits)
+{
+	switch (order)
+	{
+	case particle_ordering::hilbert:
+		return peano_hilbert_key(x, y, z, bits);
+	case particle_ordering::morton:
+		return morton_key(x, y, z, bits);
+	default:
+		return ((uint64_t)x << (2 * bits)) | ((uint64_t)y << bits) | (uint64_t)z;
+	}
+}
+
+void leaf_cell_order::parallel_sort(std::vector<cell> &cells)
+{
+	int nthreads = 1;
+#if defined(_OPENMP)
+	nthreads = omp_get_max_threads();
+#endif
+	const size_t n = cells.size();
+
+	if (nthreads < 2 || n < 65536)
+	{
+		std::sort(cells.begin(), cells.end(), compare_key);
+		return;
+	}
+
+	//... sort nthreads chunks independently, then merge pairs of chunks in log2(nthreads) rounds
+	std::vector<size_t> bounds(nthreads + 1);
+	for (int ic = 0; ic <= nthreads; ++ic)
+		bounds[ic] = n * ic / nthreads;
+
+#pragma omp parallel for
+	for (int ic = 0; ic < nthreads; ++ic)
+		std::sort(cells.begin() + bounds[ic], cells.begin() + bounds[ic + 1], compare_key);
+
+	for (int width = 1; width < nthreads; width *= 2)
+	{
+#pragma omp parallel for
+		for (int ic = 0; ic < nthreads; ic += 2 * width)
+		{
+			if (ic + width >= nthreads)
+				continue;
+			size_t ilo = bounds[ic];
+			size_t imid = bounds[ic + width];
+			size_t ihi = bounds[std::min(ic + 2 * width, nthreads)];
+			std::inplace_merge(cells.begin() + ilo, cells.begin() + imid, cells.begin() + ihi, compare_key);
+		}
+	}
+}
+
+} // namespace music
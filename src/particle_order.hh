@@ -0,0 +1,168 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+#include <config_file.hh>
+
+namespace music
+{
+
+//! order in which the particles of one type are emitted, selected by [output] particle_order
+enum class particle_ordering
+{
+	none,		//!< level-major, row-major (i,j,k) order of the grid loops (default)
+	slab,		//!< row-major (x,y,z) order of the unperturbed particle position on the finest grid
+	morton,	//!< Morton (z-order) key of the unperturbed particle position
+	hilbert //!< Peano-Hilbert key, identical to the one used by the Gadget domain decomposition
+};
+
+//! read [output] particle_order from the config file
+particle_ordering get_particle_ordering(config_file &cf);
+
+//! name of an ordering as used in the config file
+std::string particle_ordering_name(particle_ordering order);
+
+//! interleave the lowest 'bits' bits of x,y,z into a Morton key
+uint64_t morton_key(uint32_t x, uint32_t y, uint32_t z, int bits);
+
+//! Peano-Hilbert key of the integer coordinates x,y,z with 'bits' bits per dimension
+uint64_t peano_hilbert_key(uint32_t x, uint32_t y, uint32_t z, int bits);
+
+//! key of the integer coordinates x,y,z with 'bits' bits per dimension for the given ordering
+uint64_t particle_key(particle_ordering order, uint32_t x, uint32_t y, uint32_t z, int bits);
+
+/*!
+ * @class leaf_cell_order
+ * @brief enumerates the leaf cells of a range of levels in particle output order
+ *
+ * Particle plug-ins emit one particle per leaf cell. Instead of looping over
+ * the grids themselves, they call for_each with the range of levels that
+ * makes up one particle type. Without ordering the cells are visited
+ * level by level in (i,j,k) order, as before. With Morton or Peano-Hilbert
+ * ordering all leaf cells of the level range are sorted by the key of their
+ * position on the grid of the finest level, so that simulation codes find
+ * their particles (nearly) sorted along the space filling curve they use
+ * for the domain decomposition. The sorted cell lists are cached per level
+ * range, so that all fields of a particle type are written in the same
+ * order and the sort is done only once.
+ */
+class leaf_cell_order
+{
+public:
+	struct cell
+	{
+		uint64_t key;
+		int i, j, k;
+		int level;
+	};
+
+protected:
+	particle_ordering order_;
+	std::map<std::pair<int, int>, std::vector<cell>> cache_;
+
+	//! sort cells by key using all threads
+	static void parallel_sort(std::vector<cell> &cells);
+
+public:
+	explicit leaf_cell_order(particle_ordering order = particle_ordering::none)
+			: order_(order)
+	{
+	}
+
+	particle_ordering ordering(void) const { return order_; }
+
+	//! leaf cells of levels levelhi down to levello sorted by key (not available for particle_ordering::none)
+	template <typename grid_hierarchy_t>
+	const std::vector<cell> &sorted_cells(const grid_hierarchy_t &gh, int levelhi, int levello)
+	{
+		if (order_ == particle_ordering::none)
+			throw std::runtime_error("leaf_cell_order : sorted cells requested without particle ordering");
+
+		auto it = cache_.find({levelhi, levello});
+		if (it != cache_.end())
+			return it->second;
+
+		std::vector<cell> &cells = cache_[{levelhi, levello}];
+		cells.reserve(gh.count_leaf_cells(levello, levelhi));
+
+		for (int ilevel = levelhi; ilevel >= levello; --ilevel)
+			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
+				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
+					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
+						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
+							cells.push_back({0, (int)i, (int)j, (int)k, ilevel});
+
+		//... keys are computed on the grid of the finest level, so that particles of
+		//... different levels that end up in the same type are ordered consistently
+		int bits = gh.levelmax();
+		if (bits > 21)
+			throw std::runtime_error("leaf_cell_order : particle ordering supports at most 21 levels");
+
+		const long long ncells = (long long)cells.size();
+
+#pragma omp parallel for
+		for (long long ic = 0; ic < ncells; ++ic)
+		{
+			cell &c = cells[ic];
+			int nl = 1 << c.level, shift = bits - c.level;
+			uint32_t x = (uint32_t)(((gh.offset_abs(c.level, 0) + c.i) % nl + nl) % nl) << shift;
+			uint32_t y = (uint32_t)(((gh.offset_abs(c.level, 1) + c.j) % nl + nl) % nl) << shift;
+			uint32_t z = (uint32_t)(((gh.offset_abs(c.level, 2) + c.k) % nl + nl) % nl) << shift;
+
+			c.key = particle_key(order_, x, y, z, bits);
+		}
+
+		parallel_sort(cells);
+
+		return cells;
+	}
+
+	//! call f(ilevel,i,j,k) for all leaf cells of levels levelhi down to levello in output order
+	template <typename grid_hierarchy_t, typename F>
+	void for_each(const grid_hierarchy_t &gh, int levelhi, int levello, F f)
+	{
+		if (order_ == particle_ordering::none)
+		{
+			for (int ilevel = levelhi; ilevel >= levello; --ilevel)
+				for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
+					for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
+						for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
+							if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
+								f(ilevel, i, j, k);
+			return;
+		}
+
+		for (const cell &c : sorted_cells(gh, levelhi, levello))
+			f(c.level, (unsigned)c.i, (unsigned)c.j, (unsigned)c.k);
+	}
+
+	//! release the cached cell lists
+	void clear(void)
+	{
+		cache_.clear();
+	}
+};
+
+} // namespace music
@@ -27,8 +27,14 @@
 #include <typeinfo>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include "hdf5.h"
 
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
 template<typename T>
 hid_t GetDataType( void )
 {
@@ -66,6 +72,254 @@ class HDFException : public std::runtime_error {
 };
 
 
+//! tuning parameters of the HDF5 file access and data transfer used by all writers below
+struct HDFIOParameters
+{
+  hsize_t alignment_threshold;  //!< objects at least this large are aligned ...
+  hsize_t alignment;            //!< ... to multiples of this (0: off)
+  size_t  sieve_buf_size;       //!< data sieve buffer in bytes (0: library default)
+  hsize_t meta_block_size;      //!< metadata aggregation block in bytes (0: library default)
+  size_t  transfer_buf_size;    //!< type conversion buffer in bytes (0: library default)
+  bool    use_mpiio;            //!< write through the MPI-IO driver (parallel HDF5 only)
+  bool    collective;           //!< collective instead of independent MPI-IO transfers
+  std::string cb_buffer_size, cb_nodes, striping_factor, striping_unit; //!< MPI-IO hints (empty: not set)
+  int     deflate_level;        //!< deflate level 1..9 of grid datasets (0: uncompressed)
+  bool    shuffle;              //!< byte shuffle before deflate
+  size_t  chunk_bytes;          //!< target size of one chunk of a compressed grid dataset
+
+  HDFIOParameters( void )
+  : alignment_threshold(1), alignment(0), sieve_buf_size(0), meta_block_size(0), transfer_buf_size(0),
+    use_mpiio(false), collective(true), deflate_level(0), shuffle(true), chunk_bytes(1<<20)
+  { }
+};
+
+inline HDFIOParameters& HDFGetIOParameters( void )
+{
+  static HDFIOParameters params;
+  return params;
+}
+
+//! read the hdf5_* tuning knobs from the [output] section of the config file
+template< typename config_t >
+inline void HDFSetIOParameters( config_t& cf )
+{
+  HDFIOParameters& p = HDFGetIOParameters();
+  
+  p.alignment           = cf.template get_value_safe<size_t>("output","hdf5_alignment",0);
+  p.alignment_threshold = cf.template get_value_safe<size_t>("output","hdf5_alignment_threshold",1);
+  p.sieve_buf_size      = cf.template get_value_safe<size_t>("output","hdf5_sieve_buffer",0);
+  p.meta_block_size     = cf.template get_value_safe<size_t>("output","hdf5_meta_block_size",0);
+  p.transfer_buf_size   = cf.template get_value_safe<size_t>("output","hdf5_transfer_buffer",0);
+  p.use_mpiio           = cf.template get_value_safe<bool>("output","hdf5_mpiio",false);
+  p.collective          = cf.template get_value_safe<bool>("output","hdf5_collective",true);
+  p.cb_buffer_size      = cf.template get_value_safe<std::string>("output","hdf5_cb_buffer_size","");
+  p.cb_nodes            = cf.template get_value_safe<std::string>("output","hdf5_cb_nodes","");
+  p.striping_factor     = cf.template get_value_safe<std::string>("output","hdf5_striping_factor","");
+  p.striping_unit       = cf.template get_value_safe<std::string>("output","hdf5_striping_unit","");
+  p.deflate_level       = cf.template get_value_safe<int>("output","hdf5_deflate",0);
+  p.shuffle             = cf.template get_value_safe<bool>("output","hdf5_shuffle",true);
+  p.chunk_bytes         = cf.template get_value_safe<size_t>("output","hdf5_chunk_size",1<<20);
+  
+  if( p.deflate_level < 0 || p.deflate_level > 9 )
+    throw HDFException("[HDF_IO] hdf5_deflate has to be in 0..9");
+  if( p.chunk_bytes == 0 )
+    throw HDFException("[HDF_IO] hdf5_chunk_size has to be positive");
+  
+#if defined(H5_HAVE_PARALLEL)
+  if( p.use_mpiio ){
+    int initialized = 0;
+    MPI_Initialized( &initialized );
+    if( !initialized ){
+      MPI_Init( NULL, NULL );
+      std::atexit( [](){ int finalized = 0; MPI_Finalized( &finalized ); if( !finalized ) MPI_Finalize(); } );
+    }
+  }
+#else
+  if( p.use_mpiio ){
+    std::cerr << " - Warning: [HDF_IO] hdf5_mpiio requested, but HDF5 was built without parallel support. Ignoring.\n";
+    p.use_mpiio = false;
+  }
+#endif
+}
+
+//! new file access property list according to the current HDFIOParameters, to be closed by the caller
+inline hid_t HDFFileAccessPList( void )
+{
+  const HDFIOParameters& p = HDFGetIOParameters();
+  hid_t plist = H5Pcreate( H5P_FILE_ACCESS );
+  
+  if( p.alignment > 0 )
+    H5Pset_alignment( plist, p.alignment_threshold, p.alignment );
+  if( p.sieve_buf_size > 0 )
+    H5Pset_sieve_buf_size( plist, p.sieve_buf_size );
+  if( p.meta_block_size > 0 )
+    H5Pset_meta_block_size( plist, p.meta_block_size );
+  
+#if defined(H5_HAVE_PARALLEL)
+  if( p.use_mpiio ){
+    //... the file is written by one process, the MPI-IO layer is used for its
+    //... collective buffering and file system (e.g. Lustre striping) hints
+    MPI_Info info;
+    MPI_Info_create( &info );
+    if( !p.cb_buffer_size.empty() )  MPI_Info_set( info, "cb_buffer_size", p.cb_buffer_size.c_str() );
+    if( !p.cb_nodes.empty() )        MPI_Info_set( info, "cb_nodes", p.cb_nodes.c_str() );
+    if( !p.striping_factor.empty() ) MPI_Info_set( info, "striping_factor", p.striping_factor.c_str() );
+    if( !p.striping_unit.empty() )   MPI_Info_set( info, "striping_unit", p.striping_unit.c_str() );
+    H5Pset_fapl_mpio( plist, MPI_COMM_SELF, info );
+    MPI_Info_free( &info );
+  }
+#endif
+  
+  return plist;
+}
+
+//! new data transfer property list according to the current HDFIOParameters, to be closed by the caller
+inline hid_t HDFTransferPList( void )
+{
+  const HDFIOParameters& p = HDFGetIOParameters();
+  hid_t plist = H5Pcreate( H5P_DATASET_XFER );
+  
+  if( p.transfer_buf_size > 0 )
+    H5Pset_buffer( plist, p.transfer_buf_size, NULL, NULL );
+  
+#if defined(H5_HAVE_PARALLEL)
+  if( p.use_mpiio )
+    H5Pset_dxpl_mpio( plist, p.collective? H5FD_MPIO_COLLECTIVE : H5FD_MPIO_INDEPENDENT );
+#endif
+  
+  return plist;
+}
+
+//! H5Fcreate with the configured file access properties
+inline hid_t HDFFileCreate( const std::string Filename, unsigned flags )
+{
+  hid_t plist = HDFFileAccessPList();
+  hid_t file_id = H5Fcreate( Filename.c_str(), flags, H5P_DEFAULT, plist );
+  H5Pclose( plist );
+  return file_id;
+}
+
+//! H5Fopen with the configured file access properties
+inline hid_t HDFFileOpen( const std::string Filename, unsigned flags )
+{
+  hid_t plist = HDFFileAccessPList();
+  hid_t file_id = H5Fopen( Filename.c_str(), flags, plist );
+  H5Pclose( plist );
+  return file_id;
+}
+
+//! H5Dwrite with the configured data transfer properties
+inline herr_t HDFDatasetWrite( hid_t dset_id, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, const void *buf )
+{
+  hid_t plist = HDFTransferPList();
+  herr_t status = H5Dwrite( dset_id, mem_type_id, mem_space_id, file_space_id, plist, buf );
+  H5Pclose( plist );
+  return status;
+}
+
+//! dataset creation property list for a grid dataset, chunked along split_dim with shuffle+deflate if
+//! compression is enabled (chunk receives the chunk dimensions), to be closed by the caller
+inline hid_t HDFGridCreatePList( int rank, const hsize_t *dims, int split_dim, size_t elem_size, hsize_t *chunk )
+{
+  const HDFIOParameters& p = HDFGetIOParameters();
+  hid_t plist = H5Pcreate( H5P_DATASET_CREATE );
+  
+  for( int i=0; i<rank; ++i )
+    chunk[i] = dims[i];
+  
+  if( p.deflate_level == 0 )
+    return plist;
+  
+  //... chunks are slabs of whole slices along split_dim of about chunk_bytes
+  size_t slice_bytes = elem_size;
+  for( int i=split_dim+1; i<rank; ++i )
+    slice_bytes *= dims[i];
+  chunk[split_dim] = std::max<hsize_t>( 1, std::min<hsize_t>( dims[split_dim], p.chunk_bytes / slice_bytes ) );
+  
+  H5Pset_chunk( plist, rank, chunk );
+  if( p.shuffle )
+    H5Pset_shuffle( plist );
+  H5Pset_deflate( plist, p.deflate_level );
+  
+  return plist;
+}
+
+//! compress whole chunks of a grid dataset created with HDFGridCreatePList on all threads and write them
+//! directly, bypassing the (serial) HDF5 filter pipeline. data holds nslices slices of split_dim
+//! starting at slice0. Returns false if this is not possible, the caller then uses a normal H5Dwrite.
+template< typename T >
+inline bool HDFWriteChunksParallel( hid_t dset_id, int rank, const hsize_t *dims, const hsize_t *chunk, int split_dim,
+                                    hsize_t slice0, hsize_t nslices, const T *data )
+{
+#if defined(HAVE_ZLIB) && H5_VERSION_GE(1,10,3)
+  const HDFIOParameters& p = HDFGetIOParameters();
+  
+  if( p.deflate_level == 0 || p.use_mpiio )
+    return false;
+  
+  //... whole chunks only, and the chunk data has to be contiguous in memory
+  for( int i=0; i<split_dim; ++i )
+    if( dims[i] != 1 ) return false;
+  const hsize_t cs = chunk[split_dim];
+  if( slice0 % cs != 0 || (nslices % cs != 0 && slice0 + nslices != dims[split_dim]) )
+    return false;
+  
+  size_t slice_elems = 1;
+  for( int i=split_dim+1; i<rank; ++i )
+    slice_elems *= dims[i];
+  
+  const size_t chunk_elems = cs * slice_elems, chunk_bytes = chunk_elems * sizeof(T);
+  const long long nchunks = (long long)((nslices + cs - 1) / cs);
+  
+  //... compress a batch of chunks in parallel, then write them in order
+  const long long batch = 64;
+  std::vector< std::vector<unsigned char> > cbuf( batch );
+  std::vector< size_t > csize( batch );
+  bool bok = true;
+  
+  for( long long ib=0; ib<nchunks && bok; ib+=batch )
+  {
+    long long nb = std::min( batch, nchunks - ib );
+    
+    #pragma omp parallel for schedule(dynamic) reduction(&&:bok)
+    for( long long ic=0; ic<nb; ++ic )
+    {
+      size_t s0 = (ib + ic) * cs, ns = std::min<size_t>( cs, nslices - s0 );
+      const unsigned char *src = reinterpret_cast<const unsigned char*>( data + s0 * slice_elems );
+      
+      //... edge chunks are stored at full size, zero padded
+      std::vector<unsigned char> raw( chunk_bytes, 0 );
+      if( p.shuffle ){
+        //... same byte transposition as the HDF5 shuffle filter
+        for( size_t i=0; i<ns*slice_elems; ++i )
+          for( size_t b=0; b<sizeof(T); ++b )
+            raw[b*chunk_elems+i] = src[i*sizeof(T)+b];
+      }else
+        memcpy( &raw[0], src, ns * slice_elems * sizeof(T) );
+      
+      uLongf clen = compressBound( chunk_bytes );
+      cbuf[ic].resize( clen );
+      bok = bok && (compress2( &cbuf[ic][0], &clen, &raw[0], chunk_bytes, p.deflate_level ) == Z_OK);
+      csize[ic] = clen;
+    }
+    
+    for( long long ic=0; ic<nb && bok; ++ic )
+    {
+      std::vector<hsize_t> offset( rank, 0 );
+      offset[split_dim] = slice0 + (ib + ic) * cs;
+      bok = H5Dwrite_chunk( dset_id, H5P_DEFAULT, 0, &offset[0], csize[ic], &cbuf[ic][0] ) >= 0;
+    }
+  }
+  
+  if( !bok )
+    throw HDFException("[HDF_IO] parallel chunk compression failed");
+  
+  return true;
+#else
+  return false;
+#endif
+}
+
 inline bool DoesFileExist( std::string Filename ){
         bool flag = false;
         std::fstream fin(Filename.c_str(),std::ios::in|std::ios::binary);
@@ -86,7 +340,7 @@ inline void AssertFileOpen( std::string Filename )
 inline void HDFCreateFile( std::string Filename )
 {
   hid_t HDF_FileID;
-  HDF_FileID = H5Fcreate( Filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT );
+  HDF_FileID = HDFFileCreate( Filename, H5F_ACC_TRUNC );
   H5Fclose( HDF_FileID );
 }
 
@@ -636,7 +890,7 @@ inline void HDFWriteDataset( const std::string Filename, const std::string ObjNa
 
   hsize_t HDF_Dims;
 
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 
   HDF_Type                = GetDataType<T>();
 
@@ -644,8 +898,7 @@ inline void HDFWriteDataset( const std::string Filename, const std::string ObjNa
   HDF_DataspaceID         = H5Screate_simple(1, &HDF_Dims, NULL);
   HDF_DatasetID           = H5Dcreate( HDF_FileID, ObjName.c_str(), HDF_Type,
                                        HDF_DataspaceID, H5P_DEFAULT );
-  H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-            H5P_DEFAULT, &Data[0] );
+  HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &Data[0] );
   H5Dclose( HDF_DatasetID );
   H5Sclose( HDF_DataspaceID );
 
@@ -665,7 +918,7 @@ inline void HDFWriteGroupDataset( const std::string Filename, const std::string
 
   hsize_t HDF_Dims;
 
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
   
   HDF_GroupID = H5Gopen( HDF_FileID, GrpName.c_str() );
 
@@ -675,8 +928,7 @@ inline void HDFWriteGroupDataset( const std::string Filename, const std::string
   HDF_DataspaceID         = H5Screate_simple(1, &HDF_Dims, NULL);
   HDF_DatasetID           = H5Dcreate( HDF_GroupID, ObjName.c_str(), HDF_Type,
                                        HDF_DataspaceID, H5P_DEFAULT );
-  H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-            H5P_DEFAULT, &Data[0] );
+  HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &Data[0] );
   H5Dclose( HDF_DatasetID );
   H5Sclose( HDF_DataspaceID );
   
@@ -698,7 +950,7 @@ inline void HDFWriteDataset2D( const std::string Filename, const std::string Obj
 
   hsize_t HDF_Dims[2];
 
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 
   HDF_Type                = GetDataType<T>();
 
@@ -716,8 +968,7 @@ inline void HDFWriteDataset2D( const std::string Filename, const std::string Obj
       tmp[k++] = (Data[i])[j];
     }
 
-  H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-            H5P_DEFAULT, tmp );
+  HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, tmp );
 
   delete[] tmp;
 
@@ -739,7 +990,7 @@ inline void HDFWriteDataset3D( const std::string Filename, const std::string Obj
 
   hsize_t HDF_Dims[3];
 
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 
   HDF_Type                = GetDataType<T>();
 
@@ -748,12 +999,15 @@ inline void HDFWriteDataset3D( const std::string Filename, const std::string Obj
   HDF_Dims[2]             = nd[2];
   
   //std::cerr << nd[0]<<nd[1]<<nd[2]<<"\n";
+  hsize_t HDF_Chunk[3];
+  hid_t HDF_CreatePList   = HDFGridCreatePList( 3, HDF_Dims, 0, sizeof(T), HDF_Chunk );
   HDF_DataspaceID         = H5Screate_simple(3, HDF_Dims, NULL);
   HDF_DatasetID           = H5Dcreate( HDF_FileID, ObjName.c_str(), HDF_Type,
-                                       HDF_DataspaceID, H5P_DEFAULT );
+                                       HDF_DataspaceID, HDF_CreatePList );
+  H5Pclose( HDF_CreatePList );
 
-  H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-            H5P_DEFAULT, &Data[0] );
+  if( !HDFWriteChunksParallel( HDF_DatasetID, 3, HDF_Dims, HDF_Chunk, 0, 0, HDF_Dims[0], &Data[0] ) )
+    HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &Data[0] );
 
   H5Dclose( HDF_DatasetID );
   H5Sclose( HDF_DataspaceID );
@@ -766,23 +1020,32 @@ template< typename T >
 struct HDFHyperslabWriter3Ds
 {
 	hid_t dset_id_, type_id_, file_id_;
+	hsize_t sizes_[4], chunk_[4];
 	
 	HDFHyperslabWriter3Ds( const std::string Filename, const std::string ObjName, size_t nd[3] )
 	{
-		hid_t filespace;
+		hid_t filespace, createplist;
 		
-		hsize_t sizes[4] = { 1, nd[0], nd[1], nd[2] };
+		sizes_[0] = 1; sizes_[1] = nd[0]; sizes_[2] = nd[1]; sizes_[3] = nd[2];
 		
 		type_id_	= GetDataType<T>();
-		file_id_	= H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+		file_id_	= HDFFileOpen( Filename, H5F_ACC_RDWR );
 		
 		//std::cerr << "creating filespace : 1 x " << nd[0] << " x " << nd[1] << " x " << nd[2] << std::endl;
-		filespace	= H5Screate_simple( 4, sizes, NULL );
-		dset_id_	= H5Dcreate( file_id_, ObjName.c_str(), type_id_, filespace, H5P_DEFAULT );
+		filespace	= H5Screate_simple( 4, sizes_, NULL );
+		createplist	= HDFGridCreatePList( 4, sizes_, 1, sizeof(T), chunk_ );
+		dset_id_	= H5Dcreate( file_id_, ObjName.c_str(), type_id_, filespace, createplist );
 		
+		H5Pclose(createplist);
 		H5Sclose(filespace);
 	}
 	
+	//! number of slices per chunk, slabs that are multiples of it are compressed in parallel
+	size_t chunk_slices( void ) const
+	{
+		return chunk_[1];
+	}
+	
 	~HDFHyperslabWriter3Ds()
 	{
 		H5Dclose( dset_id_ );
@@ -795,6 +1058,10 @@ struct HDFHyperslabWriter3Ds
 		hsize_t counts[4] = { 1, count[0], count[1], count[2] };
 		hsize_t offsets[4] = { 0, offset[0], offset[1], offset[2] };
 		
+		if( offset[1] == 0 && offset[2] == 0 && count[1] == sizes_[2] && count[2] == sizes_[3]
+		    && HDFWriteChunksParallel( dset_id_, 4, sizes_, chunk_, 1, offset[0], count[0], data ) )
+			return;
+		
 		hid_t filespace = H5Dget_space(dset_id_);
 		
 		//std::cerr << "creating memspace : 1 x " << count[0] << " x " << count[1] << " x " << count[2] << std::endl;
@@ -803,7 +1070,7 @@ struct HDFHyperslabWriter3Ds
 		
 		//herr_t status;
 		//status = 
-		H5Dwrite(dset_id_, type_id_, memspace, filespace, H5P_DEFAULT, reinterpret_cast<void*>(data));
+		HDFDatasetWrite(dset_id_, type_id_, memspace, filespace, reinterpret_cast<void*>(data));
 		H5Sclose(filespace);
 		H5Sclose(memspace);
 	}
@@ -823,7 +1090,7 @@ inline void HDFWriteDataset3Ds( const std::string Filename, const std::string Ob
 	
 	hsize_t HDF_Dims[4];
 	
-	HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+	HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 	
 	HDF_Type                = GetDataType<T>();
 	
@@ -837,8 +1104,7 @@ inline void HDFWriteDataset3Ds( const std::string Filename, const std::string Ob
 	HDF_DatasetID           = H5Dcreate( HDF_FileID, ObjName.c_str(), HDF_Type,
 										HDF_DataspaceID, H5P_DEFAULT );
 	
-	H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-			 H5P_DEFAULT, &Data[0] );
+	HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &Data[0] );
 	
 	H5Dclose( HDF_DatasetID );
 	H5Sclose( HDF_DataspaceID );
@@ -861,7 +1127,7 @@ inline void HDFWriteDatasetVector( const std::string Filename, const std::string
 
   //  hsize_t HDF_Dims;
 
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 
   HDF_Type                = GetDataType<T>();
 
@@ -877,8 +1143,7 @@ inline void HDFWriteDatasetVector( const std::string Filename, const std::string
   HDF_DataspaceID         = H5Screate_simple(2, HDF_Dims, NULL);
   HDF_DatasetID           = H5Dcreate( HDF_FileID, ObjName.c_str(), H5T_NATIVE_FLOAT,
                                        HDF_DataspaceID, H5P_DEFAULT );
-  H5Dwrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL,
-            H5P_DEFAULT, &Data[0] );
+  HDFDatasetWrite( HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &Data[0] );
   H5Dclose( HDF_DatasetID );
   H5Sclose( HDF_DataspaceID );
 
@@ -889,7 +1154,7 @@ inline void HDFCreateGroup( const std::string Filename, const std::string GroupN
 {
 	hid_t HDF_FileID, HDF_GroupID;
 
-	HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+	HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 	HDF_GroupID = H5Gcreate( HDF_FileID, GroupName.c_str(), 0 );
 	H5Gclose( HDF_GroupID );
 	H5Fclose( HDF_FileID );
@@ -900,7 +1165,7 @@ inline void HDFCreateSubGroup( const std::string Filename, const std::string Sup
 {
 	hid_t HDF_FileID, HDF_GroupID, HDF_SuperGroupID;
 
-	HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+	HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
   HDF_SuperGroupID = H5Gopen( HDF_FileID, SuperGroupName.c_str() );
 	HDF_GroupID = H5Gcreate( HDF_SuperGroupID, GroupName.c_str(), 0 );
 	H5Gclose( HDF_GroupID );
@@ -925,7 +1190,7 @@ inline void HDFWriteGroupAttribute( const std::string Filename, const std::strin
  HDF_Dims = (hsize_t)(Data.size());
 
  
- HDF_FileID      = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );  
+ HDF_FileID      = HDFFileOpen( Filename, H5F_ACC_RDWR );  
  HDF_GroupID     = H5Gopen( HDF_FileID, GroupName.c_str() );  
  HDF_DataspaceID = H5Screate_simple(1, &HDF_Dims, NULL);
 
@@ -953,7 +1218,7 @@ inline void HDFWriteDatasetAttribute( const std::string Filename, const std::str
 	HDF_Dims = (hsize_t)(Data.size());
 	
 	
-	HDF_FileID      = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );  
+	HDF_FileID      = HDFFileOpen( Filename, H5F_ACC_RDWR );  
 	HDF_DatasetID   = H5Dopen( HDF_FileID, DatasetName.c_str() );  
 	HDF_DataspaceID = H5Screate_simple(1, &HDF_Dims, NULL);
 	
@@ -982,7 +1247,7 @@ Data )
 
   
   
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
   HDF_GroupID = H5Gopen( HDF_FileID, GroupName.c_str() );
   HDF_DataspaceID         = H5Screate(H5S_SCALAR);
   HDF_AttributeID         = H5Acreate(HDF_GroupID, ObjName.c_str(), HDF_DatatypeID,
@@ -1009,7 +1274,7 @@ inline void HDFWriteDatasetAttribute( const std::string Filename, const std::str
 	
 	
 	
-	HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+	HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
 	HDF_DatasetID = H5Dopen( HDF_FileID, DatasetName.c_str() );
 	HDF_DataspaceID         = H5Screate(H5S_SCALAR);
 	HDF_AttributeID         = H5Acreate(HDF_DatasetID, ObjName.c_str(), HDF_DatatypeID,
@@ -1038,7 +1303,7 @@ Data )
 
   
   
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
   std::cerr << "opening " << GroupName.c_str() << std::endl;
   HDF_GroupID = H5Gopen( HDF_FileID, GroupName.c_str() );
   std::cerr << "opening " << SubGroupName.c_str() << std::endl;
@@ -1070,7 +1335,7 @@ inline void HDFWriteGroupAttribute<std::string>( const std::string Filename, con
   H5Tset_size( HDF_DatatypeID, Data.size() );
   H5Tset_strpad(HDF_DatatypeID, H5T_STR_NULLPAD);
   
-  HDF_FileID = H5Fopen( Filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT );
+  HDF_FileID = HDFFileOpen( Filename, H5F_ACC_RDWR );
   HDF_GroupID = H5Gopen( HDF_FileID, GroupName.c_str() );
   HDF_DataspaceID         = H5Screate(H5S_SCALAR);
   HDF_AttributeID         = H5Acreate(HDF_GroupID, ObjName.c_str(), HDF_DatatypeID,
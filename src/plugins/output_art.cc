@@ -15,6 +15,7 @@
 #include <vector>
 
 #include "output.hh"
+#include "file_writer.hh"
 
 template <typename T>
 inline T bytereorder(T v)
@@ -172,7 +173,7 @@ protected:
 		else
 			fout = "/PMcrd.DAT";
 		std::string partfname = fname_ + fout;
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
+		music::file_writer ofs(partfname);
 		//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
 		header this_header(header_);
 		//Should be 529 in a dm only run; 533 in a baryon run
@@ -249,7 +250,7 @@ protected:
 	void write_pt_file(void) //pt.dat
 	{
 		std::string partfname = fname_ + "/pt.dat";
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
+		music::file_writer ofs(partfname);
 		//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
 		ptf this_ptf(ptf_);
 		int blksize = sizeof(ptf); //4
@@ -296,16 +297,16 @@ protected:
 			fout = "/PMcrs0.DAT";
 
 		std::string partfname = fname_ + fout;
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
+		music::file_writer ofs(partfname);
 
 		// generate all temp file names
 		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
-		snprintf(fnx,  256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 0);
-		snprintf(fny,  256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 1);
-		snprintf(fnz,  256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 2);
-		snprintf(fnvx, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + 0);
-		snprintf(fnvy, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + 1);
-		snprintf(fnvz, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + 2);
+		music::temp_storage::get_filename(fnx, 256, 100 * id_dm_pos + 0);
+		music::temp_storage::get_filename(fny, 256, 100 * id_dm_pos + 1);
+		music::temp_storage::get_filename(fnz, 256, 100 * id_dm_pos + 2);
+		music::temp_storage::get_filename(fnvx, 256, 100 * id_dm_vel + 0);
+		music::temp_storage::get_filename(fnvy, 256, 100 * id_dm_vel + 1);
+		music::temp_storage::get_filename(fnvz, 256, 100 * id_dm_vel + 2);
 
 		// create buffers for temporary data
 		T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
@@ -416,16 +417,16 @@ protected:
 	{
 		// file name
 		std::string partfname = fname_ + "/PMcrs0_GAS.DAT";
-		std::ofstream ofs(partfname.c_str(), std::ios::trunc);
+		music::file_writer ofs(partfname);
 
 		// generate all temp file names
 		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
-		snprintf(fnx,  256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 0);
-		snprintf(fny,  256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 1);
-		snprintf(fnz,  256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 2);
-		snprintf(fnvx, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + 0);
-		snprintf(fnvy, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + 1);
-		snprintf(fnvz, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + 2);
+		music::temp_storage::get_filename(fnx, 256, 100 * id_gas_pos + 0);
+		music::temp_storage::get_filename(fny, 256, 100 * id_gas_pos + 1);
+		music::temp_storage::get_filename(fnz, 256, 100 * id_gas_pos + 2);
+		music::temp_storage::get_filename(fnvx, 256, 100 * id_gas_vel + 0);
+		music::temp_storage::get_filename(fnvy, 256, 100 * id_gas_vel + 1);
+		music::temp_storage::get_filename(fnvz, 256, 100 * id_gas_vel + 2);
 
 		// create buffers for temporary data
 		T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
@@ -645,7 +646,7 @@ public:
 		double xfac = (double)header_.NGRIDC;
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_pos + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		size_t blksize = sizeof(T_store) * nptot;
@@ -709,7 +710,7 @@ public:
 		double vfac = (header_.aexpN * header_.NGRIDC) / (100.0);
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_vel + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		size_t blksize = sizeof(T_store) * nptot;
@@ -772,7 +773,7 @@ public:
 		double xfac = (double)header_.NGRIDC;
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_pos + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		size_t blksize = sizeof(T_store) * nptot;
@@ -836,7 +837,7 @@ public:
 		double vfac = (header_.aexpN * header_.NGRIDC) / (100.0);
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_vel + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		size_t blksize = sizeof(T_store) * nptot;
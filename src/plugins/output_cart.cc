@@ -15,6 +15,7 @@
 #include <vector>
 
 #include "output.hh"
+#include "file_writer.hh"
 
 template<typename T>
 inline T bytereorder(T v )
@@ -163,7 +164,7 @@ class cart_output_plugin : public output_plugin
 				headfname = fname_ + "/music_D.mdh";
 			}
 			//std::string headfname = fname_ + "/PMcrd.DAT";
-			std::ofstream ofs( headfname.c_str(), std::ios::trunc );
+			music::file_writer ofs( headfname );
 			//ofs.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
 			header this_header(header_);
 			//Should be 529 in a dm only run; 533 in a baryon run
@@ -293,16 +294,16 @@ class cart_output_plugin : public output_plugin
 				partfname = fname_ + "/music_D.mdxv";
 			}
 			//std::string partfname = fname_ + "/PMcrs0.DAT";
-			std::ofstream ofs( partfname.c_str(), std::ios::trunc );
+			music::file_writer ofs( partfname );
 
 			// generate all temp file names
 			char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256];
-			snprintf( fnx,  256, "___ic_temp_%05d.bin", 100*id_dm_pos+0 );
-			snprintf( fny,  256, "___ic_temp_%05d.bin", 100*id_dm_pos+1 );
-			snprintf( fnz,  256, "___ic_temp_%05d.bin", 100*id_dm_pos+2 );
-			snprintf( fnvx, 256, "___ic_temp_%05d.bin", 100*id_dm_vel+0 );
-			snprintf( fnvy, 256, "___ic_temp_%05d.bin", 100*id_dm_vel+1 );
-			snprintf( fnvz, 256, "___ic_temp_%05d.bin", 100*id_dm_vel+2 );
+			music::temp_storage::get_filename(fnx, 256, 100*id_dm_pos+0);
+			music::temp_storage::get_filename(fny, 256, 100*id_dm_pos+1);
+			music::temp_storage::get_filename(fnz, 256, 100*id_dm_pos+2);
+			music::temp_storage::get_filename(fnvx, 256, 100*id_dm_vel+0);
+			music::temp_storage::get_filename(fnvy, 256, 100*id_dm_vel+1);
+			music::temp_storage::get_filename(fnvz, 256, 100*id_dm_vel+2);
 
 			// create buffers for temporary data
 			T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6;
@@ -418,17 +419,17 @@ class cart_output_plugin : public output_plugin
 			}else{
 				hydrofname = fname_ + "/music_D.md";
 			}
-			std::ofstream ofs( hydrofname.c_str(), std::ios::trunc );
+			music::file_writer ofs( hydrofname );
 
 			// generate all temp file names
 			char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256],fnpma[256]; //add fields here
-			snprintf( fnx,  256, "___ic_temp_%05d.bin", 100*id_gas_pos+0 );
-			snprintf( fny,  256, "___ic_temp_%05d.bin", 100*id_gas_pos+1 );
-			snprintf( fnz,  256, "___ic_temp_%05d.bin", 100*id_gas_pos+2 );
-			snprintf( fnvx, 256, "___ic_temp_%05d.bin", 100*id_gas_vel+0 );
-			snprintf( fnvy, 256, "___ic_temp_%05d.bin", 100*id_gas_vel+1 );
-			snprintf( fnvz, 256, "___ic_temp_%05d.bin", 100*id_gas_vel+2 );
-			snprintf( fnpma,256, "___ic_temp_%05d.bin", 100*id_gas_pma ); //add fields here
+			music::temp_storage::get_filename(fnx, 256, 100*id_gas_pos+0);
+			music::temp_storage::get_filename(fny, 256, 100*id_gas_pos+1);
+			music::temp_storage::get_filename(fnz, 256, 100*id_gas_pos+2);
+			music::temp_storage::get_filename(fnvx, 256, 100*id_gas_vel+0);
+			music::temp_storage::get_filename(fnvy, 256, 100*id_gas_vel+1);
+			music::temp_storage::get_filename(fnvz, 256, 100*id_gas_vel+2);
+			music::temp_storage::get_filename(fnpma, 256, 100*id_gas_pma); //add fields here
 
 			// create buffers for temporary data
 			T_store *tmp1, *tmp2, *tmp3, *tmp4, *tmp5, *tmp6, *tmp7; //add fields here
@@ -668,7 +669,7 @@ class cart_output_plugin : public output_plugin
 			double xfac = (double) header_.NGRIDC;
 
 			char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_pos+coord );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_pos+coord);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 
 			size_t blksize = sizeof(T_store)*nptot;
@@ -746,7 +747,7 @@ class cart_output_plugin : public output_plugin
 			//snl	    exit(1);
 
 			char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_vel+coord );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_vel+coord);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 
 			size_t blksize = sizeof(T_store)*nptot;
@@ -819,7 +820,7 @@ class cart_output_plugin : public output_plugin
 			}
 
 			char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_gas_vel+coord );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_gas_vel+coord);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 
 			size_t blksize = sizeof(T_store)*nptot;
@@ -873,7 +874,7 @@ class cart_output_plugin : public output_plugin
 
 			// write gas positions to cell centers
 			for (int coord=0; coord < 3; coord++ ) {
-				snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_gas_pos+coord );
+				music::temp_storage::get_filename(temp_fname, 256, 100*id_gas_pos+coord);
 				std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 				ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
@@ -924,7 +925,7 @@ class cart_output_plugin : public output_plugin
 			{
 				double pmafac = header_.Omb0 / header_.Om0 ;
 				double pma;
-				snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_gas_pma);
+				music::temp_storage::get_filename(temp_fname, 256, 100*id_gas_pma);
 				std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
 				ofs_temp.write( (char *)&blksize, sizeof(size_t) );
 
@@ -14,6 +14,7 @@ Copyright (C) 2010  Oliver Hahn
 #include <sys/stat.h>
 
 #include "output.hh"
+#include "grid_compression.hh"
 
 #include "HDF_IO.hh"
 
@@ -48,6 +49,8 @@ protected:
 
 	sim_header the_sim_header;
 
+	music::grid_error_bounds error_bounds_;
+
 	void write_sim_header(std::string fname, const sim_header &h)
 	{
 		HDFWriteGroupAttribute(fname, "/", "Dimensions", h.dimensions);
@@ -188,7 +191,7 @@ protected:
 		}
 	}
 
-	void dump_grid_data(std::string fieldname, const grid_hierarchy &gh, double factor = 1.0, double add = 0.0)
+	void dump_grid_data(std::string fieldname, const grid_hierarchy &gh, music::grid_field_kind kind, double factor = 1.0, double add = 0.0)
 	{
 		char enzoname[256], filename[512];
 
@@ -233,6 +236,10 @@ protected:
 			//... create full array in file
 			HDFHyperslabWriter3Ds<real_t> *slab_writer = new HDFHyperslabWriter3Ds<real_t>(filename, enzoname, nsz);
 
+			//... slabs of whole chunks can be compressed in parallel
+			if (slices_in_slab > slab_writer->chunk_slices())
+				slices_in_slab -= slices_in_slab % slab_writer->chunk_slices();
+
 			//... create buffer
 			real_t *data_buf = new real_t[slices_in_slab * (size_t)ng[0] * (size_t)ng[1]];
 
@@ -249,6 +256,8 @@ protected:
 							data_buf[(size_t)(k * ng[1] + j) * (size_t)ng[0] + (size_t)i] =
 									(add + (*gh.get_grid(ilevel))(i, j, k + slices_written)) * factor;
 
+				music::round_to_error_bound(data_buf, slices_in_slab * (size_t)ng[0] * (size_t)ng[1], error_bounds_.get(kind));
+
 				size_t count[3], offset[3];
 
 				count[0] = slices_in_slab;
@@ -298,7 +307,7 @@ protected:
 
 public:
 	enzo_output_plugin(config_file &cf)
-			: output_plugin(cf)
+			: output_plugin(cf), error_bounds_(cf)
 	{
 		if (mkdir(fname_.c_str(), 0777))
 		{
@@ -306,6 +315,9 @@ public:
 			throw std::runtime_error("Error in enzo_output_plugin!");
 		}
 
+		//... HDF5 file access and transfer tuning, see HDF_IO.hh
+		HDFSetIOParameters(cf);
+
 		bool bhave_hydro = cf_.get_value<bool>("setup", "baryons");
 		bool align_top = cf.get_value_safe<bool>("setup", "align_top", false);
 
@@ -555,7 +567,7 @@ public:
 
 		double vunit = 1.0 / (1.225e2 * sqrt(the_sim_header.omega_m / the_sim_header.a_start));
 
-		dump_grid_data(enzoname, gh, vunit);
+		dump_grid_data(enzoname, gh, music::grid_field_kind::velocity, vunit);
 	}
 
 	void write_dm_position(int coord, const grid_hierarchy &gh)
@@ -563,7 +575,7 @@ public:
 		char enzoname[256];
 		snprintf(enzoname, 256, "ParticleDisplacements_%c", (char)('x' + coord));
 
-		dump_grid_data(enzoname, gh);
+		dump_grid_data(enzoname, gh, music::grid_field_kind::displacement);
 	}
 
 	void write_dm_potential(const grid_hierarchy &gh)
@@ -580,7 +592,7 @@ public:
 
 		char enzoname[256];
 		snprintf(enzoname, 256, "GridVelocities_%c", (char)('x' + coord));
-		dump_grid_data(enzoname, gh, vunit);
+		dump_grid_data(enzoname, gh, music::grid_field_kind::velocity, vunit);
 	}
 
 	void write_gas_position(int coord, const grid_hierarchy &gh)
@@ -593,7 +605,12 @@ public:
 
 		char enzoname[256];
 		snprintf(enzoname, 256, "GridDensity");
-		dump_grid_data(enzoname, gh, the_sim_header.omega_b / the_sim_header.omega_m, 1.0);
+		dump_grid_data(enzoname, gh, music::grid_field_kind::density, the_sim_header.omega_b / the_sim_header.omega_m, 1.0);
+	}
+
+	bool writes_hdf5(void) const
+	{
+		return true;
 	}
 
 	void finalize(void)
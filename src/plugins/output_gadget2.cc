@@ -13,6 +13,9 @@
 #include "logger.hh"
 #include "region_generator.hh"
 #include "output.hh"
+#include "file_writer.hh"
+#include "gadget_io.hh"
+#include "particle_order.hh"
 #include "mg_interp.hh"
 #include "mesh.hh"
 
@@ -28,7 +31,7 @@ public:
 	bool shift_halfcell_;
 
 protected:
-	std::ofstream ofs_;
+	music::file_writer ofs_;
 	bool blongids_;
 	bool bhave_particlenumbers_;
 
@@ -86,18 +89,237 @@ protected:
 
 	unsigned bndparticletype_;
 	bool bmorethan2bnd_;
+
+	//... masses of the boundary particle type if it holds more than one level; they are
+	//... generated while assembling the file instead of being stored in a temporary file
+	std::vector<double> coarse_pmass_;			//!< particle mass per level
+	std::vector<size_t> coarse_np_per_level_; //!< number of boundary particles per level
+	std::vector<uint8_t> coarse_level_;				//!< level of each boundary particle, only with particle ordering
+	int coarse_levelhi_;
 	bool kpcunits_;
 	bool msolunits_;
 	double YHe_;
 	bool spread_coarse_acrosstypes_;
+	bool bvector_io_;
+
+	music::leaf_cell_order cell_order_;
+
+	std::string split_mode_;
+	std::vector<std::vector<unsigned>> np_per_file_split_;
+	std::vector<uint64_t> split_keys_;
 
 	refinement_mask refmask;
 
+	struct level_group
+	{
+		int levelhi, levello;
+		unsigned itype;
+	};
+
+	//! the ranges of levels (finest first) whose particles are stored as one particle type
+	std::vector<level_group> particle_type_groups(const grid_hierarchy &gh, int levelhi) const
+	{
+		//... the finest level is type 1, coarser levels are spread over types 2-5 or all of type bndparticletype_
+		int lmin = (int)gh.levelmin();
+		int lcoarse = spread_coarse_acrosstypes_ ? (int)gh.levelmax() - 4 : (int)gh.levelmax() - 1;
+
+		std::vector<level_group> groups;
+		for (int ilevel = levelhi; ilevel >= lmin;)
+		{
+			int ilevello = (ilevel <= lcoarse) ? lmin : ilevel;
+			unsigned itype = std::min<int>((int)gh.levelmax() - ilevel + 1, 5);
+			if (!spread_coarse_acrosstypes_ && itype > 1)
+				itype = bndparticletype_;
+			groups.push_back({ilevel, ilevello, itype});
+			ilevel = ilevello - 1;
+		}
+		return groups;
+	}
+
+	//! call f(ilevel,i,j,k) for all particles of levels levelhi..levelmin, grouped by particle type
+	template <typename F>
+	void for_each_particle_cell(const grid_hierarchy &gh, int levelhi, F f)
+	{
+		for (auto &g : particle_type_groups(gh, levelhi))
+			cell_order_.for_each(gh, g.levelhi, g.levello, f);
+	}
+
+	//! split the particles of every type into nfiles_ contiguous segments along the space filling curve
+	void determine_spatial_split(const grid_hierarchy &gh)
+	{
+		typedef music::leaf_cell_order::cell cell;
+
+		std::vector<const std::vector<cell> *> cells;
+		std::vector<unsigned> types;
+		size_t ntotal = 0;
+		for (auto &g : particle_type_groups(gh, gh.levelmax()))
+		{
+			cells.push_back(&cell_order_.sorted_cells(gh, g.levelhi, g.levello));
+			types.push_back(g.itype);
+			ntotal += cells.back()->size();
+		}
+
+		auto key_less = [](const cell &c, uint64_t key)
+		{ return c.key < key; };
+
+		auto count_below = [&](size_t igroup, uint64_t key) -> size_t
+		{ return std::lower_bound(cells[igroup]->begin(), cells[igroup]->end(), key, key_less) - cells[igroup]->begin(); };
+
+		auto count_below_all = [&](uint64_t key)
+		{
+			size_t n = 0;
+			for (size_t ig = 0; ig < cells.size(); ++ig)
+				n += count_below(ig, key);
+			return n;
+		};
+
+		//... segment boundaries balance the total particle number, all types share the same segments
+		const uint64_t keyend = 1ull << (3 * gh.levelmax());
+		split_keys_.assign(nfiles_ + 1, 0);
+		split_keys_[nfiles_] = keyend;
+
+		for (unsigned ifile = 1; ifile < nfiles_; ++ifile)
+		{
+			size_t ntarget = ntotal * ifile / nfiles_;
+			uint64_t klo = split_keys_[ifile - 1], khi = keyend;
+			while (klo < khi)
+			{
+				uint64_t kmid = klo + (khi - klo) / 2;
+				if (count_below_all(kmid) < ntarget)
+					klo = kmid + 1;
+				else
+					khi = kmid;
+			}
+			split_keys_[ifile] = klo;
+		}
+
+		np_per_file_split_.assign(nfiles_, std::vector<unsigned>(6, 0));
+		for (size_t ig = 0; ig < cells.size(); ++ig)
+			for (unsigned ifile = 0; ifile < nfiles_; ++ifile)
+				np_per_file_split_[ifile][types[ig]] += count_below(ig, split_keys_[ifile + 1]) - count_below(ig, split_keys_[ifile]);
+
+		if (do_baryons_)
+			for (unsigned ifile = 0; ifile < nfiles_; ++ifile)
+				np_per_file_split_[ifile][0] = np_per_file_split_[ifile][1];
+	}
+
+	//! write components coord0, coord0+1, ... of a particle field to their temporary files in one pass over the hierarchy
+	/*! value(icoord,ilevel,i,j,k,v) converts the grid value v of component icoord to the stored quantity */
+	template <typename F>
+	void write_temp_components(int id, int coord0, const std::vector<const grid_hierarchy *> &comps, F value, std::string what)
+	{
+		//... count number of leaf cells ...//
+		determine_particle_numbers(*comps[0]);
+
+		size_t npart = 0;
+		for (int i = 1; i < 6; ++i)
+			npart += np_per_type_[i];
+
+		const size_t ncomp = comps.size();
+		const size_t blksize = sizeof(T_store) * npart;
+		size_t nwritten = 0;
+
+		std::vector<std::vector<T_store>> temp_data(ncomp);
+		std::vector<std::ofstream> ofs_temp(ncomp);
+
+		for (size_t ic = 0; ic < ncomp; ++ic)
+		{
+			char temp_fname[256];
+			music::temp_storage::get_filename(temp_fname, 256, 100 * id + coord0 + ic);
+			ofs_temp[ic].open(temp_fname, std::ios::binary | std::ios::trunc);
+			ofs_temp[ic].write((char *)&blksize, sizeof(size_t));
+			temp_data[ic].reserve(block_buf_size_);
+		}
+
+		auto flush_blocks = [&](void)
+		{
+			nwritten += temp_data[0].size();
+			for (size_t ic = 0; ic < ncomp; ++ic)
+			{
+				ofs_temp[ic].write((char *)&temp_data[ic][0], sizeof(T_store) * temp_data[ic].size());
+				temp_data[ic].clear();
+			}
+		};
+
+		for_each_particle_cell(*comps[0], comps[0]->levelmax(), [&](int ilevel, unsigned i, unsigned j, unsigned k)
+		{
+			if (temp_data[0].size() == block_buf_size_)
+				flush_blocks();
+
+			for (size_t ic = 0; ic < ncomp; ++ic)
+				temp_data[ic].push_back(value(coord0 + ic, ilevel, i, j, k, (*comps[ic]->get_grid(ilevel))(i, j, k)));
+		});
+
+		if (temp_data[0].size() > 0)
+			flush_blocks();
+
+		if (nwritten != npart)
+			throw std::runtime_error("Internal consistency error while writing temporary file for " + what);
+
+		//... dump to temporary file
+		for (size_t ic = 0; ic < ncomp; ++ic)
+		{
+			ofs_temp[ic].write((char *)&blksize, sizeof(size_t));
+
+			if (ofs_temp[ic].bad())
+				throw std::runtime_error("I/O error while writing temporary file for " + what);
+		}
+	}
+
+	//! collect displacements and convert to absolute coordinates with correct units
+	void write_position_components(int id, int coord0, const std::vector<const grid_hierarchy *> &comps, bool bgas)
+	{
+		const grid_hierarchy &gh = *comps[0];
+
+		//... determine if we need to shift the coordinates back
+		double shift = shift_halfcell_ ? -1.0 / (1 << (levelmin_ + 1)) : 0.0;
+
+		//... shift gas particle positions (this has to be done as the same shift
+		//... is used when computing the convolution kernel for SPH baryons)
+		if (bgas)
+			shift += 0.5 / (1ul << gh.levelmax());
+
+		double xfac = header_.BoxSize;
+
+		write_temp_components(id, coord0, comps, [&](int icoord, int ilevel, unsigned i, unsigned j, unsigned k, double disp)
+		{
+			double xx[3];
+			gh.cell_pos(ilevel, i, j, k, xx);
+			return (xx[icoord] + shift + disp) * xfac;
+		}, bgas ? "gas positions" : "positions");
+	}
+
+	//! collect velocities and convert to correct units
+	void write_velocity_components(int id, int coord0, const std::vector<const grid_hierarchy *> &comps, bool bgas)
+	{
+		float isqrta = 1.0f / sqrt(header_.time);
+		float vfac = isqrta * header_.BoxSize;
+
+		// if( kpcunits_ )
+		//   vfac /= 1000.0;
+		vfac *= unit_length_chosen_ / unit_vel_chosen_;
+
+		write_temp_components(id, coord0, comps, [&](int icoord, int ilevel, unsigned i, unsigned j, unsigned k, double v)
+		{
+			return v * vfac;
+		}, bgas ? "gas velocities" : "velocities");
+	}
+
 	void distribute_particles(unsigned nfiles, std::vector<std::vector<unsigned>> &np_per_file, std::vector<unsigned> &np_tot_per_file)
 	{
 		np_per_file.assign(nfiles, std::vector<unsigned>(6, 0));
 		np_tot_per_file.assign(nfiles, 0);
 
+		//... spatial split, the numbers have been determined from the particle keys
+		if (!np_per_file_split_.empty())
+		{
+			np_per_file = np_per_file_split_;
+			for (unsigned i = 0; i < nfiles; ++i)
+				for (int itype = 0; itype < 6; ++itype)
+					np_tot_per_file[i] += np_per_file[i][itype];
+			return;
+		}
+
 		size_t n2dist[6];
 		size_t ntotal = 0;
 		for (int i = 0; i < 6; ++i)
@@ -284,8 +506,8 @@ protected:
 
 			/*** positions ***/
 
-			snprintf(fc, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + icomp);
-			snprintf(fb, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + icomp);
+			music::temp_storage::get_filename(fc, 256, 100 * id_dm_pos + icomp);
+			music::temp_storage::get_filename(fb, 256, 100 * id_gas_pos + icomp);
 
 			iffs1.open(fc, nptot, npfine * sizeof(T_store));
 			iffs2.open(fb, nptot, npfine * sizeof(T_store));
@@ -315,8 +537,8 @@ protected:
 
 			/*** velocities ***/
 
-			snprintf(fc, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + icomp);
-			snprintf(fb, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + icomp);
+			music::temp_storage::get_filename(fc, 256, 100 * id_dm_vel + icomp);
+			music::temp_storage::get_filename(fb, 256, 100 * id_gas_vel + icomp);
 
 			iffs1.open(fc, nptot, npfine * sizeof(T_store));
 			iffs2.open(fb, nptot, npfine * sizeof(T_store));
@@ -347,6 +569,66 @@ protected:
 		}
 	}
 
+	//! write the particle numbers, key ranges and bounding boxes of the spatially split files
+	void write_domain_file(const std::vector<std::vector<unsigned>> &np_per_file, const std::vector<std::vector<double>> &file_bbox)
+	{
+		std::string dfname = fname_ + ".domains";
+		FILE *fp = fopen(dfname.c_str(), "w");
+		if (fp == NULL)
+		{
+			music::elog.Print("gadget-2 output plug-in could not open domain file '%s' for writing!", dfname.c_str());
+			throw std::runtime_error("gadget-2 output plug-in could not open domain file for writing");
+		}
+
+		fprintf(fp, "# Gadget2 ICs split into %u files by %s keys with %u bits per dimension\n", nfiles_, split_mode_.c_str(), levelmax_);
+		fprintf(fp, "# box size = %g, bounding boxes are in the same units and not periodically wrapped\n", header_.BoxSize);
+		fprintf(fp, "# file key_begin key_end npart0 npart1 npart2 npart3 npart4 npart5 xmin ymin zmin xmax ymax zmax\n");
+
+		for (unsigned ifile = 0; ifile < nfiles_; ++ifile)
+		{
+			fprintf(fp, "%u %llu %llu", ifile, (unsigned long long)split_keys_[ifile], (unsigned long long)split_keys_[ifile + 1]);
+			for (int itype = 0; itype < 6; ++itype)
+				fprintf(fp, " %u", np_per_file[ifile][itype]);
+			for (int i = 0; i < 6; ++i)
+				fprintf(fp, " %g", file_bbox[ifile][i]);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+
+		music::ilog.Print("Gadget2 : wrote domain information to '%s'", dfname.c_str());
+	}
+
+	//! masses of the boundary type particles first..first+n-1 (counted over all files)
+	void fill_coarse_masses(size_t first, size_t n, T_store *m) const
+	{
+		if (!coarse_level_.empty())
+		{
+#pragma omp parallel for
+			for (long long i = 0; i < (long long)n; ++i)
+				m[i] = coarse_pmass_[coarse_level_[first + i]];
+			return;
+		}
+
+		//... without particle ordering the levels follow each other, finest first
+		size_t lstart = 0;
+		for (int ilevel = coarse_levelhi_; ilevel >= (int)levelmin_ && n > 0; --ilevel)
+		{
+			size_t lend = lstart + coarse_np_per_level_[ilevel];
+			if (first < lend)
+			{
+				size_t nl = std::min(n, lend - first);
+				std::fill(m, m + nl, (T_store)coarse_pmass_[ilevel]);
+				m += nl;
+				first += nl;
+				n -= nl;
+			}
+			lstart = lend;
+		}
+
+		if (n > 0)
+			throw std::runtime_error("Internal consistency error while generating masses");
+	}
+
 	void assemble_gadget_file(void)
 	{
 
@@ -356,23 +638,22 @@ protected:
 		//............................................................................
 		//... copy from the temporary files, interleave the data and save ............
 
-		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256], fnm[256];
+		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
 		char fnbx[256], fnby[256], fnbz[256], fnbvx[256], fnbvy[256], fnbvz[256];
 
-		snprintf(fnx, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 0);
-		snprintf(fny, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 1);
-		snprintf(fnz, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 2);
-		snprintf(fnvx, 256,"___ic_temp_%05d.bin", 100 * id_dm_vel + 0);
-		snprintf(fnvy, 256,"___ic_temp_%05d.bin", 100 * id_dm_vel + 1);
-		snprintf(fnvz, 256,"___ic_temp_%05d.bin", 100 * id_dm_vel + 2);
-		snprintf(fnm, 256, "___ic_temp_%05d.bin", 100 * id_dm_mass);
-
-		snprintf(fnbx, 256,"___ic_temp_%05d.bin", 100 * id_gas_pos + 0);
-		snprintf(fnby, 256,"___ic_temp_%05d.bin", 100 * id_gas_pos + 1);
-		snprintf(fnbz, 256,"___ic_temp_%05d.bin", 100 * id_gas_pos + 2);
-		snprintf(fnbvx,256,"___ic_temp_%05d.bin", 100 * id_gas_vel + 0);
-		snprintf(fnbvy,256,"___ic_temp_%05d.bin", 100 * id_gas_vel + 1);
-		snprintf(fnbvz,256,"___ic_temp_%05d.bin", 100 * id_gas_vel + 2);
+		music::temp_storage::get_filename(fnx, 256, 100 * id_dm_pos + 0);
+		music::temp_storage::get_filename(fny, 256, 100 * id_dm_pos + 1);
+		music::temp_storage::get_filename(fnz, 256, 100 * id_dm_pos + 2);
+		music::temp_storage::get_filename(fnvx, 256, 100 * id_dm_vel + 0);
+		music::temp_storage::get_filename(fnvy, 256, 100 * id_dm_vel + 1);
+		music::temp_storage::get_filename(fnvz, 256, 100 * id_dm_vel + 2);
+
+		music::temp_storage::get_filename(fnbx, 256, 100 * id_gas_pos + 0);
+		music::temp_storage::get_filename(fnby, 256, 100 * id_gas_pos + 1);
+		music::temp_storage::get_filename(fnbz, 256, 100 * id_gas_pos + 2);
+		music::temp_storage::get_filename(fnbvx, 256, 100 * id_gas_vel + 0);
+		music::temp_storage::get_filename(fnbvy, 256, 100 * id_gas_vel + 1);
+		music::temp_storage::get_filename(fnbvz, 256, 100 * id_gas_vel + 2);
 
 		pistream iffs1, iffs2, iffs3;
 
@@ -381,10 +662,11 @@ protected:
 				// npgas = np_fine_gas_,
 				npcdm = nptot - np_per_type_[0];
 
-		size_t
-				wrote_coarse = 0,
-				wrote_gas = 0,
-				wrote_dm = 0;
+		//... particles of each type written to previous files, and offset of each type in the temporary files
+		size_t wrote_type[6] = {0, 0, 0, 0, 0, 0};
+		size_t dm_type_offset[6] = {0, 0, 0, 0, 0, 0};
+		for (int itype = 2; itype < 6; ++itype)
+			dm_type_offset[itype] = dm_type_offset[itype - 1] + np_per_type_[itype - 1];
 
 		size_t
 				npleft = nptot,
@@ -418,7 +700,7 @@ protected:
 
 		if (nfiles_ > 1)
 		{
-			music::ilog.Print("Gadget2 : distributing particles to %d files", nfiles_);
+			music::ilog.Print("Gadget2 : distributing particles to %d files (split by %s)", nfiles_, split_mode_.c_str());
 			//<< "                 " << std::setw(12) << "type 0" << "," << std::setw(12) << "type 1" << "," << std::setw(12) << "type " << bndparticletype_ << std::endl;
 			for (unsigned i = 0; i < nfiles_; ++i)
 				music::ilog.Print("      file %i : %12llu", i, np_tot_per_file[i], header_.mass[i]);
@@ -426,7 +708,6 @@ protected:
 
 		size_t curr_block_buf_size = block_buf_size_;
 
-		size_t idcount = 0;
 		bool bneed_long_ids = blongids_;
 		if (nptot >= 1ul << 32 && !bneed_long_ids)
 		{
@@ -434,18 +715,36 @@ protected:
 			music::wlog.Print("Need long particle IDs, will write 64bit, make sure to enable in Gadget!");
 		}
 
+		//... bounding box (xmin,ymin,zmin,xmax,ymax,zmax) of the particles in each file, not periodically wrapped
+		std::vector<std::vector<double>> file_bbox(nfiles_);
+
+		auto update_bbox = [&](std::vector<double> &bbox, const T_store *x, const T_store *y, const T_store *z, size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				bbox[0] = std::min<double>(bbox[0], x[i]);
+				bbox[1] = std::min<double>(bbox[1], y[i]);
+				bbox[2] = std::min<double>(bbox[2], z[i]);
+				bbox[3] = std::max<double>(bbox[3], x[i]);
+				bbox[4] = std::max<double>(bbox[4], y[i]);
+				bbox[5] = std::max<double>(bbox[5], z[i]);
+			}
+		};
+
 		for (unsigned ifile = 0; ifile < nfiles_; ++ifile)
 		{
+			std::vector<double> &bbox = file_bbox[ifile];
+			bbox = {1e30, 1e30, 1e30, -1e30, -1e30, -1e30};
 
 			if (nfiles_ > 1)
 			{
 				char ffname[256];
 				snprintf(ffname, 256, "%s.%d", fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary | std::ios::trunc);
+				ofs_.open(ffname);
 			}
 			else
 			{
-				ofs_.open(fname_.c_str(), std::ios::binary | std::ios::trunc);
+				ofs_.open(fname_.c_str());
 			}
 
 			size_t np_this_file = np_tot_per_file[ifile];
@@ -473,9 +772,9 @@ protected:
 			if (bbaryons && np_per_file[ifile][0] > 0ul)
 			{
 
-				iffs1.open(fnbx, npcdm, wrote_gas * sizeof(T_store));
-				iffs2.open(fnby, npcdm, wrote_gas * sizeof(T_store));
-				iffs3.open(fnbz, npcdm, wrote_gas * sizeof(T_store));
+				iffs1.open(fnbx, npcdm, wrote_type[0] * sizeof(T_store));
+				iffs2.open(fnby, npcdm, wrote_type[0] * sizeof(T_store));
+				iffs3.open(fnbz, npcdm, wrote_type[0] * sizeof(T_store));
 
 				npleft = np_per_file[ifile][0];
 				n2read = std::min(curr_block_buf_size, npleft);
@@ -484,6 +783,7 @@ protected:
 					iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
 					iffs2.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
 					iffs3.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
+					update_bbox(bbox, tmp1, tmp2, tmp3, n2read);
 
 					for (size_t i = 0; i < n2read; ++i)
 					{
@@ -502,46 +802,53 @@ protected:
 				iffs3.close();
 			}
 
-			npleft = np_this_file - np_per_file[ifile][0];
-			n2read = std::min(curr_block_buf_size, npleft);
-
-			iffs1.open(fnx, npcdm, wrote_dm * sizeof(T_store));
-			iffs2.open(fny, npcdm, wrote_dm * sizeof(T_store));
-			iffs3.open(fnz, npcdm, wrote_dm * sizeof(T_store));
-
-			while (n2read > 0ul)
+			//... the dark matter particles of this file are contiguous per type in the temporary files
+			for (int itype = 1; itype < 6; ++itype)
 			{
-				iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
-				iffs2.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
-				iffs3.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
+				if (np_per_file[ifile][itype] == 0)
+					continue;
 
-				for (size_t i = 0; i < n2read; ++i)
+				iffs1.open(fnx, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
+				iffs2.open(fny, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
+				iffs3.open(fnz, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
+
+				npleft = np_per_file[ifile][itype];
+				n2read = std::min(curr_block_buf_size, npleft);
+				while (n2read > 0ul)
 				{
-					adata3.push_back(fmod(tmp1[i] + header_.BoxSize, header_.BoxSize));
-					adata3.push_back(fmod(tmp2[i] + header_.BoxSize, header_.BoxSize));
-					adata3.push_back(fmod(tmp3[i] + header_.BoxSize, header_.BoxSize));
+					iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
+					iffs2.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
+					iffs3.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
+					update_bbox(bbox, tmp1, tmp2, tmp3, n2read);
+
+					for (size_t i = 0; i < n2read; ++i)
+					{
+						adata3.push_back(fmod(tmp1[i] + header_.BoxSize, header_.BoxSize));
+						adata3.push_back(fmod(tmp2[i] + header_.BoxSize, header_.BoxSize));
+						adata3.push_back(fmod(tmp3[i] + header_.BoxSize, header_.BoxSize));
+					}
+					ofs_.write(reinterpret_cast<char *>(&adata3[0]), 3 * n2read * sizeof(T_store));
+
+					adata3.clear();
+					npleft -= n2read;
+					n2read = std::min(curr_block_buf_size, npleft);
 				}
-				ofs_.write(reinterpret_cast<char *>(&adata3[0]), 3 * n2read * sizeof(T_store));
 
-				adata3.clear();
-				npleft -= n2read;
-				n2read = std::min(curr_block_buf_size, npleft);
+				iffs1.close();
+				iffs2.close();
+				iffs3.close();
 			}
 			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
 
-			iffs1.close();
-			iffs2.close();
-			iffs3.close();
-
 			//... particle velocities ..................................................
 			blksize = 3ul * np_this_file * sizeof(T_store);
 			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
 
 			if (bbaryons && np_per_file[ifile][0] > 0ul)
 			{
-				iffs1.open(fnbvx, npcdm, wrote_gas * sizeof(T_store));
-				iffs2.open(fnbvy, npcdm, wrote_gas * sizeof(T_store));
-				iffs3.open(fnbvz, npcdm, wrote_gas * sizeof(T_store));
+				iffs1.open(fnbvx, npcdm, wrote_type[0] * sizeof(T_store));
+				iffs2.open(fnbvy, npcdm, wrote_type[0] * sizeof(T_store));
+				iffs3.open(fnbvz, npcdm, wrote_type[0] * sizeof(T_store));
 
 				npleft = np_per_file[ifile][0];
 				n2read = std::min(curr_block_buf_size, npleft);
@@ -570,99 +877,72 @@ protected:
 				iffs3.close();
 			}
 
-			iffs1.open(fnvx, npcdm, wrote_dm * sizeof(T_store));
-			iffs2.open(fnvy, npcdm, wrote_dm * sizeof(T_store));
-			iffs3.open(fnvz, npcdm, wrote_dm * sizeof(T_store));
-
-			npleft = np_this_file - np_per_file[ifile][0];
-			n2read = std::min(curr_block_buf_size, npleft);
-			while (n2read > 0ul)
+			for (int itype = 1; itype < 6; ++itype)
 			{
-				iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
-				iffs2.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
-				iffs3.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
-
-				for (size_t i = 0; i < n2read; ++i)
-				{
-					adata3.push_back(tmp1[i]);
-					adata3.push_back(tmp2[i]);
-					adata3.push_back(tmp3[i]);
-				}
+				if (np_per_file[ifile][itype] == 0)
+					continue;
 
-				ofs_.write(reinterpret_cast<char *>(&adata3[0]), 3 * n2read * sizeof(T_store));
+				iffs1.open(fnvx, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
+				iffs2.open(fnvy, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
+				iffs3.open(fnvz, npcdm, (dm_type_offset[itype] + wrote_type[itype]) * sizeof(T_store));
 
-				adata3.clear();
-				npleft -= n2read;
+				npleft = np_per_file[ifile][itype];
 				n2read = std::min(curr_block_buf_size, npleft);
-			}
-			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-
-			iffs1.close();
-			iffs2.close();
-			iffs3.close();
-
-			//... particle IDs ..........................................................
-			std::vector<unsigned> short_ids;
-			std::vector<size_t> long_ids;
-
-			if (bneed_long_ids)
-				long_ids.assign(curr_block_buf_size, 0);
-			else
-				short_ids.assign(curr_block_buf_size, 0);
+				while (n2read > 0ul)
+				{
+					iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
+					iffs2.read(reinterpret_cast<char *>(&tmp2[0]), n2read * sizeof(T_store));
+					iffs3.read(reinterpret_cast<char *>(&tmp3[0]), n2read * sizeof(T_store));
 
-			npleft = np_this_file;
-			n2read = std::min(curr_block_buf_size, npleft);
-			blksize = sizeof(unsigned) * np_this_file;
+					for (size_t i = 0; i < n2read; ++i)
+					{
+						adata3.push_back(tmp1[i]);
+						adata3.push_back(tmp2[i]);
+						adata3.push_back(tmp3[i]);
+					}
 
-			if (bneed_long_ids)
-				blksize = sizeof(size_t) * np_this_file;
+					ofs_.write(reinterpret_cast<char *>(&adata3[0]), 3 * n2read * sizeof(T_store));
 
-			//... generate contiguous IDs and store in file ..
-			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-			while (n2read > 0ul)
-			{
-				if (bneed_long_ids)
-				{
-					for (size_t i = 0; i < n2read; ++i)
-						long_ids[i] = idcount++;
-					ofs_.write(reinterpret_cast<char *>(&long_ids[0]), n2read * sizeof(size_t));
-				}
-				else
-				{
-					for (size_t i = 0; i < n2read; ++i)
-						short_ids[i] = idcount++;
-					ofs_.write(reinterpret_cast<char *>(&short_ids[0]), n2read * sizeof(unsigned));
+					adata3.clear();
+					npleft -= n2read;
+					n2read = std::min(curr_block_buf_size, npleft);
 				}
-				npleft -= n2read;
-				n2read = std::min(curr_block_buf_size, npleft);
+
+				iffs1.close();
+				iffs2.close();
+				iffs3.close();
 			}
 			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
 
-			std::vector<unsigned>().swap(short_ids);
-			std::vector<size_t>().swap(long_ids);
+			//... particle IDs, contiguous over all files .............................
+			size_t id0 = 0;
+			for (unsigned j = 0; j < ifile; ++j)
+				id0 += np_tot_per_file[j];
+
+			if (bneed_long_ids)
+				music::write_gadget_id_block<size_t>(ofs_, id0, np_this_file, block_buf_size_);
+			else
+				music::write_gadget_id_block<unsigned>(ofs_, id0, np_this_file, block_buf_size_);
 
 			//... particle masses .......................................................
 			if (bmorethan2bnd_) // bmultimass_ && bmorethan2bnd_ && nc_per_file[ifile] > 0ul)
 			{
-				unsigned npcoarse = np_per_file[ifile][bndparticletype_]; // nc_per_file[ifile];//header_.npart[5];
-				iffs1.open(fnm, np_per_type_[bndparticletype_], wrote_coarse * sizeof(T_store));
+				size_t npcoarse = np_per_file[ifile][bndparticletype_];
 
 				npleft = npcoarse;
 				n2read = std::min(curr_block_buf_size, npleft);
 				blksize = npcoarse * sizeof(T_store);
 
 				ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-				while (n2read > 0ul)
+				for (size_t first = wrote_type[bndparticletype_]; n2read > 0ul; first += n2read)
 				{
-					iffs1.read(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
+					fill_coarse_masses(first, n2read, tmp1);
 					ofs_.write(reinterpret_cast<char *>(&tmp1[0]), n2read * sizeof(T_store));
 
 					npleft -= n2read;
 					n2read = std::min(curr_block_buf_size, npleft);
 				}
 				ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-
-				iffs1.close();
 			}
 
 			//... initial internal energy for gas particles
@@ -707,11 +987,13 @@ protected:
 			ofs_.flush();
 			ofs_.close();
 
-			wrote_gas += np_per_file[ifile][0];
-			wrote_dm += np_this_file - np_per_file[ifile][0];
-			wrote_coarse += np_per_file[ifile][5];
+			for (int itype = 0; itype < 6; ++itype)
+				wrote_type[itype] += np_per_file[ifile][itype];
 		}
 
+		if (!split_keys_.empty())
+			write_domain_file(np_per_file, file_bbox);
+
 		delete[] tmp1;
 		delete[] tmp2;
 		delete[] tmp3;
@@ -728,7 +1010,6 @@ protected:
 		remove(fnvx);
 		remove(fnvy);
 		remove(fnvz);
-		remove(fnm);
 	}
 
 	void determine_particle_numbers(const grid_hierarchy &gh)
@@ -791,6 +1072,9 @@ protected:
 
 			if (do_baryons_)
 				np_per_type_[0] = np_per_type_[1];
+
+			if (split_mode_ != "count")
+				determine_spatial_split(gh);
 		}
 	}
 
@@ -834,7 +1118,7 @@ public:
 			{
 				char ffname[256];
 				snprintf(ffname, 256, "%s.%d", fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary | std::ios::trunc);
+				ofs_.open(ffname);
 				if (!ofs_.good())
 				{
 					music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!", ffname);
@@ -845,7 +1129,7 @@ public:
 		}
 		else
 		{
-			ofs_.open(fname_.c_str(), std::ios::binary | std::ios::trunc);
+			ofs_.open(fname_.c_str());
 			if (!ofs_.good())
 			{
 				music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!", fname_.c_str());
@@ -953,6 +1237,39 @@ public:
 				music::wlog.Print("Gadget: Option \'gadget_spreadcoarse\' forces \'gadget_coarsetype=5\'! Will override.");
 		}
 
+		bvector_io_ = cf.get_value_safe<bool>("output", "vector_io", false);
+
+		cell_order_ = music::leaf_cell_order(music::get_particle_ordering(cf));
+
+		//... multi-file output split by particle number or into spatial domains
+		split_mode_ = cf.get_value_safe<std::string>("output", "gadget_split", "count");
+		if (split_mode_ != "count")
+		{
+			music::particle_ordering split_order;
+			if (split_mode_ == "slab")
+				split_order = music::particle_ordering::slab;
+			else if (split_mode_ == "hilbert")
+				split_order = music::particle_ordering::hilbert;
+			else
+			{
+				music::elog.Print("Gadget: unknown gadget_split \'%s\'. Use one of count, slab, hilbert.", split_mode_.c_str());
+				throw std::runtime_error("Unknown gadget_split mode for Gadget output plugin");
+			}
+
+			if (nfiles_ < 2)
+				split_mode_ = "count";
+			else
+			{
+				//... spatial domains are contiguous segments of the particles sorted by key
+				if (cell_order_.ordering() != music::particle_ordering::none && cell_order_.ordering() != split_order)
+					music::wlog.Print("Gadget: Option \'gadget_split=%s\' forces \'particle_order=%s\'! Will override.", split_mode_.c_str(), split_mode_.c_str());
+				cell_order_ = music::leaf_cell_order(split_order);
+			}
+		}
+
+		if (cell_order_.ordering() != music::particle_ordering::none)
+			music::ilog.Print("Gadget : particles of each type are written in %s order.", music::particle_ordering_name(cell_order_.ordering()).c_str());
+
 		//... set time ......................................................
 		header_.redshift = cf.get_value<double>("setup", "zstart");
 		header_.time = 1.0 / (1.0 + header_.redshift);
@@ -1004,206 +1321,64 @@ public:
 		{
 			header_.mass[bndparticletype_] = 0.;
 
-			size_t npcoarse = np_per_type_[bndparticletype_];
-			size_t nwritten = 0;
-
-			std::vector<T_store> temp_dat;
-			temp_dat.reserve(block_buf_size_);
-
-			char temp_fname[256];
-			snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_dm_mass);
-			std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-			size_t blksize = sizeof(T_store) * npcoarse;
-
-			ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-			int levelmaxcoarse = gh.levelmax() - 4;
+			coarse_levelhi_ = gh.levelmax() - 4;
 			if (!spread_coarse_acrosstypes_)
-				levelmaxcoarse = gh.levelmax() - 1;
-
-			for (int ilevel = levelmaxcoarse; ilevel >= (int)gh.levelmin(); --ilevel)
+				coarse_levelhi_ = gh.levelmax() - 1;
+
+			// baryon particles live only on finest grid
+			// these particles here are total matter particles
+			coarse_pmass_.assign(gh.levelmax() + 1, 0.0);
+			coarse_np_per_level_.assign(gh.levelmax() + 1, 0);
+			size_t npcoarse = 0;
+			for (int ilevel = coarse_levelhi_; ilevel >= (int)gh.levelmin(); --ilevel)
 			{
-				// baryon particles live only on finest grid
-				// these particles here are total matter particles
-				double pmass = header_.Omega0 * rhoc * pow(header_.BoxSize, 3.) / pow(2, 3 * ilevel);
-
-				for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-					for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-						for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-							if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-							{
-								if (temp_dat.size() < block_buf_size_)
-									temp_dat.push_back(pmass);
-								else
-								{
-									ofs_temp.write((char *)&temp_dat[0], sizeof(T_store) * block_buf_size_);
-									nwritten += block_buf_size_;
-									temp_dat.clear();
-									temp_dat.push_back(pmass);
-								}
-							}
+				coarse_pmass_[ilevel] = header_.Omega0 * rhoc * pow(header_.BoxSize, 3.) / pow(2, 3 * ilevel);
+				coarse_np_per_level_[ilevel] = gh.count_leaf_cells(ilevel, ilevel);
+				npcoarse += coarse_np_per_level_[ilevel];
 			}
 
-			if (temp_dat.size() > 0)
+			// with particle ordering the levels are interleaved, remember the level of each particle
+			coarse_level_.clear();
+			if (cell_order_.ordering() != music::particle_ordering::none)
 			{
-				ofs_temp.write((char *)&temp_dat[0], sizeof(T_store) * temp_dat.size());
-				nwritten += temp_dat.size();
+				coarse_level_.reserve(npcoarse);
+				for_each_particle_cell(gh, coarse_levelhi_, [&](int ilevel, unsigned i, unsigned j, unsigned k)
+				{
+					coarse_level_.push_back((uint8_t)ilevel);
+				});
 			}
 
-			if (nwritten != npcoarse)
+			if (npcoarse != np_per_type_[bndparticletype_] || (!coarse_level_.empty() && coarse_level_.size() != npcoarse))
 			{
-				music::elog.Print("nwritten = %llu != npcoarse = %llu\n", nwritten, npcoarse);
-				throw std::runtime_error("Internal consistency error while writing temporary file for masses");
+				music::elog.Print("npcoarse = %llu != %llu\n", npcoarse, np_per_type_[bndparticletype_]);
+				throw std::runtime_error("Internal consistency error while determining coarse particle masses");
 			}
-
-			ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-			if (ofs_temp.bad())
-				throw std::runtime_error("I/O error while writing temporary file for masses");
 		}
 	}
 
 	void write_dm_position(int coord, const grid_hierarchy &gh)
 	{
-		//... count number of leaf cells ...//
-		determine_particle_numbers(gh);
-
-		size_t npart = 0;
-		for (int i = 1; i < 6; ++i)
-			npart += np_per_type_[i];
-
-		//... determine if we need to shift the coordinates back
-		double *shift = NULL;
-
-		if (shift_halfcell_)
-		{
-			double h = 1.0 / (1 << (levelmin_ + 1));
-			shift = new double[3];
-			shift[0] = shift[1] = shift[2] = -h;
-		}
-
-		size_t nwritten = 0;
-		//... collect displacements and convert to absolute coordinates with correct
-		//... units
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
-
-		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + coord);
-		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-		size_t blksize = sizeof(T_store) * npart;
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		double xfac = header_.BoxSize;
-
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							double xx[3];
-							gh.cell_pos(ilevel, i, j, k, xx);
-							if (shift != NULL)
-								xx[coord] += shift[coord];
-
-							xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * xfac;
-
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back(xx[coord]);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back(xx[coord]);
-							}
-						}
-
-		if (temp_data.size() > 0)
-		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
-		}
-
-		if (nwritten != npart)
-			throw std::runtime_error("Internal consistency error while writing temporary file for positions");
-
-		//... dump to temporary file
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		if (ofs_temp.bad())
-			throw std::runtime_error("I/O error while writing temporary file for positions");
-
-		ofs_temp.close();
-
-		if (shift != NULL)
-			delete[] shift;
+		write_position_components(id_dm_pos, coord, {&gh}, false);
 	}
 
 	void write_dm_velocity(int coord, const grid_hierarchy &gh)
 	{
-		//... count number of leaf cells ...//
-		determine_particle_numbers(gh);
-
-		size_t npart = 0;
-		for (int i = 1; i < 6; ++i)
-			npart += np_per_type_[i];
-
-		//... collect displacements and convert to absolute coordinates with correct
-		//... units
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
-
-		float isqrta = 1.0f / sqrt(header_.time);
-		float vfac = isqrta * header_.BoxSize;
-
-		// if( kpcunits_ )
-		//   vfac /= 1000.0;
-		vfac *= unit_length_chosen_ / unit_vel_chosen_;
-
-		size_t nwritten = 0;
-
-		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + coord);
-		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-		size_t blksize = sizeof(T_store) * npart;
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		for (int ilevel = levelmax_; ilevel >= (int)levelmin_; --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							}
-						}
-		if (temp_data.size() > 0)
-		{
-			ofs_temp.write((char *)&temp_data[0], temp_data.size() * sizeof(T_store));
-			nwritten += temp_data.size();
-		}
-
-		if (nwritten != npart)
-			throw std::runtime_error("Internal consistency error while writing temporary file for velocities");
+		write_velocity_components(id_dm_vel, coord, {&gh}, false);
+	}
 
-		ofs_temp.write((char *)&blksize, sizeof(int));
+	bool supports_vector_fields(void) const
+	{
+		return bvector_io_;
+	}
 
-		if (ofs_temp.bad())
-			throw std::runtime_error("I/O error while writing temporary file for velocities");
+	void write_dm_positions(const grid_hierarchy &x, const grid_hierarchy &y, const grid_hierarchy &z)
+	{
+		write_position_components(id_dm_pos, 0, {&x, &y, &z}, false);
+	}
 
-		ofs_temp.close();
+	void write_dm_velocities(const grid_hierarchy &vx, const grid_hierarchy &vy, const grid_hierarchy &vz)
+	{
+		write_velocity_components(id_dm_vel, 0, {&vx, &vy, &vz}, false);
 	}
 
 	void write_dm_density(const grid_hierarchy &gh)
@@ -1224,156 +1399,23 @@ public:
 	//... write data for gas -- don't do this
 	void write_gas_velocity(int coord, const grid_hierarchy &gh)
 	{
-		determine_particle_numbers(gh);
-		size_t npart = 0;
-		for (int i = 1; i < 6; ++i)
-			npart += np_per_type_[i];
-
-		//... collect velocities and convert to absolute coordinates with correct
-		//... units
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
-
-		float isqrta = 1.0f / sqrt(header_.time);
-		float vfac = isqrta * header_.BoxSize;
-
-		// if( kpcunits_ )
-		//   vfac /= 1000.0;
-		vfac *= unit_length_chosen_ / unit_vel_chosen_;
-
-		// size_t npart = gh.count_leaf_cells(gh.levelmin(), gh.levelmax());;;
-		size_t nwritten = 0;
-
-		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + coord);
-		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-		size_t blksize = sizeof(T_store) * npart;
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		for (int ilevel = levelmax_; ilevel >= (int)levelmin_; --ilevel)
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back((*gh.get_grid(ilevel))(i, j, k) * vfac);
-							}
-						}
-
-		if (temp_data.size() > 0)
-		{
-			ofs_temp.write((char *)&temp_data[0], temp_data.size() * sizeof(T_store));
-			nwritten += temp_data.size();
-		}
-
-		if (nwritten != npart)
-			throw std::runtime_error("Internal consistency error while writing temporary file for gas velocities");
-
-		ofs_temp.write((char *)&blksize, sizeof(int));
-
-		if (ofs_temp.bad())
-			throw std::runtime_error("I/O error while writing temporary file for gas velocities");
-
-		ofs_temp.close();
+		write_velocity_components(id_gas_vel, coord, {&gh}, true);
 	}
 
 	//... write only for fine level
 	void write_gas_position(int coord, const grid_hierarchy &gh)
 	{
-		//... count number of leaf cells ...//
-		determine_particle_numbers(gh);
-
-		size_t npart = 0;
-		for (int i = 1; i < 6; ++i)
-			npart += np_per_type_[i];
-
-		//... determine if we need to shift the coordinates back
-		double *shift = NULL;
-
-		if (shift_halfcell_)
-		{
-			double h = 1.0 / (1 << (levelmin_ + 1));
-			shift = new double[3];
-			shift[0] = shift[1] = shift[2] = -h;
-		}
-
-		size_t nwritten = 0;
-
-		//...
-		//... collect displacements and convert to absolute coordinates with correct
-		//... units
-		std::vector<T_store> temp_data;
-		temp_data.reserve(block_buf_size_);
-
-		char temp_fname[256];
-		snprintf(temp_fname, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + coord);
-		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-		size_t blksize = sizeof(T_store) * npart;
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		double xfac = header_.BoxSize;
-
-		double h = 1.0 / (1ul << gh.levelmax());
-
-		for (int ilevel = gh.levelmax(); ilevel >= (int)gh.levelmin(); --ilevel)
-		{
-			for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-				for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-					for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-						// if( ! gh.is_refined(ilevel,i,j,k) )
-						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
-						{
-							double xx[3];
-							gh.cell_pos(ilevel, i, j, k, xx);
-							if (shift != NULL)
-								xx[coord] += shift[coord];
-
-							//... shift particle positions (this has to be done as the same shift
-							//... is used when computing the convolution kernel for SPH baryons)
-							xx[coord] += 0.5 * h;
-
-							xx[coord] = (xx[coord] + (*gh.get_grid(ilevel))(i, j, k)) * xfac;
-
-							if (temp_data.size() < block_buf_size_)
-								temp_data.push_back(xx[coord]);
-							else
-							{
-								ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * block_buf_size_);
-								nwritten += block_buf_size_;
-								temp_data.clear();
-								temp_data.push_back(xx[coord]);
-							}
-						}
-		}
-
-		if (temp_data.size() > 0)
-		{
-			ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * temp_data.size());
-			nwritten += temp_data.size();
-		}
-
-		if (nwritten != npart)
-			throw std::runtime_error("Internal consistency error while writing temporary file for gas positions");
-
-		//... dump to temporary file
-		ofs_temp.write((char *)&blksize, sizeof(size_t));
-
-		if (ofs_temp.bad())
-			throw std::runtime_error("I/O error while writing temporary file for gas positions");
+		write_position_components(id_gas_pos, coord, {&gh}, true);
+	}
 
-		ofs_temp.close();
+	void write_gas_velocities(const grid_hierarchy &vx, const grid_hierarchy &vy, const grid_hierarchy &vz)
+	{
+		write_velocity_components(id_gas_vel, 0, {&vx, &vy, &vz}, true);
+	}
 
-		if (shift != NULL)
-			delete[] shift;
+	void write_gas_positions(const grid_hierarchy &x, const grid_hierarchy &y, const grid_hierarchy &z)
+	{
+		write_position_components(id_gas_pos, 0, {&x, &y, &z}, true);
 	}
 
 	void write_gas_density(const grid_hierarchy &gh)
@@ -1383,6 +1425,7 @@ public:
 
 	void finalize(void)
 	{
+		cell_order_.clear();
 		this->assemble_gadget_file();
 	}
 };
@@ -9,16 +9,20 @@
  */
 
 #include <fstream>
+#include <memory>
 #include "logger.hh"
 #include "output.hh"
+#include "file_writer.hh"
+#include "gadget_io.hh"
 #include "mg_interp.hh"
 #include "mesh.hh"
+#include "glass_load.hh"
 
 template <typename T_store = float>
 class gadget2_2comp_output_plugin : public output_plugin
 {
 protected:
-	std::ofstream ofs_;
+	music::file_writer ofs_;
 	bool bmultimass_;
 
 	typedef struct io_header
@@ -51,6 +55,8 @@ protected:
 
 	bool do_glass_;
 	std::string fname_glass_baryon_, fname_glass_cdm_;
+	std::unique_ptr<music::glass_load> glass_[3]; //!< glass loads of the particle types 1 and 2
+	int glass_uses_[3];												 //!< components still to be written from each load
 
 	enum iofields
 	{
@@ -250,23 +256,22 @@ protected:
 		//............................................................................
 		//... copy from the temporary files, interleave the data and save ............
 
-		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256], fnm[256];
+		char fnx[256], fny[256], fnz[256], fnvx[256], fnvy[256], fnvz[256];
 		char fnbx[256], fnby[256], fnbz[256], fnbvx[256], fnbvy[256], fnbvz[256];
 
-		snprintf(fnx, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 0);
-		snprintf(fny, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 1);
-		snprintf(fnz, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 2);
-		snprintf(fnvx,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 0);
-		snprintf(fnvy,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 1);
-		snprintf(fnvz,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 2);
-		snprintf(fnm, 256, "___ic_temp_%05d.bin", 100 * id_dm_mass);
-
-		snprintf(fnbx, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 0);
-		snprintf(fnby, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 1);
-		snprintf(fnbz, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 2);
-		snprintf(fnbvx,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 0);
-		snprintf(fnbvy,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 1);
-		snprintf(fnbvz,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 2);
+		music::temp_storage::get_filename(fnx, 256, 100 * id_dm_pos + 0);
+		music::temp_storage::get_filename(fny, 256, 100 * id_dm_pos + 1);
+		music::temp_storage::get_filename(fnz, 256, 100 * id_dm_pos + 2);
+		music::temp_storage::get_filename(fnvx, 256, 100 * id_dm_vel + 0);
+		music::temp_storage::get_filename(fnvy, 256, 100 * id_dm_vel + 1);
+		music::temp_storage::get_filename(fnvz, 256, 100 * id_dm_vel + 2);
+
+		music::temp_storage::get_filename(fnbx, 256, 100 * id_gas_pos + 0);
+		music::temp_storage::get_filename(fnby, 256, 100 * id_gas_pos + 1);
+		music::temp_storage::get_filename(fnbz, 256, 100 * id_gas_pos + 2);
+		music::temp_storage::get_filename(fnbvx, 256, 100 * id_gas_vel + 0);
+		music::temp_storage::get_filename(fnbvy, 256, 100 * id_gas_vel + 1);
+		music::temp_storage::get_filename(fnbvz, 256, 100 * id_gas_vel + 2);
 
 		pistream iffs1, iffs2, iffs3;
 
@@ -343,11 +348,11 @@ protected:
 			{
 				char ffname[256];
 				snprintf(ffname, 256, "%s.%d", fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary | std::ios::trunc);
+				ofs_.open(ffname);
 			}
 			else
 			{
-				ofs_.open(fname_.c_str(), std::ios::binary | std::ios::trunc);
+				ofs_.open(fname_.c_str());
 			}
 
 			size_t np_this_file = nfgas_per_file[ifile] + nfdm_per_file[ifile] + nc_per_file[ifile];
@@ -502,45 +507,12 @@ protected:
 
 			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
 
-			//... particle IDs ..........................................................
-			std::vector<unsigned> short_ids;
-			std::vector<size_t> long_ids;
-
+			//... particle IDs, contiguous over all files .............................
 			if (bneed_long_ids)
-				long_ids.assign(curr_block_buf_size, 0);
+				music::write_gadget_id_block<size_t>(ofs_, idcount, np_this_file, block_buf_size_);
 			else
-				short_ids.assign(curr_block_buf_size, 0);
-
-			npleft = np_this_file;
-			n2read = std::min(curr_block_buf_size, npleft);
-			blksize = sizeof(unsigned) * np_this_file;
-
-			if (bneed_long_ids)
-				blksize = sizeof(size_t) * np_this_file;
-
-			//... generate contiguous IDs and store in file ..
-			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-			while (n2read > 0ul)
-			{
-				if (bneed_long_ids)
-				{
-					for (size_t i = 0; i < n2read; ++i)
-						long_ids[i] = idcount++;
-					ofs_.write(reinterpret_cast<char *>(&long_ids[0]), n2read * sizeof(size_t));
-				}
-				else
-				{
-					for (size_t i = 0; i < n2read; ++i)
-						short_ids[i] = idcount++;
-					ofs_.write(reinterpret_cast<char *>(&short_ids[0]), n2read * sizeof(unsigned));
-				}
-				npleft -= n2read;
-				n2read = std::min(curr_block_buf_size, npleft);
-			}
-			ofs_.write(reinterpret_cast<char *>(&blksize), sizeof(int));
-
-			std::vector<unsigned>().swap(short_ids);
-			std::vector<size_t>().swap(long_ids);
+				music::write_gadget_id_block<unsigned>(ofs_, idcount, np_this_file, block_buf_size_);
+			idcount += np_this_file;
 
 			//... particle masses .......................................................
 			// multi-mass not supported here
@@ -569,72 +541,42 @@ protected:
 		remove(fnvx);
 		remove(fnvy);
 		remove(fnvz);
-		remove(fnm);
 	}
 
-	void get_cic_displacement(size_t icoord, const float *ppos, size_t np, float l, const grid_hierarchy &gh, T_store *valp)
+	//! const access to the glass load of particle type itype, read on first use
+	const music::glass_load &get_glass(int itype, const std::string &fname, const grid_hierarchy &gh)
+	{
+		if (!glass_[itype])
+			glass_[itype] = std::make_unique<music::glass_load>(fname, itype, gh.count_leaf_cells(gh.levelmax(), gh.levelmax()));
+		return *glass_[itype];
+	}
+
+	//! one component of particle type itype is written, the load is freed after the last one
+	void release_glass(int itype)
+	{
+		if (--glass_uses_[itype] <= 0)
+			glass_[itype].reset();
+	}
+
+	void get_cic_displacement(size_t icoord, const music::glass_load &glass, size_t ip0, size_t np, const grid_hierarchy &gh, T_store *valp)
 	{
 		size_t N = gh.size(gh.levelmax(), 0);
+		float l = glass.boxlength();
 
 		float facconv = 1.f / l * (float)N / (float)(1ul << levelmax_);
 		float suboffset = (float)(gh.offset_abs(levelmax_, icoord)) / ((float)(1ul << levelmax_));
 
-		for (size_t ip = 0; ip < np; ++ip)
-		{
-			float u, v, w;
-
-			u = ppos[3 * ip + 0] / l * (float)N;
-			v = ppos[3 * ip + 1] / l * (float)N;
-			w = ppos[3 * ip + 2] / l * (float)N;
-
-			int i, j, k;
-
-			i = (((int)u) + N) % N;
-			j = (((int)v) + N) % N;
-			k = (((int)w) + N) % N;
-
-			u -= (float)i;
-			v -= (float)j;
-			w -= (float)k;
-
-			int i1, j1, k1;
-			i1 = (i + 1 + N) % N;
-			j1 = (j + 1 + N) % N;
-			k1 = (k + 1 + N) % N;
-
-			double f1, f2, f3, f4, f5, f6, f7, f8;
-
-			f1 = (1.f - u) * (1.f - v) * (1.f - w);
-			f2 = (1.f - u) * (1.f - v) * (w);
-			f3 = (1.f - u) * (v) * (1.f - w);
-			f4 = (1.f - u) * (v) * (w);
-			f5 = (u) * (1.f - v) * (1.f - w);
-			f6 = (u) * (1.f - v) * (w);
-			f7 = (u) * (v) * (1.f - w);
-			f8 = (u) * (v) * (w);
-
+		glass.interpolate(*gh.get_grid(levelmax_), ip0, np, [&](const float *x)
+											{
 			float disp = 0.0f;
-
-			// disp += add_term;
 			disp += suboffset;
-			disp += ppos[3 * ip + icoord] * facconv;
-
-			disp += f1 * (*gh.get_grid(levelmax_))(i, j, k);
-			disp += f2 * (*gh.get_grid(levelmax_))(i, j, k1);
-			disp += f3 * (*gh.get_grid(levelmax_))(i, j1, k);
-			disp += f4 * (*gh.get_grid(levelmax_))(i, j1, k1);
-			disp += f5 * (*gh.get_grid(levelmax_))(i1, j, k);
-			disp += f6 * (*gh.get_grid(levelmax_))(i1, j, k1);
-			disp += f7 * (*gh.get_grid(levelmax_))(i1, j1, k);
-			disp += f8 * (*gh.get_grid(levelmax_))(i1, j1, k1);
-
-			disp = fmodf((1.0f + disp) * header_.BoxSize, header_.BoxSize);
-
-			valp[ip] = disp;
-		}
+			disp += x[icoord] * facconv;
+			return disp; },
+											[&](float disp)
+											{ return (T_store)fmodf((1.0f + disp) * header_.BoxSize, header_.BoxSize); }, valp);
 	}
 
-	void get_cic_velocity(const float *ppos, size_t np, float l, const grid_hierarchy &gh, T_store *valp)
+	void get_cic_velocity(const music::glass_load &glass, size_t ip0, size_t np, const grid_hierarchy &gh, T_store *valp)
 	{
 		float isqrta = 1.0f / sqrt(header_.time);
 		float vfac = isqrta * header_.BoxSize;
@@ -642,58 +584,12 @@ protected:
 		if (kpcunits_)
 			vfac /= 1000.0;
 
-		size_t N = gh.size(gh.levelmax(), 0);
-		// float facconv   = 1.f / l * (float)N/(float)(1ul<<levelmax_);
-
-		for (size_t ip = 0; ip < np; ++ip)
-		{
-			float u, v, w;
-
-			u = ppos[3 * ip + 0] / l * (float)N;
-			v = ppos[3 * ip + 1] / l * (float)N;
-			w = ppos[3 * ip + 2] / l * (float)N;
-
-			int i, j, k;
-
-			i = (((int)u) + N) % N;
-			j = (((int)v) + N) % N;
-			k = (((int)w) + N) % N;
-
-			u -= (float)i;
-			v -= (float)j;
-			w -= (float)k;
-
-			int i1, j1, k1;
-			i1 = (i + 1 + N) % N;
-			j1 = (j + 1 + N) % N;
-			k1 = (k + 1 + N) % N;
-
-			double f1, f2, f3, f4, f5, f6, f7, f8;
-
-			f1 = (1.f - u) * (1.f - v) * (1.f - w);
-			f2 = (1.f - u) * (1.f - v) * (w);
-			f3 = (1.f - u) * (v) * (1.f - w);
-			f4 = (1.f - u) * (v) * (w);
-			f5 = (u) * (1.f - v) * (1.f - w);
-			f6 = (u) * (1.f - v) * (w);
-			f7 = (u) * (v) * (1.f - w);
-			f8 = (u) * (v) * (w);
-
-			float vel = 0.0f;
-
-			vel += f1 * (*gh.get_grid(levelmax_))(i, j, k);
-			vel += f2 * (*gh.get_grid(levelmax_))(i, j, k1);
-			vel += f3 * (*gh.get_grid(levelmax_))(i, j1, k);
-			vel += f4 * (*gh.get_grid(levelmax_))(i, j1, k1);
-			vel += f5 * (*gh.get_grid(levelmax_))(i1, j, k);
-			vel += f6 * (*gh.get_grid(levelmax_))(i1, j, k1);
-			vel += f7 * (*gh.get_grid(levelmax_))(i1, j1, k);
-			vel += f8 * (*gh.get_grid(levelmax_))(i1, j1, k1);
-
+		glass.interpolate(*gh.get_grid(levelmax_), ip0, np, [](const float *)
+											{ return 0.0f; },
+											[vfac](float vel)
+											{
 			vel *= vfac;
-
-			valp[ip] = vel;
-		}
+			return (T_store)vel; }, valp);
 	}
 
 public:
@@ -721,7 +617,7 @@ public:
 			{
 				char ffname[256];
 				snprintf(ffname, 256,"%s.%d", fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary | std::ios::trunc);
+				ofs_.open(ffname);
 				if (!ofs_.good())
 				{
 					music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!", ffname);
@@ -732,7 +628,7 @@ public:
 		}
 		else
 		{
-			ofs_.open(fname_.c_str(), std::ios::binary | std::ios::trunc);
+			ofs_.open(fname_.c_str());
 			if (!ofs_.good())
 			{
 				music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!", fname_.c_str());
@@ -777,6 +673,11 @@ public:
 				fname_glass_baryon_ = fname_glass_cdm_; // cf.get_value<std::string>("output","glass_file_baryon");
 		}
 
+		//... the driver writes 3 velocity and 3 position components, gas positions only for SPH
+		glass_uses_[0] = 0;
+		glass_uses_[1] = 6;
+		glass_uses_[2] = cf.get_value_safe<bool>("setup", "do_SPH", false) ? 6 : 3;
+
 		//... set time ......................................................
 		header_.redshift = cf.get_value<double>("setup", "zstart");
 		header_.time = 1.0 / (1.0 + header_.redshift);
@@ -826,59 +727,9 @@ public:
 
 		if (bmorethan2bnd_)
 		{
-			unsigned long long npcoarse = gh.count_leaf_cells(gh.levelmin(), gh.levelmax() - 1);
-			unsigned long long nwritten = 0;
-
-			std::vector<T_store> temp_dat;
-			temp_dat.reserve(block_buf_size_);
-
-			char temp_fname[256];
-			snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_mass);
-			std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
-
-			unsigned long long blksize = sizeof(T_store) * npcoarse;
-
-			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
-
-			for (int ilevel = gh.levelmax() - 1; ilevel >= (int)gh.levelmin(); --ilevel)
-			{
-				double pmass = 0.0;
-
-				if (!do_baryons_)
-					pmass = header_.Omega0 * rhoc * pow(header_.BoxSize, 3.) / pow(2, 3 * ilevel);
-				else
-					pmass = (header_.Omega0 - omegab_) * rhoc * pow(header_.BoxSize, 3.) / pow(2, 3 * ilevel);
-
-				for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
-					for (unsigned j = 0; j < gh.get_grid(ilevel)->size(1); ++j)
-						for (unsigned k = 0; k < gh.get_grid(ilevel)->size(2); ++k)
-							if (!gh.is_refined(ilevel, i, j, k))
-							{
-								if (temp_dat.size() < block_buf_size_)
-									temp_dat.push_back(pmass);
-								else
-								{
-									ofs_temp.write((char *)&temp_dat[0], sizeof(T_store) * block_buf_size_);
-									nwritten += block_buf_size_;
-									temp_dat.clear();
-									temp_dat.push_back(pmass);
-								}
-							}
-			}
-
-			if (temp_dat.size() > 0)
-			{
-				ofs_temp.write((char *)&temp_dat[0], sizeof(T_store) * temp_dat.size());
-				nwritten += temp_dat.size();
-			}
-
-			if (nwritten != npcoarse)
-				throw std::runtime_error("Internal consistency error while writing temporary file for masses");
-
-			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
-
-			if (ofs_temp.bad())
-				throw std::runtime_error("I/O error while writing temporary file for masses");
+			// multi-mass blocks are not written by this plug-in (see assemble_gadget_file),
+			// so there is no need to store the individual coarse particle masses
+			header_.mass[5] = 0.0;
 		}
 		else if (gh.levelmax() != gh.levelmin())
 		{
@@ -936,7 +787,7 @@ public:
 		double xfac = header_.BoxSize;
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_pos + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_pos + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		//... if baryons are present, then stagger the two fields
@@ -990,77 +841,43 @@ public:
 		else
 		{
 
-			std::ifstream ofg(fname_glass_cdm_.c_str(), std::ios::binary);
-
-			if (!ofg.good())
-				music::elog.Print("could not open glass input file \'%s\'", fname_glass_cdm_.c_str());
-
-			io_header glasshead;
-			unsigned blksz;
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			assert(blksz == sizeof(io_header));
-
-			ofg.read(reinterpret_cast<char *>(&glasshead), sizeof(io_header));
-
-			// size_t nreq = gh.size(gh.levelmax(), 0)*gh.size(gh.levelmax(), 1)*gh.size(gh.levelmax(), 2);
-			/*if( nreq != (size_t)glasshead.npart[1] )
-			{
-				music::elog.Print("glass file contains %d particles, but should contain %ld",glasshead.npart[1],nreq);
-				throw std::runtime_error("glass file does not contain the right amount of particles");
-			}*/
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			// assert( blksz == glasshead.npart[1]*sizeof(float)*3 );
-
-			float lglass = glasshead.BoxSize;
+			const music::glass_load &glass = get_glass(1, fname_glass_cdm_, gh);
 
-			blksize = sizeof(T_store) * glasshead.npart[1];
-			// ofs_temp.write( (char *)&blksize, sizeof(int) );
+			blksize = sizeof(T_store) * glass.size();
 			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
 
-			header_.npart[1] = glasshead.npart[1];
-			header_.npartTotal[1] = glasshead.npartTotal[1];
-			header_.npartTotalHighWord[1] = 0;
+			header_.npart[1] = (unsigned)glass.size();
+			header_.npartTotal[1] = (unsigned)glass.size();
+			header_.npartTotalHighWord[1] = (unsigned)(glass.size() >> 32);
 
 			double rhoc = 27.7519737;
 			if (kpcunits_)
 				rhoc *= 10.0; // in h^2 M_sol / kpc^3
 
 			if (do_baryons_)
-				header_.mass[1] = omegac_ * rhoc * pow(header_.BoxSize, 3.) / (glasshead.npart[1]);
+				header_.mass[1] = omegac_ * rhoc * pow(header_.BoxSize, 3.) / (glass.size());
 			else
-				header_.mass[1] = omegam_ * rhoc * pow(header_.BoxSize, 3.) / (glasshead.npart[1]);
+				header_.mass[1] = omegam_ * rhoc * pow(header_.BoxSize, 3.) / (glass.size());
 
-			// read glass, do interpolation and write
+			// interpolate to the glass and write
 			size_t npartdone = 0;
-			size_t npinter = glasshead.npart[1];
-
-			blksize = sizeof(T_store) * npinter;
-			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
+			size_t npinter = glass.size();
 
-			float *pos_tmp = new float[3 * block_buf_size_];
 			temp_data.assign(block_buf_size_, 0.0);
 
 			while (npartdone < npinter)
 			{
 				size_t npart2read = std::min(npinter - npartdone, block_buf_size_);
 
-				ofg.read(reinterpret_cast<char *>(&pos_tmp[0]), npart2read * sizeof(float) * 3);
-				get_cic_displacement(coord, pos_tmp, npart2read, lglass, gh, &temp_data[0]);
+				get_cic_displacement(coord, glass, npartdone, npart2read, gh, &temp_data[0]);
 				ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * npart2read);
 
-				//        std::cout << "npart2read " << npart2read << "\n";
-				//        std::cout << "pos temp " << temp_data[0] << " " << temp_data[1] << " " << temp_data[2] << "\n";
-				//        std::cout << "pos temp " << temp_data[npart2read-1] << " " << temp_data[npart2read-2] << " " << temp_data[npart2read-3] <<"\n";
-
 				npartdone += npart2read;
 				nwritten += npart2read;
 			}
 
-			delete[] pos_tmp;
 			temp_data.clear();
+			release_glass(1);
 
 			// do all lower levels with standard cartesian grid
 			for (int ilevel = gh.levelmax() - 1; ilevel >= (int)gh.levelmin(); --ilevel)
@@ -1141,7 +958,7 @@ public:
 		unsigned long long blksize;
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_vel + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		if (!do_glass_)
@@ -1170,52 +987,34 @@ public:
 		else
 		{
 
-			std::ifstream ofg(fname_glass_cdm_.c_str(), std::ios::binary);
-
-			if (!ofg.good())
-				music::elog.Print("could not open glass input file \'%s\'", fname_glass_cdm_.c_str());
-
-			io_header glasshead;
-			unsigned blksz;
+			const music::glass_load &glass = get_glass(1, fname_glass_cdm_, gh);
 
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			assert(blksz == sizeof(io_header));
+			header_.npart[1] = (unsigned)glass.size();
+			header_.npartTotal[1] = (unsigned)glass.size();
+			header_.npartTotalHighWord[1] = (unsigned)(glass.size() >> 32);
 
-			ofg.read(reinterpret_cast<char *>(&glasshead), sizeof(io_header));
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			// assert( blksz == glasshead.npart[1]*sizeof(float)*3 );
-
-			header_.npart[1] = glasshead.npart[1];
-			header_.npartTotal[1] = glasshead.npartTotal[1];
-			header_.npartTotalHighWord[1] = glasshead.npartTotalHighWord[1];
-			float lglass = glasshead.BoxSize;
-
-			// read glass, do interpolation and write
+			// interpolate to the glass and write
 			size_t npartdone = 0;
-			size_t npinter = glasshead.npart[1];
+			size_t npinter = glass.size();
 
 			blksize = sizeof(T_store) * npinter;
 			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
 
-			float *pos_tmp = new float[3 * block_buf_size_];
 			temp_data.assign(block_buf_size_, 0.0);
 
 			while (npartdone < npinter)
 			{
 				size_t npart2read = std::min(npinter - npartdone, block_buf_size_);
 
-				ofg.read(reinterpret_cast<char *>(&pos_tmp[0]), npart2read * sizeof(float) * 3);
-				get_cic_velocity(pos_tmp, npart2read, lglass, gh, &temp_data[0]);
+				get_cic_velocity(glass, npartdone, npart2read, gh, &temp_data[0]);
 				ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * npart2read);
 
 				npartdone += npart2read;
 				nwritten += npart2read;
 			}
 
-			delete[] pos_tmp;
 			temp_data.clear();
+			release_glass(1);
 
 			for (int ilevel = levelmax_ - 1; ilevel >= (int)levelmin_; --ilevel)
 				for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
@@ -1292,7 +1091,7 @@ public:
 		unsigned nwritten = 0;
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_vel + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		unsigned long long blksize;
@@ -1328,62 +1127,35 @@ public:
 		else
 		{
 
-			std::ifstream ofg(fname_glass_baryon_.c_str(), std::ios::binary);
-
-			if (!ofg.good())
-				music::elog.Print("could not open glass input file \'%s\'", fname_glass_cdm_.c_str());
-
-			io_header glasshead;
-			unsigned blksz;
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			assert(blksz == sizeof(io_header));
-
-			ofg.read(reinterpret_cast<char *>(&glasshead), sizeof(io_header));
-
-			// size_t nreq = gh.size(gh.levelmax(), 0)*gh.size(gh.levelmax(), 1)*gh.size(gh.levelmax(), 2);
-			/*if( nreq != (size_t)glasshead.npart[1] )
-			{
-				music::elog.Print("glass file contains %d particles, but should contain %ld",glasshead.npart[1],nreq);
-				throw std::runtime_error("glass file does not contain the right amount of particles");
-			}*/
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			// assert( blksz == (glasshead.npart[1]+glasshead.npart[2])*sizeof(float)*3 );
-			// ofg.seekg( sizeof(float)*3*glasshead.npart[1], std::ios_base::cur );
-
 			// do the highest level with the glass
-			float lglass = glasshead.BoxSize;
+			const music::glass_load &glass = get_glass(2, fname_glass_baryon_, gh);
 
-			header_.npart[2] = glasshead.npart[2];
-			header_.npartTotal[2] = glasshead.npartTotal[2];
-			header_.npartTotalHighWord[2] = glasshead.npartTotalHighWord[2];
+			header_.npart[2] = (unsigned)glass.size();
+			header_.npartTotal[2] = (unsigned)glass.size();
+			header_.npartTotalHighWord[2] = (unsigned)(glass.size() >> 32);
 
-			// read glass, do interpolation and write
+			// interpolate to the glass and write
 			size_t npartdone = 0;
-			size_t npinter = (size_t)glasshead.npart[2];
+			size_t npinter = glass.size();
 
 			blksize = sizeof(T_store) * npinter;
 			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
 
-			float *pos_tmp = new float[3 * block_buf_size_];
 			temp_data.assign(block_buf_size_, 0.0);
 
 			while (npartdone < npinter)
 			{
 				size_t npart2read = std::min(npinter - npartdone, block_buf_size_);
 
-				ofg.read(reinterpret_cast<char *>(&pos_tmp[0]), npart2read * sizeof(float) * 3);
-				get_cic_velocity(pos_tmp, npart2read, lglass, gh, &temp_data[0]);
+				get_cic_velocity(glass, npartdone, npart2read, gh, &temp_data[0]);
 				ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * npart2read);
 
 				npartdone += npart2read;
 				nwritten += npart2read;
 			}
 
-			delete[] pos_tmp;
 			temp_data.clear();
+			release_glass(2);
 
 			for (int ilevel = levelmax_ - 1; ilevel >= (int)levelmin_; --ilevel)
 				for (unsigned i = 0; i < gh.get_grid(ilevel)->size(0); ++i)
@@ -1459,7 +1231,7 @@ public:
 		temp_data.reserve(block_buf_size_);
 
 		char temp_fname[256];
-		snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_gas_pos + coord);
+		music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_pos + coord);
 		std::ofstream ofs_temp(temp_fname, std::ios::binary | std::ios::trunc);
 
 		unsigned long long blksize;
@@ -1524,70 +1296,40 @@ public:
 		else
 		{
 
-			std::ifstream ofg(fname_glass_baryon_.c_str(), std::ios::binary);
-
-			if (!ofg.good())
-				music::elog.Print("could not open glass input file \'%s\'", fname_glass_cdm_.c_str());
-
-			io_header glasshead;
-			unsigned blksz;
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			assert(blksz == sizeof(io_header));
-
-			ofg.read(reinterpret_cast<char *>(&glasshead), sizeof(io_header));
+			const music::glass_load &glass = get_glass(2, fname_glass_baryon_, gh);
 
-			// size_t nreq = gh.size(gh.levelmax(), 0)*gh.size(gh.levelmax(), 1)*gh.size(gh.levelmax(), 2);
-			/*if( nreq != (size_t)glasshead.npart[1] )
-			{
-				music::elog.Print("glass file contains %d particles, but should contain %ld",glasshead.npart[1],nreq);
-				throw std::runtime_error("glass file does not contain the right amount of particles");
-			}*/
-
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			ofg.read(reinterpret_cast<char *>(&blksz), sizeof(unsigned));
-			// assert( blksz == (glasshead.npart[1]+glasshead.npart[2])*sizeof(float)*3 );
-			// ofg.seekg( sizeof(float)*3*glasshead.npart[1], std::ios_base::cur );
-
-			float lglass = glasshead.BoxSize;
-
-			blksize = sizeof(T_store) * glasshead.npart[1];
+			blksize = sizeof(T_store) * glass.size();
 			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
 
-			header_.npart[2] = glasshead.npart[2];
-			header_.npartTotal[2] = glasshead.npartTotal[2];
-			header_.npartTotalHighWord[2] = glasshead.npartTotalHighWord[2];
+			header_.npart[2] = (unsigned)glass.size();
+			header_.npartTotal[2] = (unsigned)glass.size();
+			header_.npartTotalHighWord[2] = (unsigned)(glass.size() >> 32);
 
 			double rhoc = 27.7519737;
 			if (kpcunits_)
 				rhoc *= 10.0; // in h^2 M_sol / kpc^3
 
-			header_.mass[2] = omegab_ * rhoc * pow(header_.BoxSize, 3.) / (glasshead.npart[2]);
+			header_.mass[2] = omegab_ * rhoc * pow(header_.BoxSize, 3.) / (glass.size());
 
-			// read glass, do interpolation and write
+			// interpolate to the glass and write
 			size_t npartdone = 0;
-			size_t npinter = glasshead.npart[2];
-
-			blksize = sizeof(T_store) * npinter;
-			ofs_temp.write((char *)&blksize, sizeof(unsigned long long));
+			size_t npinter = glass.size();
 
-			float *pos_tmp = new float[3 * block_buf_size_];
 			temp_data.assign(block_buf_size_, 0.0);
 
 			while (npartdone < npinter)
 			{
 				size_t npart2read = std::min(npinter - npartdone, block_buf_size_);
 
-				ofg.read(reinterpret_cast<char *>(&pos_tmp[0]), npart2read * sizeof(float) * 3);
-				get_cic_displacement(coord, pos_tmp, npart2read, lglass, gh, &temp_data[0]);
+				get_cic_displacement(coord, glass, npartdone, npart2read, gh, &temp_data[0]);
 				ofs_temp.write((char *)&temp_data[0], sizeof(T_store) * npart2read);
 
 				npartdone += npart2read;
 				nwritten += npart2read;
 			}
 
-			delete[] pos_tmp;
 			temp_data.clear();
+			release_glass(2);
 		}
 
 		if (temp_data.size() > 0)
@@ -19,6 +19,7 @@
 #include "logger.hh"
 #include "region_generator.hh"
 #include "output.hh"
+#include "file_writer.hh"
 #include "mg_interp.hh"
 #include "mesh.hh"
 
@@ -418,7 +419,7 @@ public:
     
 protected:
 	
-	std::ofstream ofs_;
+	music::file_writer ofs_;
 	bool bmultimass_;
     bool blongids_;
     bool blagrangeids_as_vertids_;
@@ -594,17 +595,17 @@ protected:
 		char fnx[256],fny[256],fnz[256],fnvx[256],fnvy[256],fnvz[256],fnm[256];
 		char fnc[256], fnl[256], fnlid[256];
         
-		snprintf( fnx, 256, "___ic_temp_%05d.bin", 100*id_dm_pos+0 );
-		snprintf( fny, 256, "___ic_temp_%05d.bin", 100*id_dm_pos+1 );
-		snprintf( fnz, 256, "___ic_temp_%05d.bin", 100*id_dm_pos+2 );
-		snprintf( fnvx,256, "___ic_temp_%05d.bin", 100*id_dm_vel+0 );
-		snprintf( fnvy,256, "___ic_temp_%05d.bin", 100*id_dm_vel+1 );
-		snprintf( fnvz,256, "___ic_temp_%05d.bin", 100*id_dm_vel+2 );
-		snprintf( fnm, 256, "___ic_temp_%05d.bin", 100*id_dm_mass  );
+		music::temp_storage::get_filename(fnx, 256, 100*id_dm_pos+0);
+		music::temp_storage::get_filename(fny, 256, 100*id_dm_pos+1);
+		music::temp_storage::get_filename(fnz, 256, 100*id_dm_pos+2);
+		music::temp_storage::get_filename(fnvx, 256, 100*id_dm_vel+0);
+		music::temp_storage::get_filename(fnvy, 256, 100*id_dm_vel+1);
+		music::temp_storage::get_filename(fnvz, 256, 100*id_dm_vel+2);
+		music::temp_storage::get_filename(fnm, 256, 100*id_dm_mass);
 
-		snprintf( fnc,  256, "___ic_temp_%05d.bin", 100*id_dm_conn );
-		snprintf( fnl,  256, "___ic_temp_%05d.bin", 100*id_dm_level );
-		snprintf( fnlid,  256, "___ic_temp_%05d.bin", 100*id_dm_lagrangeid );
+		music::temp_storage::get_filename(fnc, 256, 100*id_dm_conn);
+		music::temp_storage::get_filename(fnl, 256, 100*id_dm_level);
+		music::temp_storage::get_filename(fnlid, 256, 100*id_dm_lagrangeid);
 		
     	pistream iffs1, iffs2, iffs3;
 	    
@@ -664,9 +665,9 @@ protected:
 			{
 				char ffname[256];
 				snprintf(ffname,256,"%s.%d",fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary|std::ios::trunc );
+				ofs_.open(ffname);
 			}else{
-				ofs_.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
+				ofs_.open(fname_.c_str());
 			}
 			
             
@@ -766,12 +767,14 @@ protected:
                 blksize = sizeof(size_t)*np_this_file;
                 
                 
-                //... generate contiguous IDs and store in file ..
+                //... generate contiguous IDs on all threads and store in file ..
                 ofs_.write( reinterpret_cast<char*>(&blksize), sizeof(int) );
                 while( n2read > 0ul )
                 {
-                    for( size_t i=0; i<n2read; ++i )
-                        ids[i] = idcount++;
+                    #pragma omp parallel for
+                    for( long long i=0; i<(long long)n2read; ++i )
+                        ids[i] = idcount + i;
+                    idcount += n2read;
                     ofs_.write( reinterpret_cast<char*>(&ids[0]), n2read*sizeof(size_t) );
                     npleft -= n2read;
                     n2read = std::min( curr_block_buf_size,npleft );
@@ -940,7 +943,7 @@ public:
 			{
 				char ffname[256];
 				snprintf(ffname,256,"%s.%d",fname_.c_str(), ifile);
-				ofs_.open(ffname, std::ios::binary|std::ios::trunc );
+				ofs_.open(ffname);
 				if(!ofs_.good())
 				{	
 					music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!",ffname);
@@ -949,7 +952,7 @@ public:
 				ofs_.close();	
 			}
 		}else{
-			ofs_.open(fname_.c_str(), std::ios::binary|std::ios::trunc );
+			ofs_.open(fname_.c_str());
 			if(!ofs_.good())
 			{	
 			  music::elog.Print("gadget-2 output plug-in could not open output file \'%s\' for writing!",fname_.c_str());
@@ -1206,7 +1209,7 @@ public:
 			temp_dat.reserve(block_buf_size_);
             
             char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_mass );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_mass);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
             
             double mfac = header_.Omega0 * rhoc * pow(header_.BoxSize,3.);
@@ -1264,7 +1267,7 @@ public:
 			temp_dat.reserve(block_buf_size_);
             
             char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_conn );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_conn);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
             
             size_t blksize = sizeof(long long)*num_p*8;
@@ -1323,7 +1326,7 @@ public:
 			temp_dat.reserve(block_buf_size_);
             
             char temp_fname[256];
-			snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_level );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_level);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
             
             size_t blksize = sizeof(int)*num_p;
@@ -1369,7 +1372,7 @@ public:
 			temp_dat.reserve(block_buf_size_);
             
             char temp_fname[256];
-			snprintf( temp_fname, 256,"___ic_temp_%05d.bin", 100*id_dm_lagrangeid );
+			music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_lagrangeid);
 			std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
             
             size_t blksize = sizeof(size_t)*num_p;
@@ -1420,7 +1423,7 @@ public:
         double xfac = header_.BoxSize;
         
         char temp_fname[256];
-        snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_pos+coord );
+        music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_pos+coord);
         std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
         
         // write all particle masses
@@ -1486,7 +1489,7 @@ public:
         temp_dat.reserve(block_buf_size_);
         
         char temp_fname[256];
-        snprintf( temp_fname, 256, "___ic_temp_%05d.bin", 100*id_dm_vel+coord );
+        music::temp_storage::get_filename(temp_fname, 256, 100*id_dm_vel+coord);
 		std::ofstream ofs_temp( temp_fname, std::ios::binary|std::ios::trunc );
         
         // write all particle masses
@@ -12,6 +12,7 @@
 #ifdef HAVE_HDF5
 
 #include "output.hh"
+#include "grid_compression.hh"
 #include "HDF_IO.hh"
 
 
@@ -20,9 +21,11 @@ class generic_output_plugin : public output_plugin
 protected:
 	
 	using output_plugin::cf_;
+	
+	music::grid_error_bounds error_bounds_;
 		
 	template< typename Tt >
-	void write2HDF5( std::string fname, std::string dname, const MeshvarBnd<Tt>& data )
+	void write2HDF5( std::string fname, std::string dname, const MeshvarBnd<Tt>& data, music::grid_field_kind kind )
 	{
 		int n0 = data.size(0), n1 = data.size(1), n2 = data.size(2), nb = data.m_nbnd;
 		std::vector<Tt> vdata;
@@ -32,14 +35,17 @@ protected:
 				for(int k=-nb; k<n2+nb; ++k )
 					vdata.push_back( data(i,j,k) );
 		
+		music::round_to_error_bound( &vdata[0], vdata.size(), error_bounds_.get(kind) );
+		
 		unsigned nd[3] = { (unsigned)(n0+2*nb),(unsigned)(n1+2*nb),(unsigned)(n2+2*nb)	};
 		HDFWriteDataset3D( fname, dname, nd, vdata);
 	}
 	
 public:
 	generic_output_plugin( config_file& cf )//std::string fname, Cosmology cosm, Parameters param )
-	: output_plugin( cf )//fname, cosm, param )
+	: output_plugin( cf ), error_bounds_( cf )//fname, cosm, param )
 	{
+		HDFSetIOParameters( cf );
 
 		HDFCreateFile(fname_);
 		
@@ -76,7 +82,7 @@ public:
 			else if( coord == 2 )
 				snprintf(sstr,128, "level_%03d_DM_vz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::velocity );
 		}
 	}
 	
@@ -93,7 +99,7 @@ public:
 			else if( coord == 2 )
 				snprintf(sstr,128,"level_%03d_DM_dz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::displacement );
 		}
 	}
 	
@@ -104,7 +110,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			snprintf(sstr,128,"level_%03d_DM_rho",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::density );
 		}
 
 
@@ -192,7 +198,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			snprintf(sstr,128,"level_%03d_DM_potential",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::potential );
 		}
 	}
 	
@@ -203,7 +209,7 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			snprintf(sstr,128,"level_%03d_BA_potential",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::potential );
 		}
 	}
 	
@@ -222,7 +228,7 @@ public:
 			else if( coord == 2 )
 				snprintf(sstr,128,"level_%03d_BA_vz",ilevel);
 			
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::velocity );
 		}
 	}
 	
@@ -236,10 +242,13 @@ public:
 		for( unsigned ilevel=0; ilevel<=levelmax_; ++ilevel )
 		{
 			snprintf(sstr,128,"level_%03d_BA_rho",ilevel);
-			write2HDF5( fname_, sstr, *gh.get_grid(ilevel) );
+			write2HDF5( fname_, sstr, *gh.get_grid(ilevel), music::grid_field_kind::density );
 		}
 	}
 	
+	bool writes_hdf5( void ) const
+	{ return true; }
+
 	void finalize( void )
 	{	}
 };
@@ -12,6 +12,8 @@
 #include <sys/stat.h>
 #include <fstream>
 #include "output.hh"
+#include "file_writer.hh"
+#include "grid_compression.hh"
 
 //! Implementation of class grafic2_output_plugin
 /*!
@@ -35,7 +37,9 @@ protected:
 	int passive_variable_index_;
 	float passive_variable_value_;
 
-	void write_file_header(std::ofstream &ofs, unsigned ilevel, const grid_hierarchy &gh)
+	music::grid_error_bounds error_bounds_;
+
+	void write_file_header(music::file_writer &ofs, unsigned ilevel, const grid_hierarchy &gh)
 	{
 		header loc_head;
 
@@ -68,7 +72,7 @@ protected:
 		ofs.write(reinterpret_cast<char *>(&blksz), sizeof(int));
 	}
 
-	void write_sliced_array(std::ofstream &ofs, unsigned ilevel, const grid_hierarchy &gh, float fac = 1.0f)
+	void write_sliced_array(music::file_writer &ofs, unsigned ilevel, const grid_hierarchy &gh, music::grid_field_kind kind, float fac = 1.0f)
 	{
 		unsigned n1, n2, n3;
 		n1 = gh.get_grid(ilevel)->size(0);
@@ -86,6 +90,8 @@ protected:
 				for (unsigned k = 0; k < n1; ++k)
 					data[j * n1 + k] = (*gh.get_grid(ilevel))(k, j, i) * fac;
 
+			music::round_to_error_bound(&data[0], (size_t)n1 * n2, error_bounds_.get(kind));
+
 			unsigned blksize = n1 * n2 * sizeof(float);
 
 			ofs.write(reinterpret_cast<char *>(&blksize), sizeof(unsigned));
@@ -153,15 +159,15 @@ protected:
 
 			// write mask
 			snprintf(ff, 256, "%s/level_%03d/ic_refmap", fname_.c_str(), gh.levelmax());
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 			write_file_header(ofs, gh.levelmax(), gh);
 
-			std::ofstream ofs_metals;
+			music::file_writer ofs_metals;
 
 			if (passive_variable_value_ > 0.0f)
 			{
 				snprintf(ff, 256, "%s/level_%03d/ic_pvar_%05d", fname_.c_str(), gh.levelmax(), passive_variable_index_);
-				ofs_metals.open(ff, std::ios::binary | std::ios::trunc);
+				ofs_metals.open(ff);
 				write_file_header(ofs_metals, gh.levelmax(), gh);
 			}
 
@@ -229,14 +235,14 @@ protected:
 			music::ilog.Print("%f of cells on level %d are refined", (double)nref / (n1c * n2c * n3c), ilevel);
 
 			snprintf(ff, 256, "%s/level_%03d/ic_refmap", fname_.c_str(), ilevel);
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 			write_file_header(ofs, ilevel, gh);
 
-			std::ofstream ofs_metals;
+			music::file_writer ofs_metals;
 			if (passive_variable_value_ > 0.0f)
 			{
 				snprintf(ff, 256, "%s/level_%03d/ic_pvar_%05d", fname_.c_str(), ilevel, passive_variable_index_);
-				ofs_metals.open(ff, std::ios::binary | std::ios::trunc);
+				ofs_metals.open(ff);
 				write_file_header(ofs_metals, ilevel, gh);
 			}
 
@@ -445,7 +451,7 @@ protected:
 
 public:
 	grafic2_output_plugin(config_file &cf)
-			: output_plugin(cf)
+			: output_plugin(cf), error_bounds_(cf)
 	{
 		// create directory structure
 		remove(fname_.c_str());
@@ -477,10 +483,10 @@ public:
 			char ff[256];
 			snprintf(ff, 256, "%s/level_%03d/ic_posc%c", fname_.c_str(), ilevel, (char)('x' + coord));
 
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 
 			write_file_header(ofs, ilevel, gh);
-			write_sliced_array(ofs, ilevel, gh, boxlength);
+			write_sliced_array(ofs, ilevel, gh, music::grid_field_kind::displacement, boxlength);
 		}
 	}
 
@@ -495,10 +501,10 @@ public:
 			char ff[256];
 			snprintf(ff, 256, "%s/level_%03d/ic_velc%c", fname_.c_str(), ilevel, (char)('x' + coord));
 
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 
 			write_file_header(ofs, ilevel, gh);
-			write_sliced_array(ofs, ilevel, gh, boxlength);
+			write_sliced_array(ofs, ilevel, gh, music::grid_field_kind::velocity, boxlength);
 		}
 	}
 
@@ -513,10 +519,10 @@ public:
 			char ff[256];
 			snprintf(ff, 256, "%s/level_%03d/ic_velb%c", fname_.c_str(), ilevel, (char)('x' + coord));
 
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 
 			write_file_header(ofs, ilevel, gh);
-			write_sliced_array(ofs, ilevel, gh, boxlength);
+			write_sliced_array(ofs, ilevel, gh, music::grid_field_kind::velocity, boxlength);
 		}
 	}
 
@@ -528,10 +534,10 @@ public:
 			char ff[256];
 			snprintf(ff, 256, "%s/level_%03d/ic_deltab", fname_.c_str(), ilevel);
 
-			std::ofstream ofs(ff, std::ios::binary | std::ios::trunc);
+			music::file_writer ofs(ff);
 
 			write_file_header(ofs, ilevel, gh);
-			write_sliced_array(ofs, ilevel, gh);
+			write_sliced_array(ofs, ilevel, gh, music::grid_field_kind::density);
 		}
 	}
 
@@ -0,0 +1,308 @@
+/*
+
+ output_lattice.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include "logger.hh"
+#include "output.hh"
+#include "file_writer.hh"
+#include "mesh.hh"
+
+/*!
+ * @class lattice_output_plugin
+ * @brief compact particle output relative to the unperturbed lattice
+ *
+ * Every particle sits close to the centre of its leaf cell, so instead of
+ * absolute positions only the lattice (offset, size and leaf cells of each
+ * level) and the displacements and velocities are stored. Both are
+ * quantised to 16 bit integers with one scale factor and the maximum
+ * quantisation error per block of particles. Displacements are in units of
+ * the cell size of the particle's level, velocities are peculiar velocities
+ * in km/s. Baryons sit on the lattice shifted by half a cell of the finest
+ * level along each axis (file_header::gas_shift), as in all other particle
+ * plug-ins. The layout is documented in, and read by, the reference decoder
+ * tools/lattice_ic_reader.hh; both have to be kept in sync.
+ *
+ * File layout (native byte order):
+ *   file_header
+ *   for each level levelmin..levelmax: level_header, leaf cell bitmap
+ *   field sections in the order they are written: section_header, then
+ *   for each level levelmin..levelmax the blocks of that level
+ *   (float scale, float maxerr, int16 values[n])
+ */
+class lattice_output_plugin : public output_plugin
+{
+protected:
+	enum fields
+	{
+		field_dm_dx = 0,
+		field_dm_vx = 3,
+		field_gas_dx = 6,
+		field_gas_vx = 9
+	};
+
+	struct file_header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t levelmin, levelmax;
+		uint32_t block_size;
+		double boxlength; //!< in Mpc/h
+		double astart;
+		double omega_m, omega_b, H0;
+		uint32_t has_baryons;
+		uint32_t reserved;
+		double gas_shift; //!< offset of the baryon lattice along each axis in units of the box (version 2)
+	};
+
+	struct level_header
+	{
+		int32_t level;
+		int32_t offset[3]; //!< absolute offset in cells of this level
+		uint32_t size[3];
+		uint32_t reserved;
+		uint64_t npart;
+		double mass; //!< total matter particle mass in 1e10 Msol/h
+	};
+
+	struct section_header
+	{
+		uint32_t field;
+		uint32_t reserved;
+		uint64_t nbytes; //!< size of the section payload that follows
+	};
+
+	music::file_writer ofs_;
+	bool bheader_written_;
+	bool do_baryons_;
+	unsigned block_size_;
+	double boxlength_, astart_, omega_m_, omega_b_, H0_;
+	double max_error_;
+
+	void write_header(const grid_hierarchy &gh)
+	{
+		if (bheader_written_)
+			return;
+		bheader_written_ = true;
+
+		file_header fh;
+		memset(&fh, 0, sizeof(fh));
+		memcpy(fh.magic, "MUSICLAT", 8);
+		fh.version = 2;
+		fh.levelmin = levelmin_;
+		fh.levelmax = levelmax_;
+		fh.block_size = block_size_;
+		fh.boxlength = boxlength_;
+		fh.astart = astart_;
+		fh.omega_m = omega_m_;
+		fh.omega_b = omega_b_;
+		fh.H0 = H0_;
+		fh.has_baryons = do_baryons_;
+		//... the same shift is used for the SPH baryon convolution kernel and by the Gadget plug-ins
+		fh.gas_shift = do_baryons_ ? 0.5 / (double)(1ull << levelmax_) : 0.0;
+
+		ofs_.write(reinterpret_cast<char *>(&fh), sizeof(file_header));
+
+		const double rhoc = 27.7519737; // in h^2 1e10 M_sol / Mpc^3
+
+		for (unsigned ilevel = levelmin_; ilevel <= levelmax_; ++ilevel)
+		{
+			const MeshvarBnd<real_t> *g = gh.get_grid(ilevel);
+
+			level_header lh;
+			memset(&lh, 0, sizeof(lh));
+			lh.level = ilevel;
+			for (int idim = 0; idim < 3; ++idim)
+			{
+				lh.offset[idim] = gh.offset_abs(ilevel, idim);
+				lh.size[idim] = g->size(idim);
+			}
+			lh.npart = gh.count_leaf_cells(ilevel, ilevel);
+			lh.mass = omega_m_ * rhoc * pow(boxlength_, 3.) / pow(2, 3 * ilevel);
+
+			std::vector<uint8_t> bitmap((g->size(0) * g->size(1) * g->size(2) + 7) / 8, 0);
+			size_t idx = 0;
+			for (unsigned i = 0; i < g->size(0); ++i)
+				for (unsigned j = 0; j < g->size(1); ++j)
+					for (unsigned k = 0; k < g->size(2); ++k, ++idx)
+						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
+							bitmap[idx / 8] |= (uint8_t)(1u << (idx % 8));
+
+			ofs_.write(reinterpret_cast<char *>(&lh), sizeof(level_header));
+			ofs_.write(reinterpret_cast<char *>(&bitmap[0]), bitmap.size());
+		}
+	}
+
+	//! size in bytes of the quantised blocks of n particles
+	size_t blocks_nbytes(size_t n) const
+	{
+		size_t nblocks = (n + block_size_ - 1) / block_size_;
+		return nblocks * 2 * sizeof(float) + n * sizeof(int16_t);
+	}
+
+	void write_field(unsigned field, const grid_hierarchy &gh, double fac_level0, bool bscale_with_level)
+	{
+		write_header(gh);
+
+		section_header sh;
+		sh.field = field;
+		sh.reserved = 0;
+		sh.nbytes = 0;
+		for (unsigned ilevel = levelmin_; ilevel <= levelmax_; ++ilevel)
+			sh.nbytes += blocks_nbytes(gh.count_leaf_cells(ilevel, ilevel));
+
+		ofs_.write(reinterpret_cast<char *>(&sh), sizeof(section_header));
+
+		double max_err = 0.0;
+
+		for (unsigned ilevel = levelmin_; ilevel <= levelmax_; ++ilevel)
+		{
+			//... displacements are stored in units of the cell size of each level
+			double fac = bscale_with_level ? fac_level0 * (double)(1ull << ilevel) : fac_level0;
+
+			std::vector<double> values;
+			values.reserve(gh.count_leaf_cells(ilevel, ilevel));
+
+			const MeshvarBnd<real_t> *g = gh.get_grid(ilevel);
+			for (unsigned i = 0; i < g->size(0); ++i)
+				for (unsigned j = 0; j < g->size(1); ++j)
+					for (unsigned k = 0; k < g->size(2); ++k)
+						if (gh.is_in_mask(ilevel, i, j, k) && !gh.is_refined(ilevel, i, j, k))
+							values.push_back((*g)(i, j, k) * fac);
+
+			const size_t n = values.size();
+			const long long nblocks = (long long)((n + block_size_ - 1) / block_size_);
+			std::vector<char> buf(blocks_nbytes(n));
+
+#pragma omp parallel for reduction(max : max_err)
+			for (long long ib = 0; ib < nblocks; ++ib)
+			{
+				size_t i0 = ib * block_size_, i1 = std::min(n, i0 + block_size_);
+
+				double vmax = 0.0;
+				for (size_t i = i0; i < i1; ++i)
+					vmax = std::max(vmax, fabs(values[i]));
+
+				float scale = (float)(vmax / 32767.0), maxerr = 0.0f;
+				char *pblock = &buf[ib * 2 * sizeof(float) + i0 * sizeof(int16_t)];
+				int16_t *q = reinterpret_cast<int16_t *>(pblock + 2 * sizeof(float));
+
+				for (size_t i = i0; i < i1; ++i)
+				{
+					long iq = (scale > 0.0f) ? lround(values[i] / scale) : 0;
+					iq = std::max(-32767l, std::min(32767l, iq));
+					q[i - i0] = (int16_t)iq;
+					maxerr = std::max(maxerr, (float)fabs(values[i] - (double)iq * scale));
+				}
+
+				memcpy(pblock, &scale, sizeof(float));
+				memcpy(pblock + sizeof(float), &maxerr, sizeof(float));
+
+				max_err = std::max(max_err, (double)maxerr);
+			}
+
+			if (!buf.empty())
+				ofs_.write(&buf[0], buf.size());
+		}
+
+		if (!ofs_.good())
+			throw std::runtime_error("I/O error while writing lattice output file");
+
+		if (bscale_with_level && max_err > max_error_)
+			music::wlog.Print("Lattice output: displacement error %g [dx] of field %u exceeds lattice_max_error = %g", max_err, field, max_error_);
+		else
+			music::ilog.Print("Lattice output: max. quantisation error of field %u is %g %s", field, max_err, bscale_with_level ? "[dx]" : "[km/s]");
+	}
+
+public:
+	explicit lattice_output_plugin(config_file &cf)
+			: output_plugin(cf), bheader_written_(false)
+	{
+		block_size_ = cf.get_value_safe<unsigned>("output", "lattice_block_size", 4096);
+		max_error_ = cf.get_value_safe<double>("output", "lattice_max_error", 1e-3);
+
+		do_baryons_ = cf.get_value_safe<bool>("setup", "baryons", false);
+		boxlength_ = cf.get_value<double>("setup", "boxlength");
+		astart_ = 1.0 / (1.0 + cf.get_value<double>("setup", "zstart"));
+		omega_m_ = cf.get_value<double>("cosmology", "Omega_m");
+		omega_b_ = cf.get_value_safe<double>("cosmology", "Omega_b", 0.0);
+		H0_ = cf.get_value<double>("cosmology", "H0");
+
+		if (block_size_ == 0)
+			throw std::runtime_error("lattice output plug-in: lattice_block_size must be positive");
+
+		ofs_.open(fname_);
+		if (!ofs_.good())
+		{
+			music::elog.Print("lattice output plug-in could not open output file \'%s\' for writing!", fname_.c_str());
+			throw std::runtime_error(std::string("lattice output plug-in could not open output file \'") + fname_ + "\' for writing!\n");
+		}
+	}
+
+	~lattice_output_plugin()
+	{
+	}
+
+	void write_dm_mass(const grid_hierarchy &gh)
+	{
+		//... masses follow from the level, they are stored in the level headers
+	}
+
+	void write_dm_density(const grid_hierarchy &gh)
+	{
+	}
+
+	void write_dm_potential(const grid_hierarchy &gh)
+	{
+	}
+
+	//! displacement relative to the lattice point in units of the level's cell size
+	void write_dm_position(int coord, const grid_hierarchy &gh)
+	{
+		write_field(field_dm_dx + coord, gh, 1.0, true);
+	}
+
+	//! peculiar velocity in km/s
+	void write_dm_velocity(int coord, const grid_hierarchy &gh)
+	{
+		write_field(field_dm_vx + coord, gh, boxlength_, false);
+	}
+
+	void write_gas_velocity(int coord, const grid_hierarchy &gh)
+	{
+		write_field(field_gas_vx + coord, gh, boxlength_, false);
+	}
+
+	void write_gas_position(int coord, const grid_hierarchy &gh)
+	{
+		write_field(field_gas_dx + coord, gh, 1.0, true);
+	}
+
+	void write_gas_density(const grid_hierarchy &gh)
+	{
+	}
+
+	void write_gas_potential(const grid_hierarchy &gh)
+	{
+	}
+
+	void finalize(void)
+	{
+		ofs_.close();
+	}
+};
+
+namespace
+{
+	output_plugin_creator_concrete<lattice_output_plugin> creator1("lattice");
+}
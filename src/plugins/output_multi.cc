@@ -0,0 +1,293 @@
+/*
+
+ output_multi.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ */
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "logger.hh"
+#include "output.hh"
+#include "grid_pager.hh"
+
+/*!
+ * @class multi_output_plugin
+ * @brief writes the same run with several output plug-ins
+ *
+ * [output] format = multi hands every field to each plug-in listed in
+ * [output] formats (comma separated), so that one pass of the driver feeds
+ * all of them, e.g. formats = gadget2, generic. Each plug-in writes to
+ * [output] filename_<format>, by default [output] filename with '_<format>'
+ * inserted before the extension, and reads its other options from the
+ * parameter file as if it had been selected on its own.
+ *
+ * With [output] multi_parallel = yes, the plug-ins are called concurrently,
+ * each on its own thread, and read the same hierarchies. Plug-ins that write
+ * HDF5 share one thread, as the HDF5 library is not thread-safe in general.
+ * While the grid pager is active, the plug-ins are always called one after
+ * the other, since reading a paged out level brings it back into memory.
+ */
+class multi_output_plugin : public output_plugin
+{
+protected:
+	struct target
+	{
+		std::string format;
+		std::string fname;
+		output_plugin *plugin;
+		int set; //!< temporary file set of this plug-in
+	};
+
+	std::vector<target> targets_;
+	std::vector<std::vector<const target *>> groups_; //!< plug-ins called on the same thread
+	bool bparallel_;
+
+	//! call f for the plug-in of every target, on one thread per group if multi_parallel is set
+	template <typename F>
+	void each(F f)
+	{
+		const int set = music::temp_storage::selected_set();
+
+		if (!bparallel_ || groups_.size() < 2 || music::grid_pager::enabled())
+		{
+			for (auto &t : targets_)
+			{
+				music::temp_storage::select_set(t.set);
+				try
+				{
+					f(*t.plugin);
+				}
+				catch (...)
+				{
+					music::temp_storage::select_set(set);
+					throw;
+				}
+			}
+			music::temp_storage::select_set(set);
+			return;
+		}
+
+		std::vector<std::exception_ptr> errors(groups_.size());
+		auto run_group = [&](size_t ig)
+		{
+			try
+			{
+				for (auto t : groups_[ig])
+				{
+					music::temp_storage::select_set(t->set);
+					f(*t->plugin);
+				}
+			}
+			catch (...)
+			{
+				errors[ig] = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t ig = 1; ig < groups_.size(); ++ig)
+			threads.emplace_back(run_group, ig);
+		run_group(0);
+		for (auto &th : threads)
+			th.join();
+
+		music::temp_storage::select_set(set);
+		for (auto &e : errors)
+			if (e)
+				std::rethrow_exception(e);
+	}
+
+public:
+	explicit multi_output_plugin(config_file &cf)
+			: output_plugin(cf)
+	{
+		std::vector<std::string> formats = output_formats(cf);
+		bparallel_ = cf.get_value_safe<bool>("output", "multi_parallel", false);
+
+		if (formats.empty())
+			throw std::runtime_error("output plug-in \'multi\' needs a list of plug-ins in [output] formats");
+
+		//... the paired and zstart list outputs have their own file name, derive from it only
+		const int set = music::temp_storage::selected_set();
+		const std::string format = cf.get_value<std::string>("output", "format");
+
+		for (size_t i = 0; i < formats.size(); ++i)
+		{
+			target t;
+			t.format = formats[i];
+			t.fname = output_filename_with_suffix(fname_, "_" + t.format);
+			if (set == 0)
+				t.fname = cf.get_value_safe<std::string>("output", "filename_" + t.format, t.fname);
+			t.set = set + 1000 * (int)i;
+			t.plugin = nullptr;
+
+			if (t.format == "multi")
+				throw std::runtime_error("output plug-in \'multi\' cannot write through itself");
+			for (auto &u : targets_)
+				if (u.format == t.format || u.fname == t.fname)
+				{
+					music::elog.Print("Output plug-ins \'%s\' and \'%s\' of [output] formats would both write \'%s\'",
+														u.format.c_str(), t.format.c_str(), t.fname.c_str());
+					throw std::runtime_error("output plug-in \'multi\': duplicate output");
+				}
+
+			//... construct the plug-in as if it had been selected on its own
+			cf.insert_value("output", "format", t.format);
+			cf.insert_value("output", "filename", t.fname);
+			music::temp_storage::select_set(t.set);
+			try
+			{
+				t.plugin = select_output_plugin(cf);
+			}
+			catch (...)
+			{
+				music::temp_storage::select_set(set);
+				cf.insert_value("output", "format", format);
+				cf.insert_value("output", "filename", fname_);
+				for (auto &u : targets_)
+					delete u.plugin;
+				throw;
+			}
+			music::temp_storage::select_set(set);
+			cf.insert_value("output", "format", format);
+			cf.insert_value("output", "filename", fname_);
+
+			targets_.push_back(t);
+			music::ilog.Print("Output plug-in \'%s\' writes to \'%s\'", t.format.c_str(), t.fname.c_str());
+		}
+
+		//... one group with all HDF5 writers, every other plug-in in a group of its own
+		std::vector<const target *> hdf5;
+		for (auto &t : targets_)
+		{
+			if (t.plugin->writes_hdf5())
+				hdf5.push_back(&t);
+			else
+				groups_.push_back({&t});
+		}
+		if (!hdf5.empty())
+			groups_.insert(groups_.begin(), hdf5);
+
+		if (bparallel_)
+			music::ilog.Print("Calling %zu output plug-ins on %zu threads", targets_.size(), groups_.size());
+	}
+
+	~multi_output_plugin()
+	{
+		for (auto &t : targets_)
+			delete t.plugin;
+	}
+
+	void write_dm_mass(const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_mass(gh); });
+	}
+
+	void write_dm_density(const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_density(gh); });
+	}
+
+	void write_dm_potential(const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_potential(gh); });
+	}
+
+	void write_dm_velocity(int coord, const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_velocity(coord, gh); });
+	}
+
+	void write_dm_position(int coord, const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_position(coord, gh); });
+	}
+
+	void write_gas_velocity(int coord, const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_velocity(coord, gh); });
+	}
+
+	void write_gas_position(int coord, const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_position(coord, gh); });
+	}
+
+	void write_gas_density(const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_density(gh); });
+	}
+
+	void write_gas_potential(const grid_hierarchy &gh)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_potential(gh); });
+	}
+
+	//! the driver keeps all components if one plug-in wants them, the others get one call per component
+	bool supports_vector_fields(void) const
+	{
+		for (auto &t : targets_)
+			if (t.plugin->supports_vector_fields())
+				return true;
+		return false;
+	}
+
+	void write_dm_positions(const grid_hierarchy &x, const grid_hierarchy &y, const grid_hierarchy &z)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_positions(x, y, z); });
+	}
+
+	void write_dm_velocities(const grid_hierarchy &vx, const grid_hierarchy &vy, const grid_hierarchy &vz)
+	{
+		each([&](output_plugin &p)
+				 { p.write_dm_velocities(vx, vy, vz); });
+	}
+
+	void write_gas_positions(const grid_hierarchy &x, const grid_hierarchy &y, const grid_hierarchy &z)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_positions(x, y, z); });
+	}
+
+	void write_gas_velocities(const grid_hierarchy &vx, const grid_hierarchy &vy, const grid_hierarchy &vz)
+	{
+		each([&](output_plugin &p)
+				 { p.write_gas_velocities(vx, vy, vz); });
+	}
+
+	bool writes_hdf5(void) const
+	{
+		for (auto &t : targets_)
+			if (t.plugin->writes_hdf5())
+				return true;
+		return false;
+	}
+
+	void finalize(void)
+	{
+		each([&](output_plugin &p)
+				 { p.finalize(); });
+	}
+};
+
+namespace
+{
+	output_plugin_creator_concrete<multi_output_plugin> creator1("multi");
+}
@@ -0,0 +1,425 @@
+/*
+
+ output_stream.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "logger.hh"
+#include "output.hh"
+#include "particle_order.hh"
+#include "mesh.hh"
+
+/*!
+ * @class stream_output_plugin
+ * @brief sends the particles to a consumer process instead of writing a file
+ *
+ * The consumer (e.g. the simulation code started in the same job, or the
+ * reference receiver tools/stream_ic_receiver.cc) creates a Unix domain
+ * socket or named pipe, MUSIC connects to it and sends every particle field
+ * as soon as it has been computed, so that the consumer can ingest it while
+ * MUSIC is still working on the next field. Writes block while the consumer
+ * is busy, which throttles MUSIC to the speed of the consumer.
+ *
+ * [output] filename = unix:<path> connects to a listening stream socket,
+ * any other filename is opened as a named pipe (created if it does not
+ * exist). Particle types and units follow the Gadget conventions: type 0 gas
+ * and type 1 dark matter on the finest level, type 5 all coarser levels;
+ * positions in Mpc/h, velocities in km/s * a^-1/2, masses in 1e10 Msol/h.
+ * Particle IDs are implicit, the particles of each type are sent in the
+ * same order for all fields.
+ *
+ * Stream layout (native byte order), a sequence of frames:
+ *   frame_header {kind = frame_begin}, stream_header
+ *   frame_header {kind = frame_block, field, ptype, component, first, count}, float values[count]
+ *   ...
+ *   frame_header {kind = frame_end}
+ * Blocks of one (field, ptype, component) arrive in order of 'first'.
+ */
+class stream_output_plugin : public output_plugin
+{
+protected:
+	enum frame_kind
+	{
+		frame_begin = 1,
+		frame_block = 2,
+		frame_end = 3
+	};
+
+	enum field_id
+	{
+		field_pos = 1,
+		field_vel = 2,
+		field_mass = 3
+	};
+
+	struct frame_header
+	{
+		char magic[4]; //!< "MSTR"
+		uint32_t kind;
+		uint32_t field;
+		uint32_t ptype;
+		uint32_t component;
+		uint32_t elem_size; //!< bytes per value
+		uint64_t first;			//!< index of the first value of the block within its particle type
+		uint64_t count;			//!< number of values in the block
+	};
+
+	struct stream_header
+	{
+		uint64_t npart[6];
+		double mass[6]; //!< mass of particle type, 0 if a mass field is sent
+		double time, redshift, boxsize;
+		double omega0, omegalambda, hubbleparam;
+		uint32_t levelmin, levelmax;
+	};
+
+	int fd_;
+	bool bheader_sent_;
+	bool do_baryons_;
+	size_t block_size_;
+	uint64_t nbytes_sent_;
+	double tstart_;
+	double boxlength_, astart_, omega_m_, omega_b_, omega_l_, H0_;
+	music::leaf_cell_order cell_order_;
+
+	static double wallclock(void)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//! write n bytes, blocking until the consumer has taken them
+	void send_raw(const void *data, size_t n)
+	{
+		const char *p = reinterpret_cast<const char *>(data);
+		while (n > 0)
+		{
+			ssize_t nw = ::write(fd_, p, n);
+			if (nw < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno == EPIPE)
+					throw std::runtime_error("stream output plug-in: consumer closed the stream");
+				throw std::runtime_error(std::string("stream output plug-in: write failed: ") + strerror(errno));
+			}
+			p += nw;
+			n -= nw;
+			nbytes_sent_ += nw;
+		}
+	}
+
+	void send_frame(uint32_t kind, uint32_t field, uint32_t ptype, uint32_t component, uint64_t first, const std::vector<float> &values)
+	{
+		frame_header fh;
+		memcpy(fh.magic, "MSTR", 4);
+		fh.kind = kind;
+		fh.field = field;
+		fh.ptype = ptype;
+		fh.component = component;
+		fh.elem_size = sizeof(float);
+		fh.first = first;
+		fh.count = values.size();
+
+		send_raw(&fh, sizeof(frame_header));
+		if (!values.empty())
+			send_raw(&values[0], sizeof(float) * values.size());
+	}
+
+	void open_socket(const std::string &path, double timeout)
+	{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+			throw std::runtime_error("stream output plug-in: socket path \'" + path + "\' is too long");
+		strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+		//... the consumer may still be starting up, retry until the timeout
+		double tstart = wallclock();
+		while (true)
+		{
+			fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd_ < 0)
+				throw std::runtime_error(std::string("stream output plug-in: could not create socket: ") + strerror(errno));
+
+			if (connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+				return;
+
+			int err = errno;
+			close(fd_);
+			fd_ = -1;
+
+			if ((err != ENOENT && err != ECONNREFUSED) || wallclock() - tstart > timeout)
+				throw std::runtime_error("stream output plug-in: could not connect to \'" + path + "\': " + strerror(err));
+
+			usleep(100000);
+		}
+	}
+
+	void open_fifo(const std::string &path)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+		{
+			if (mkfifo(path.c_str(), 0600) != 0)
+				throw std::runtime_error("stream output plug-in: could not create named pipe \'" + path + "\': " + strerror(errno));
+		}
+		else if (!S_ISFIFO(st.st_mode))
+			throw std::runtime_error("stream output plug-in: \'" + path + "\' exists and is not a named pipe");
+
+		//... blocks until the consumer opens the other end
+		fd_ = open(path.c_str(), O_WRONLY);
+		if (fd_ < 0)
+			throw std::runtime_error("stream output plug-in: could not open named pipe \'" + path + "\': " + strerror(errno));
+	}
+
+	//! particle mass of a level in 1e10 Msol/h (total matter, or dark matter only on the finest level with baryons)
+	double level_mass(int ilevel, bool bdm_only) const
+	{
+		const double rhoc = 27.7519737; // in h^2 1e10 M_sol / Mpc^3
+		double omega = bdm_only ? omega_m_ - omega_b_ : omega_m_;
+		return omega * rhoc * pow(boxlength_, 3.) / pow(2, 3 * ilevel);
+	}
+
+	void send_header(const grid_hierarchy &gh)
+	{
+		if (bheader_sent_)
+			return;
+		bheader_sent_ = true;
+
+		stream_header sh;
+		memset(&sh, 0, sizeof(sh));
+
+		sh.npart[1] = gh.count_leaf_cells(levelmax_, levelmax_);
+		sh.mass[1] = level_mass(levelmax_, do_baryons_);
+		if (do_baryons_)
+		{
+			sh.npart[0] = sh.npart[1];
+			sh.mass[0] = omega_b_ * 27.7519737 * pow(boxlength_, 3.) / pow(2, 3 * levelmax_);
+		}
+		if (levelmax_ > levelmin_)
+			sh.npart[5] = gh.count_leaf_cells(levelmin_, levelmax_ - 1);
+
+		sh.time = astart_;
+		sh.redshift = 1.0 / astart_ - 1.0;
+		sh.boxsize = boxlength_;
+		sh.omega0 = omega_m_;
+		sh.omegalambda = omega_l_;
+		sh.hubbleparam = H0_ / 100.0;
+		sh.levelmin = levelmin_;
+		sh.levelmax = levelmax_;
+
+		frame_header fh;
+		memset(&fh, 0, sizeof(fh));
+		memcpy(fh.magic, "MSTR", 4);
+		fh.kind = frame_begin;
+		fh.count = sizeof(stream_header);
+
+		send_raw(&fh, sizeof(frame_header));
+		send_raw(&sh, sizeof(stream_header));
+
+		music::ilog.Print("Stream output: sending %llu gas, %llu fine and %llu coarse particles",
+											(unsigned long long)sh.npart[0], (unsigned long long)sh.npart[1], (unsigned long long)sh.npart[5]);
+	}
+
+	//! send value(ilevel,i,j,k) of all particles of levels levelhi..levello in blocks
+	template <typename F>
+	void send_field(const grid_hierarchy &gh, uint32_t field, uint32_t ptype, uint32_t component, int levelhi, int levello, F value)
+	{
+		send_header(gh);
+
+		std::vector<float> block;
+		block.reserve(block_size_);
+		uint64_t first = 0;
+
+		cell_order_.for_each(gh, levelhi, levello, [&](int ilevel, unsigned i, unsigned j, unsigned k)
+		{
+			block.push_back(value(ilevel, i, j, k));
+			if (block.size() == block_size_)
+			{
+				send_frame(frame_block, field, ptype, component, first, block);
+				first += block.size();
+				block.clear();
+			}
+		});
+
+		if (!block.empty())
+			send_frame(frame_block, field, ptype, component, first, block);
+	}
+
+	void send_positions(int coord, const grid_hierarchy &gh, bool bgas)
+	{
+		//... gas particles are shifted by half a fine cell, as the same shift
+		//... is used when computing the convolution kernel for SPH baryons
+		double shift = bgas ? 0.5 / (1ul << levelmax_) : 0.0;
+
+		auto pos = [&](int ilevel, unsigned i, unsigned j, unsigned k)
+		{
+			double xx[3];
+			gh.cell_pos(ilevel, i, j, k, xx);
+			//... wrap periodically into [0,boxlength), as the gadget2 plug-in does
+			double x = (xx[coord] + shift + (*gh.get_grid(ilevel))(i, j, k)) * boxlength_;
+			return (float)fmod(x + boxlength_, boxlength_);
+		};
+
+		if (bgas)
+		{
+			send_field(gh, field_pos, 0, coord, levelmax_, levelmax_, pos);
+			return;
+		}
+
+		send_field(gh, field_pos, 1, coord, levelmax_, levelmax_, pos);
+		if (levelmax_ > levelmin_)
+			send_field(gh, field_pos, 5, coord, levelmax_ - 1, levelmin_, pos);
+	}
+
+	void send_velocities(int coord, const grid_hierarchy &gh, bool bgas)
+	{
+		double vfac = boxlength_ / sqrt(astart_);
+
+		auto vel = [&](int ilevel, unsigned i, unsigned j, unsigned k)
+		{
+			return (float)((*gh.get_grid(ilevel))(i, j, k) * vfac);
+		};
+
+		if (bgas)
+		{
+			send_field(gh, field_vel, 0, coord, levelmax_, levelmax_, vel);
+			return;
+		}
+
+		send_field(gh, field_vel, 1, coord, levelmax_, levelmax_, vel);
+		if (levelmax_ > levelmin_)
+			send_field(gh, field_vel, 5, coord, levelmax_ - 1, levelmin_, vel);
+	}
+
+public:
+	explicit stream_output_plugin(config_file &cf)
+			: output_plugin(cf), fd_(-1), bheader_sent_(false), nbytes_sent_(0)
+	{
+		block_size_ = cf.get_value_safe<size_t>("output", "stream_block_size", 1 << 18);
+		double timeout = cf.get_value_safe<double>("output", "stream_connect_timeout", 60.0);
+
+		do_baryons_ = cf.get_value_safe<bool>("setup", "baryons", false);
+		boxlength_ = cf.get_value<double>("setup", "boxlength");
+		astart_ = 1.0 / (1.0 + cf.get_value<double>("setup", "zstart"));
+		omega_m_ = cf.get_value<double>("cosmology", "Omega_m");
+		omega_b_ = cf.get_value_safe<double>("cosmology", "Omega_b", 0.0);
+		omega_l_ = cf.get_value<double>("cosmology", "Omega_L");
+		H0_ = cf.get_value<double>("cosmology", "H0");
+
+		if (block_size_ == 0)
+			throw std::runtime_error("stream output plug-in: stream_block_size must be positive");
+
+		//... gas is sent as particles, so we need the baryon displacements
+		if (do_baryons_)
+			cf.insert_value("setup", "do_SPH", "yes");
+
+		cell_order_ = music::leaf_cell_order(music::get_particle_ordering(cf));
+
+		//... a consumer going away must not kill us with SIGPIPE, we report EPIPE instead
+		signal(SIGPIPE, SIG_IGN);
+
+		const std::string prefix("unix:");
+		if (fname_.compare(0, prefix.size(), prefix) == 0)
+		{
+			music::ilog.Print("Stream output: connecting to socket \'%s\'", fname_.c_str() + prefix.size());
+			open_socket(fname_.substr(prefix.size()), timeout);
+		}
+		else
+		{
+			music::ilog.Print("Stream output: waiting for a reader on named pipe \'%s\'", fname_.c_str());
+			open_fifo(fname_);
+		}
+
+		tstart_ = wallclock();
+	}
+
+	~stream_output_plugin()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+	void write_dm_mass(const grid_hierarchy &gh)
+	{
+		send_header(gh);
+
+		//... the coarse particles have different masses, send them as a field
+		if (levelmax_ > levelmin_)
+			send_field(gh, field_mass, 5, 0, levelmax_ - 1, levelmin_, [&](int ilevel, unsigned i, unsigned j, unsigned k)
+			{
+				return (float)level_mass(ilevel, false);
+			});
+	}
+
+	void write_dm_density(const grid_hierarchy &gh)
+	{
+	}
+
+	void write_dm_potential(const grid_hierarchy &gh)
+	{
+	}
+
+	void write_dm_position(int coord, const grid_hierarchy &gh)
+	{
+		send_positions(coord, gh, false);
+	}
+
+	void write_dm_velocity(int coord, const grid_hierarchy &gh)
+	{
+		send_velocities(coord, gh, false);
+	}
+
+	void write_gas_velocity(int coord, const grid_hierarchy &gh)
+	{
+		send_velocities(coord, gh, true);
+	}
+
+	void write_gas_position(int coord, const grid_hierarchy &gh)
+	{
+		send_positions(coord, gh, true);
+	}
+
+	void write_gas_density(const grid_hierarchy &gh)
+	{
+	}
+
+	void write_gas_potential(const grid_hierarchy &gh)
+	{
+	}
+
+	void finalize(void)
+	{
+		send_frame(frame_end, 0, 0, 0, 0, std::vector<float>());
+		close(fd_);
+		fd_ = -1;
+
+		double dt = wallclock() - tstart_;
+		music::ilog.Print("Stream output: sent %.1f MB in %.2f s", nbytes_sent_ / 1048576.0, dt);
+		cell_order_.clear();
+	}
+};
+
+namespace
+{
+	output_plugin_creator_concrete<stream_output_plugin> creator1("stream");
+}
@@ -73,7 +73,7 @@ protected:
           HDF_Dims = data.size() - offset;
       }
 
-      HDF_FileID = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+      HDF_FileID = HDFFileOpen(filename, H5F_ACC_RDWR);
       HDF_GroupID = H5Gopen(HDF_FileID, GrpName.str().c_str());
 
       HDF_Type = GetDataType<T>();
@@ -81,7 +81,7 @@ protected:
       HDF_DatasetID = H5Dcreate(HDF_GroupID, fieldName.c_str(), HDF_Type, HDF_DataspaceID, H5P_DEFAULT);
 
       // write and close
-      H5Dwrite(HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[offset]);
+      HDFDatasetWrite(HDF_DatasetID, HDF_Type, H5S_ALL, H5S_ALL, &data[offset]);
 
       H5Dclose(HDF_DatasetID);
       H5Sclose(HDF_DataspaceID);
@@ -117,7 +117,7 @@ protected:
           HDF_Dims[0] = data.size() - w_offset;
       }
 
-      HDF_FileID = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+      HDF_FileID = HDFFileOpen(filename, H5F_ACC_RDWR);
       HDF_GroupID = H5Gopen(HDF_FileID, GrpName.str().c_str());
 
       HDF_Type = GetDataType<T>();
@@ -152,7 +152,7 @@ protected:
       if (readFlag)
         H5Dread(HDF_DatasetID, HDF_Type, HDF_MemoryspaceID, HDF_DataspaceID, H5P_DEFAULT, &data[w_offset]);
       else
-        H5Dwrite(HDF_DatasetID, HDF_Type, HDF_MemoryspaceID, HDF_DataspaceID, H5P_DEFAULT, &data[w_offset]);
+        HDFDatasetWrite(HDF_DatasetID, HDF_Type, HDF_MemoryspaceID, HDF_DataspaceID, &data[w_offset]);
 
       H5Dclose(HDF_DatasetID);
       H5Gclose(HDF_GroupID);
@@ -536,6 +536,9 @@ public:
     // -> instead of just writing gas densities (which are here ignored), the gas displacements are also written
     cf.insert_value("setup", "do_SPH", "yes");
 
+    // HDF5 file access and transfer tuning, see HDF_IO.hh
+    HDFSetIOParameters(cf);
+
     // init header and config parameters
     nPartTotal = std::vector<long long>(NTYPES, 0);
     massTable = std::vector<double>(NTYPES, 0.0);
@@ -720,6 +723,8 @@ public:
   void write_gas_potential(const grid_hierarchy &gh) { /* skip */
   }
 
+  bool writes_hdf5(void) const { return true; }
+
   void finalize(void) {
     // generate and add contiguous IDs for each particle type we have written
     generateAndWriteIDs();
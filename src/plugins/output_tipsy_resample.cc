@@ -270,8 +270,8 @@ protected:
 
                 /*** positions ***/
 
-            snprintf (fc, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + icomp);
-            snprintf (fb, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + icomp);
+            music::temp_storage::get_filename(fc, 256, 100 * id_dm_pos + icomp);
+            music::temp_storage::get_filename(fb, 256, 100 * id_gas_pos + icomp);
 
             iffs1.open (fc, nptot, npfine * sizeof (T_store));
             iffs2.open (fb, nptot, npfine * sizeof (T_store));
@@ -301,8 +301,8 @@ protected:
 
             /*** velocities ***/
 
-            snprintf (fc, 256, "___ic_temp_%05d.bin", 100 * id_dm_vel + icomp);
-            snprintf (fb, 256, "___ic_temp_%05d.bin", 100 * id_gas_vel + icomp);
+            music::temp_storage::get_filename(fc, 256, 100 * id_dm_vel + icomp);
+            music::temp_storage::get_filename(fb, 256, 100 * id_gas_vel + icomp);
 
             iffs1.open (fc, nptot, npfine * sizeof (T_store));
             iffs2.open (fb, nptot, npfine * sizeof (T_store));
@@ -351,21 +351,21 @@ protected:
         char fnbx[256], fnby[256], fnbz[256], fnbvx[256], fnbvy[256], fnbvz[256],
           fnbm[256];
 
-        snprintf (fnx, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 0);
-        snprintf (fny, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 1);
-        snprintf (fnz, 256, "___ic_temp_%05d.bin", 100 * id_dm_pos + 2);
-        snprintf (fnvx,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 0);
-        snprintf (fnvy,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 1);
-        snprintf (fnvz,256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + 2);
-        snprintf (fnm, 256, "___ic_temp_%05d.bin", 100 * id_dm_mass);
+        music::temp_storage::get_filename(fnx, 256, 100 * id_dm_pos + 0);
+        music::temp_storage::get_filename(fny, 256, 100 * id_dm_pos + 1);
+        music::temp_storage::get_filename(fnz, 256, 100 * id_dm_pos + 2);
+        music::temp_storage::get_filename(fnvx, 256, 100 * id_dm_vel + 0);
+        music::temp_storage::get_filename(fnvy, 256, 100 * id_dm_vel + 1);
+        music::temp_storage::get_filename(fnvz, 256, 100 * id_dm_vel + 2);
+        music::temp_storage::get_filename(fnm, 256, 100 * id_dm_mass);
 
-        snprintf (fnbx, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 0);
-        snprintf (fnby, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 1);
-        snprintf (fnbz, 256, "___ic_temp_%05d.bin", 100 * id_gas_pos + 2);
-        snprintf (fnbvx,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 0);
-        snprintf (fnbvy,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 1);
-        snprintf (fnbvz,256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + 2);
-        snprintf (fnbm, 256, "___ic_temp_%05d.bin", 100 * id_gas_mass);
+        music::temp_storage::get_filename(fnbx, 256, 100 * id_gas_pos + 0);
+        music::temp_storage::get_filename(fnby, 256, 100 * id_gas_pos + 1);
+        music::temp_storage::get_filename(fnbz, 256, 100 * id_gas_pos + 2);
+        music::temp_storage::get_filename(fnbvx, 256, 100 * id_gas_vel + 0);
+        music::temp_storage::get_filename(fnbvy, 256, 100 * id_gas_vel + 1);
+        music::temp_storage::get_filename(fnbvz, 256, 100 * id_gas_vel + 2);
+        music::temp_storage::get_filename(fnbm, 256, 100 * id_gas_mass);
 
 
         pistream ifs_x, ifs_y, ifs_z, ifs_vx, ifs_vy, ifs_vz, ifs_m;
@@ -716,7 +716,7 @@ public:
         temp_dat.reserve (block_buf_size_);
 
         char temp_fname[256];
-        snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_mass);
+        music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_mass);
         std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
 
 
@@ -801,7 +801,7 @@ public:
             temp_dat.reserve (block_buf_size_);
 
             char temp_fname[256];
-            snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_gas_mass);
+            music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_mass);
             ofs_temp.open (temp_fname, std::ios::binary | std::ios::trunc);
 
 
@@ -950,7 +950,7 @@ public:
 
 
         char temp_fname[256];
-        snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_pos + coord);
+        music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_pos + coord);
         std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
 
         size_t blksize = sizeof (T_store) * nptot;
@@ -1063,7 +1063,7 @@ public:
         double vfac = 2.894405 / (100.0 * astart_);
 
         char temp_fname[256];
-        snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_dm_vel + coord);
+        music::temp_storage::get_filename(temp_fname, 256, 100 * id_dm_vel + coord);
         std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
 
         size_t blksize = sizeof (T_store) * nptot;
@@ -1174,7 +1174,7 @@ public:
         double vfac = 2.894405 / (100.0 * astart_);
 
         char temp_fname[256];
-        snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_gas_vel + coord);
+        music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_vel + coord);
         std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
 
         size_t blksize = sizeof (T_store) * npart;
@@ -1268,7 +1268,7 @@ public:
 
 
         char temp_fname[256];
-        snprintf(temp_fname, 256,  "___ic_temp_%05d.bin", 100 * id_gas_pos + coord);
+        music::temp_storage::get_filename(temp_fname, 256, 100 * id_gas_pos + coord);
         std::ofstream ofs_temp (temp_fname, std::ios::binary | std::ios::trunc);
 
         size_t blksize = sizeof (T_store) * npart;
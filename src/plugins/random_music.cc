@@ -1,5 +1,6 @@
 #include "random.hh"
 #include "random_music_wnoise_generator.hh"
+#include "file_writer.hh"
 
 typedef music_wnoise_generator<real_t> rng;
 
@@ -226,10 +227,10 @@ void RNG_music::compute_random_numbers(void)
     int lfac = 1 << (ilevel - levelmin_poisson);
 
     std::array<int,3> margin;
-    if( prefh_->get_margin()>0 ){
-      margin[0] = prefh_->get_margin();
-      margin[1] = prefh_->get_margin();
-      margin[2] = prefh_->get_margin();
+    if( prefh_->get_margin(ilevel)>0 ){
+      margin[0] = prefh_->get_margin(ilevel);
+      margin[1] = prefh_->get_margin(ilevel);
+      margin[2] = prefh_->get_margin(ilevel);
     }else{
       margin[0] = prefh_->size(ilevel, 0)/2;
       margin[1] = prefh_->size(ilevel, 1)/2;
@@ -286,7 +287,7 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
 
       music::ulog.Print("Storing white noise field for grafic in file \'%s\'...", fname);
 
-      std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+      music::file_writer ofs(fname);
       data.assign(N * N, 0.0);
 
       int blksize = 4 * sizeof(int);
@@ -333,7 +334,7 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
       music::ulog.Print("Storing white noise field for grafic in file \'%s\'...", fname);
       music::dlog.Print("(%d,%d,%d) -- (%d,%d,%d) -- lfac = %d", nx, ny, nz, i0, j0, k0, lfac);
 
-      std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+      music::file_writer ofs(fname);
       data.assign(nx * ny, 0.0);
 
       int blksize = 4 * sizeof(int);
@@ -379,7 +380,7 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
 
       music::ulog.Print("Storing white noise field in file \'%s\'...", fname);
 
-      std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+      music::file_writer ofs(fname);
 
       ofs.write(reinterpret_cast<char *>(&N), sizeof(unsigned));
       ofs.write(reinterpret_cast<char *>(&N), sizeof(unsigned));
@@ -403,10 +404,10 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
       int i0, j0, k0;
 
       std::array<int,3> margin;
-      if( prefh_->get_margin()>0 ){
-        margin[0] = prefh_->get_margin();
-        margin[1] = prefh_->get_margin();
-        margin[2] = prefh_->get_margin();
+      if( prefh_->get_margin(ilevel)>0 ){
+        margin[0] = prefh_->get_margin(ilevel);
+        margin[1] = prefh_->get_margin(ilevel);
+        margin[2] = prefh_->get_margin(ilevel);
       }else{
         margin[0] = prefh_->size(ilevel, 0)/2;
         margin[1] = prefh_->size(ilevel, 1)/2;
@@ -425,7 +426,7 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
 
       music::ulog.Print("Storing white noise field in file \'%s\'...", fname);
 
-      std::ofstream ofs(fname, std::ios::binary | std::ios::trunc);
+      music::file_writer ofs(fname);
 
       ofs.write(reinterpret_cast<char *>(&nx), sizeof(unsigned));
       ofs.write(reinterpret_cast<char *>(&ny), sizeof(unsigned));
@@ -460,10 +461,10 @@ void RNG_music::store_rnd(int ilevel, rng *prng)
     else
     {
       std::array<int,3> margin;
-      if( prefh_->get_margin()>0 ){
-        margin[0] = prefh_->get_margin();
-        margin[1] = prefh_->get_margin();
-        margin[2] = prefh_->get_margin();
+      if( prefh_->get_margin(ilevel)>0 ){
+        margin[0] = prefh_->get_margin(ilevel);
+        margin[1] = prefh_->get_margin(ilevel);
+        margin[2] = prefh_->get_margin(ilevel);
       }else{
         margin[0] = prefh_->size(ilevel, 0)/2;
         margin[1] = prefh_->size(ilevel, 1)/2;
@@ -524,10 +525,10 @@ void RNG_music::fill_grid(int ilevel, DensityGrid<real_t> &A)
     if (nx != (int)A.size(0) || ny != (int)A.size(1) || nz != (int)A.size(2))
     {
       std::array<int,3> margin;
-      if( prefh_->get_margin()>0 ){
-        margin[0] = prefh_->get_margin();
-        margin[1] = prefh_->get_margin();
-        margin[2] = prefh_->get_margin();
+      if( prefh_->get_margin(ilevel)>0 ){
+        margin[0] = prefh_->get_margin(ilevel);
+        margin[1] = prefh_->get_margin(ilevel);
+        margin[2] = prefh_->get_margin(ilevel);
       }else{
         margin[0] = prefh_->size(ilevel, 0)/2;
         margin[1] = prefh_->size(ilevel, 1)/2;
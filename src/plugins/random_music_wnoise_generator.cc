@@ -183,14 +183,27 @@ music_wnoise_generator<T>::music_wnoise_generator(  unsigned res, unsigned cubes
 
   if (zeromean)
   {
+    //... summed in cell order on one thread, so that the field does not depend on the number of threads
     mean = 0.0;
 
-#pragma omp parallel for reduction(+ \
-                                   : mean)
-    for (int i = 0; i < (int)res_; ++i)
-      for (unsigned j = 0; j < res_; ++j)
-        for (unsigned k = 0; k < res_; ++k)
-          mean += (*this)(i, j, k);
+    if (res_ == ncubes_ * cubesize_)
+    {
+      for (int i = 0; i < (int)res_; ++i)
+        for (unsigned j = 0; j < res_; ++j)
+          for (unsigned kc = 0; kc < ncubes_; ++kc)
+          {
+            const T *row = &(*this)(i, j, kc * cubesize_);
+            for (unsigned k = 0; k < cubesize_; ++k)
+              mean += row[k];
+          }
+    }
+    else
+    {
+      for (int i = 0; i < (int)res_; ++i)
+        for (unsigned j = 0; j < res_; ++j)
+          for (unsigned k = 0; k < res_; ++k)
+            mean += (*this)(i, j, k);
+    }
 
     mean *= 1.0 / (double)(res_l * res_l * res_l);
 
@@ -823,8 +836,6 @@ double music_wnoise_generator<T>::fill_subvolume(int *i0, int *n)
   music::dlog.Print("filling cubes %d,%d,%d ..+ %d,%d,%d", i0cube[0], i0cube[1], i0cube[2], ncube[0], ncube[1], ncube[2]);
 #endif
 
-  double mean = 0.0;
-
   for (int i = i0cube[0]; i < i0cube[0] + ncube[0]; ++i)
     for (int j = i0cube[1]; j < i0cube[1] + ncube[1]; ++j)
       for (int k = i0cube[2]; k < i0cube[2] + ncube[2]; ++k)
@@ -838,7 +849,9 @@ double music_wnoise_generator<T>::fill_subvolume(int *i0, int *n)
         register_cube(ii, jj, kk);
       }
 
-  #pragma omp parallel for reduction(+ : mean)
+  std::vector<double> cubemean((size_t)ncube[0] * ncube[1] * ncube[2], 0.0);
+
+  #pragma omp parallel for
   for (int i = i0cube[0]; i < i0cube[0] + ncube[0]; ++i)
     for (int j = i0cube[1]; j < i0cube[1] + ncube[1]; ++j)
       for (int k = i0cube[2]; k < i0cube[2] + ncube[2]; ++k)
@@ -849,16 +862,15 @@ double music_wnoise_generator<T>::fill_subvolume(int *i0, int *n)
         jj = (jj + ncubes_) % ncubes_;
         kk = (kk + ncubes_) % ncubes_;
 
-        mean += fill_cube(ii, jj, kk);
+        cubemean[((size_t)(i - i0cube[0]) * ncube[1] + (j - i0cube[1])) * ncube[2] + (k - i0cube[2])] = fill_cube(ii, jj, kk);
       }
-  return mean / (ncube[0] * ncube[1] * ncube[2]);
+
+  return ordered_sum(cubemean) / (ncube[0] * ncube[1] * ncube[2]);
 }
 
 template <typename T>
 double music_wnoise_generator<T>::fill_all(void)
 {
-  double sum = 0.0;
-
   for (int i = 0; i < (int)ncubes_; ++i)
     for (int j = 0; j < (int)ncubes_; ++j)
       for (int k = 0; k < (int)ncubes_; ++k)
@@ -872,35 +884,16 @@ double music_wnoise_generator<T>::fill_all(void)
         register_cube(ii, jj, kk);
       }
 
-  #pragma omp parallel for reduction(+ : sum)
-  for (int i = 0; i < (int)ncubes_; ++i)
-    for (int j = 0; j < (int)ncubes_; ++j)
-      for (int k = 0; k < (int)ncubes_; ++k)
-      {
-        int ii(i), jj(j), kk(k);
-
-        ii = (ii + ncubes_) % ncubes_;
-        jj = (jj + ncubes_) % ncubes_;
-        kk = (kk + ncubes_) % ncubes_;
+  std::vector<double> cubemean((size_t)ncubes_ * ncubes_ * ncubes_, 0.0);
 
-        sum += fill_cube(ii, jj, kk);
-      }
-
-  //... subtract mean
-  #pragma omp parallel for reduction(+ : sum)
+  #pragma omp parallel for
   for (int i = 0; i < (int)ncubes_; ++i)
     for (int j = 0; j < (int)ncubes_; ++j)
       for (int k = 0; k < (int)ncubes_; ++k)
-      {
-        int ii(i), jj(j), kk(k);
-
-        ii = (ii + ncubes_) % ncubes_;
-        jj = (jj + ncubes_) % ncubes_;
-        kk = (kk + ncubes_) % ncubes_;
-        subtract_from_cube(ii, jj, kk, sum / (ncubes_ * ncubes_ * ncubes_));
-      }
+        cubemean[((size_t)i * ncubes_ + j) * ncubes_ + k] = fill_cube(i, j, k);
 
-  return sum / (ncubes_ * ncubes_ * ncubes_);
+  //... the mean is not subtracted here, callers that need a zero mean field remove it from the full field
+  return ordered_sum(cubemean) / (ncubes_ * ncubes_ * ncubes_);
 }
 
 template <typename T>
@@ -39,6 +39,15 @@ protected:
   //! subtract a constant from an entire cube
   void subtract_from_cube(int i, int j, int k, double val);
 
+  //! sum of per cube values in cube order, the same however the cubes were shared out between threads
+  static double ordered_sum(const std::vector<double> &v)
+  {
+    double sum = 0.0;
+    for (double x : v)
+      sum += x;
+    return sum;
+  }
+
   //! usees the N-GenIC random number generator to set up the top grid
   void gen_topgrid_NGenIC( size_t res, long baseseed );
 
@@ -89,8 +98,6 @@ protected:
   template <class C>
   double fill_all(C &dat)
   {
-    double sum = 0.0;
-
     for (int i = 0; i < (int)ncubes_; ++i)
       for (int j = 0; j < (int)ncubes_; ++j)
         for (int k = 0; k < (int)ncubes_; ++k)
@@ -99,24 +106,19 @@ protected:
           register_cube(ii, jj, kk);
         }
 
-#pragma omp parallel for reduction(+ \
-                                   : sum)
+    std::vector<double> cubemean((size_t)ncubes_ * ncubes_ * ncubes_, 0.0);
+
+#pragma omp parallel for
     for (int i = 0; i < (int)ncubes_; ++i)
       for (int j = 0; j < (int)ncubes_; ++j)
         for (int k = 0; k < (int)ncubes_; ++k)
         {
-          int ii(i), jj(j), kk(k);
-
-          ii = (ii + ncubes_) % ncubes_;
-          jj = (jj + ncubes_) % ncubes_;
-          kk = (kk + ncubes_) % ncubes_;
-
-          sum += fill_cube(ii, jj, kk);
-          copy_cube(ii, jj, kk, dat);
-          free_cube(ii, jj, kk);
+          cubemean[((size_t)i * ncubes_ + j) * ncubes_ + k] = fill_cube(i, j, k);
+          copy_cube(i, j, k, dat);
+          free_cube(i, j, k);
         }
 
-    return sum / (ncubes_ * ncubes_ * ncubes_);
+    return ordered_sum(cubemean) / (ncubes_ * ncubes_ * ncubes_);
   }
 
   //! write the number of allocated random number cubes to stdout
@@ -94,7 +94,6 @@ protected:
   int coordinate_system_shift_[3];
   int ix_abs_[3], ix_per_[3], ix_rel_[3], level_p_, lextra_;
   const refinement_hierarchy *prefh_;
-  std::array<int,3> margins_;
 
   struct panphasia_descriptor
   {
@@ -194,12 +193,6 @@ public:
     levelmin_final_ = pcf_->get_value<unsigned>("setup", "levelmin");
     levelmax_ = prefh_->levelmax();
 
-    if( refh.get_margin() < 0 ){
-      margins_ = {-1,-1,-1};
-    }else{
-      margins_ = { refh.get_margin(), refh.get_margin(), refh.get_margin() };
-    }
-
     clear_panphasia_thread_states();
     music::ilog.Print("PANPHASIA: running with %d threads", num_threads_);
 
@@ -280,12 +273,12 @@ void RNG_panphasia::fill_grid(int level, DensityGrid<real_t> &R)
     }
     else
     {
-      if( margins_[0] < 0 ){
+      if( prefh_->get_margin(level) < 0 ){
         ileft_corner[k] = (ileft[k] - nx[k] / 4 + (1 << level)) % (1 << level); // Isolated
         ileft_corner[k] = (ileft[k] - nx[k] / 4 + (1 << level)) % (1 << level); // Isolated
       }else{
-        ileft_corner[k] = (ileft[k] - margins_[k] + (1 << level)) % (1 << level); // Isolated
-        ileft_corner[k] = (ileft[k] - margins_[k] + (1 << level)) % (1 << level); // Isolated
+        ileft_corner[k] = (ileft[k] - prefh_->get_margin(level) + (1 << level)) % (1 << level); // Isolated
+        ileft_corner[k] = (ileft[k] - prefh_->get_margin(level) + (1 << level)) % (1 << level); // Isolated
       }
     }
     iexpand_left[k] = (ileft_corner[k] % grid_m_ == 0) ? 0 : ileft_corner[k] % grid_m_;
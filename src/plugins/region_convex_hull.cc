@@ -18,6 +18,7 @@
 #include <algorithm>
 
 #include "region_generator.hh"
+#include "output.hh"
 #include "convex_hull.hh"
 #include "point_file_reader.hh"
 
@@ -104,8 +105,8 @@ public:
         
         // conditions should be added here
         {
-            std::string output_plugin = cf.get_value<std::string>("output","format");
-            if( output_plugin == std::string("grafic2") )
+            std::vector<std::string> formats = output_formats(cf);
+            if( std::find(formats.begin(), formats.end(), "grafic2") != formats.end() )
                 do_extra_padding_ = true;
         }
         
@@ -43,6 +43,9 @@ private:
 
   double zstart_, ztarget_, astart_, atarget_, kmax_, kmin_, h_, tnorm_;
 
+  bool bfit_to_grid_;         //!< [cosmology] CLASS_fit_to_grid, tables only as wide and dense as the run needs
+  double tolerance_;          //!< [cosmology] transfer_tolerance, relative interpolation error of the tables
+
   ClassParams pars_;
   std::unique_ptr<ClassEngine> the_ClassEngine_;
   std::ofstream ofs_class_input_;
@@ -54,12 +57,40 @@ private:
     ofs_class_input_ << parameter_name << " = " << parameter_value << std::endl;
   }
 
+  //! estimate of the conformal age in Mpc, to turn a wave number into CLASS' k_min_tau0
+  double conformal_age(void) const
+  {
+    const double Om = cosmo_params_.get("Omega_m"), Or = cosmo_params_.get("Omega_r");
+    const double Ok = cosmo_params_.get("Omega_k"), Ode = cosmo_params_.get("Omega_DE");
+    const double c_over_H0 = 2997.92458 / h_; // Mpc
+
+    //... tau0 = int_0^1 c da / (a^2 H), with a = s^2 so that the integrand stays finite at a = 0
+    const int n = 1000;
+    double tau0 = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+      double s = (i + 0.5) / n, a = s * s;
+      tau0 += 2.0 * s / std::sqrt(Or + Om * a + Ok * a * a + Ode * a * a * a * a) / n;
+    }
+    return tau0 * c_over_H0;
+  }
+
   //! Set up class parameters from MUSIC cosmological parameters
   void init_ClassEngine(void)
   {
     //--- general parameters ------------------------------------------
-    add_class_parameter("z_max_pk", std::max(std::max(zstart_, ztarget_),199.0)); // use 1.2 as safety
-    add_class_parameter("P_k_max_h/Mpc", std::max(2.0,kmax_));
+    if (bfit_to_grid_)
+    {
+      //... only the tables at ztarget and z=0 are ever taken from CLASS
+      add_class_parameter("z_max_pk", std::max(ztarget_, 0.0));
+      add_class_parameter("P_k_max_h/Mpc", kmax_);
+      add_class_parameter("k_min_tau0", kmin_ * h_ * conformal_age());
+    }
+    else
+    {
+      add_class_parameter("z_max_pk", std::max(std::max(zstart_, ztarget_),199.0)); // use 1.2 as safety
+      add_class_parameter("P_k_max_h/Mpc", std::max(2.0,kmax_));
+    }
     add_class_parameter("output", "dTk,vTk");
     add_class_parameter("extra metric transfer functions","yes");
     // add_class_parameter("lensing", "no");
@@ -125,8 +156,24 @@ private:
     add_class_parameter("reio_parametrization", "reio_none");
 
     // precision parameters
-    add_class_parameter("k_per_decade_for_pk", 100);
-    add_class_parameter("k_per_decade_for_bao", 100);
+    if (bfit_to_grid_)
+    {
+      //... cubic splines in log-log have an error of 5/384 h^4 |f''''| for a step h in ln k. The smooth
+      //... part of ln T changes on a scale of ~0.5 in ln k, the BAO wiggles have a period of ~0.2 in ln k
+      //... around k ~ 0.3 h/Mpc and an amplitude of ~5% in ln T
+      const double step_pk = 0.5 * std::pow(384.0 * tolerance_ / 5.0, 0.25);
+      const double step_bao = 0.2 / (2.0 * M_PI) * std::pow(384.0 * tolerance_ / (5.0 * 0.05), 0.25);
+      const int per_decade_pk = std::max(10, (int)std::ceil(std::log(10.0) / step_pk));
+      const int per_decade_bao = std::max(per_decade_pk, (int)std::ceil(std::log(10.0) / step_bao));
+
+      add_class_parameter("k_per_decade_for_pk", per_decade_pk);
+      add_class_parameter("k_per_decade_for_bao", per_decade_bao);
+    }
+    else
+    {
+      add_class_parameter("k_per_decade_for_pk", 100);
+      add_class_parameter("k_per_decade_for_bao", 100);
+    }
     add_class_parameter("compute damping scale", "yes");
     add_class_parameter("tol_perturb_integration", 1.e-8);
     add_class_parameter("tol_background_integration", 1e-9);
@@ -154,7 +201,9 @@ private:
 
     // output parameters, only needed for the control CLASS .ini file that we output
     std::stringstream zlist;
-    if (ztarget_ == zstart_)
+    if (bfit_to_grid_)
+      zlist << ztarget_ << ((ztarget_!=0.0)? ", 0.0" : "");
+    else if (ztarget_ == zstart_)
       zlist << ztarget_ << ((ztarget_!=0.0)? ", 0.0" : "");
     else
       zlist << std::max(ztarget_, zstart_) << ", " << std::min(ztarget_, zstart_) << ", 0.0";
@@ -228,7 +277,19 @@ public:
     double lbox = pcf_->get_value<double>("setup", "boxlength");
     int levelmax = pcf_->get_value<int>("setup", "levelmax");
     double dx = lbox / (1<<levelmax);
-    kmax_ = std::max(20.0, M_PI /dx  * sqrt(3) * 2.0); // 200% of spatial diagonal, or k=20h Mpc-1
+    bfit_to_grid_ = pcf_->get_value_safe<bool>("cosmology", "CLASS_fit_to_grid", false);
+    tolerance_ = pcf_->get_value_safe<double>("cosmology", "transfer_tolerance", 1e-4);
+    if (bfit_to_grid_)
+    {
+      //... from half the fundamental mode of the box (at most 0.01 h/Mpc, which keeps sigma8 exact) to the
+      //... Nyquist frequency of the finest level along the diagonal, with 5% headroom for the spline ends;
+      //... CLASS computes A_s from sigma8 on its own tables, these keep the old k=20h Mpc-1 then
+      kmin_ = std::min(M_PI / lbox, 0.01);
+      kmax_ = std::max((cosmo_params_["A_s"] > 0.0) ? 2.0 : 20.0, 1.05 * M_PI / dx * std::sqrt(3.0));
+      music::ilog << "CLASS: Tables from k = " << kmin_ << " to " << kmax_ << " h Mpc-1, tolerance " << tolerance_ << std::endl;
+    }
+    else
+      kmax_ = std::max(20.0, M_PI /dx  * sqrt(3) * 2.0); // 200% of spatial diagonal, or k=20h Mpc-1
 
     // initialise CLASS and get the normalisation
     this->init_ClassEngine();
@@ -49,6 +49,7 @@ void print_poisson_plugins()
 
 #include <mg_solver.hh>
 #include <fd_schemes.hh>
+#include <fft_sizes.hh>
 
 
 typedef multigrid::solver<stencil_7P, interp_O3_fluxcorr, mg_straight> poisson_solver_O2;
@@ -873,8 +874,10 @@ void poisson_hybrid(T &f, int idir, int order, bool periodic, bool deconvolve_ci
 	if (!periodic)
 	{
 		nxp = nmax + 2 * boundary; 
-		nyp = nmax + 2 * boundary; 
-		nzp = nmax + 2 * boundary; 
+		if (CONFIG::FFT_friendly_sizes)
+			nxp = music::fft_friendly_size(nxp, 2); // only adds zero padding on the right
+		nyp = nxp; 
+		nzp = nxp; 
 		xo = boundary;						 
 		yo = boundary;						 
 		zo = boundary;						 
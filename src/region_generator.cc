@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include "region_generator.hh"
+#include "output.hh"
 
 std::map<std::string, region_generator_plugin_creator *> &
 get_region_generator_plugin_map()
@@ -164,8 +165,8 @@ public:
             // conditions should be added here
             {
                 do_extra_padding_ = false;
-                std::string output_plugin = cf.get_value<std::string>("output", "format");
-                if (output_plugin == std::string("grafic2"))
+                std::vector<std::string> formats = output_formats(cf);
+                if (std::find(formats.begin(), formats.end(), "grafic2") != formats.end())
                     do_extra_padding_ = true;
                 padding_fine_ = 0.0;
                 if (do_extra_padding_)
@@ -0,0 +1,343 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <temp_storage.hh>
+#include <output.hh>
+#include <system_stat.hh>
+#include <logger.hh>
+
+namespace music
+{
+
+bool temp_storage::binitialized_ = false;
+temp_storage::tier temp_storage::tier_ = temp_storage::tier_cwd;
+std::string temp_storage::basedir_ = ".";
+std::string temp_storage::rundir_ = ".";
+bool temp_storage::brundir_created_ = false;
+size_t temp_storage::predicted_size_ = 0;
+std::string temp_storage::mode_ = "auto";
+std::string temp_storage::scratchdir_;
+double temp_storage::ram_fraction_ = 0.25;
+std::vector<std::string> temp_storage::registered_files_;
+thread_local int temp_storage::set_ = 0;
+std::mutex temp_storage::mutex_;
+
+namespace
+{
+
+//! directory of a memory backed file system, if present
+const char *ram_directory = "/dev/shm";
+
+//! fields stored per particle species: mass, 3 positions, 3 velocities (+ spare for plug-in specific fields)
+const size_t temp_fields_per_species = 8;
+
+//... copies of the registered paths for the signal handler, which may only call async-signal-safe
+//... functions: a slot is filled before the count is raised, and the handler only reads the first nsignal_files
+const int max_signal_files = 512;
+const size_t signal_path_length = 320;
+char signal_files[max_signal_files][signal_path_length];
+char signal_rundir[signal_path_length];
+volatile sig_atomic_t nsignal_files = 0;
+volatile sig_atomic_t bsignal_rundir = 0;
+
+//! keep a copy of path for the signal handler, paths that do not fit are only removed at exit
+void register_signal_path(char *slot, const std::string &path, volatile sig_atomic_t &flag, sig_atomic_t value)
+{
+	if (path.size() >= signal_path_length)
+		return;
+	memcpy(slot, path.c_str(), path.size() + 1);
+	std::atomic_signal_fence(std::memory_order_release);
+	flag = value;
+}
+
+bool is_writable_directory(const std::string &dir)
+{
+	struct stat st;
+	if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+		return false;
+	return access(dir.c_str(), W_OK | X_OK) == 0;
+}
+
+size_t free_space(const std::string &dir)
+{
+	struct statvfs sv;
+	if (statvfs(dir.c_str(), &sv) != 0)
+		return 0;
+	return (size_t)sv.f_bavail * (size_t)sv.f_frsize;
+}
+
+} // namespace
+
+size_t temp_storage::predict_size(config_file &cf)
+{
+	unsigned levelmin = cf.get_value<unsigned>("setup", "levelmin");
+	unsigned levelmax = cf.get_value<unsigned>("setup", "levelmax");
+	bool bbaryons = cf.get_value_safe<bool>("setup", "baryons", false);
+
+	//... count leaf cells: each level minus the cells covered by the next finer level
+	size_t nleaf = 0;
+	char str[128];
+	for (unsigned ilevel = levelmin; ilevel <= levelmax; ++ilevel)
+	{
+		size_t ncells = 1;
+		for (int j = 0; j < 3; ++j)
+		{
+			snprintf(str, 128, "size(%u,%d)", ilevel, j);
+			ncells *= cf.get_value_safe<size_t>("setup", str, 1ul << ilevel);
+		}
+		nleaf += ncells;
+		if (ilevel > levelmin)
+			nleaf -= ncells / 8;
+	}
+
+	size_t nspecies = bbaryons ? 2 : 1;
+	size_t nsets = num_outputs(cf) * output_formats(cf).size();
+	return nleaf * nspecies * nsets * temp_fields_per_species * sizeof(double);
+}
+
+void temp_storage::init(config_file &cf)
+{
+	if (binitialized_)
+		return;
+
+	mode_ = cf.get_value_safe<std::string>("output", "temp_storage", "auto");
+	scratchdir_ = cf.get_value_safe<std::string>("output", "temp_dir", "");
+	ram_fraction_ = cf.get_value_safe<double>("output", "temp_ram_fraction", 0.25);
+
+	if (scratchdir_.empty() && getenv("TMPDIR") != nullptr)
+		scratchdir_ = getenv("TMPDIR");
+
+	//... an explicitly requested tier has to exist, this is checked right away
+	if (mode_ == "ram" && !is_writable_directory(ram_directory))
+	{
+		music::elog.Print("temp_storage = ram, but \'%s\' is not available.", ram_directory);
+		throw std::runtime_error("Memory backed temporary storage not available");
+	}
+	else if (mode_ == "scratch" && (scratchdir_.empty() || !is_writable_directory(scratchdir_)))
+	{
+		music::elog.Print("temp_storage = scratch, but temp_dir \'%s\' is not a writable directory.", scratchdir_.c_str());
+		throw std::runtime_error("Scratch directory for temporary storage not available");
+	}
+	else if (mode_ != "auto" && mode_ != "ram" && mode_ != "scratch" && mode_ != "cwd")
+	{
+		music::elog.Print("Unknown temp_storage \'%s\'. Use one of auto, ram, scratch, cwd.", mode_.c_str());
+		throw std::runtime_error("Unknown temp_storage mode");
+	}
+
+	predicted_size_ = predict_size(cf);
+
+	install_cleanup_handlers();
+	binitialized_ = true;
+}
+
+void temp_storage::choose_tier(void)
+{
+	//... done when the first file is handed out: the plug-ins are created before the density and potential
+	//... grids are allocated, only now the available memory tells what is left for a memory backed tier
+	SystemStat::Memory mem;
+	bool ram_ok = is_writable_directory(ram_directory) && (double)predicted_size_ < ram_fraction_ * (double)mem.get_AvailMem();
+	bool scratch_ok = !scratchdir_.empty() && is_writable_directory(scratchdir_) && predicted_size_ < free_space(scratchdir_);
+
+	if (mode_ == "auto")
+	{
+		if (ram_ok)
+			tier_ = tier_ram;
+		else if (scratch_ok)
+			tier_ = tier_scratch;
+		else
+			tier_ = tier_cwd;
+	}
+	else if (mode_ == "ram")
+	{
+		if (!ram_ok)
+			music::wlog.Print("Temporary files (%.1f Mb) may not fit into available memory.", (double)predicted_size_ / 1024. / 1024.);
+		tier_ = tier_ram;
+	}
+	else if (mode_ == "scratch")
+		tier_ = tier_scratch;
+	else
+		tier_ = tier_cwd;
+
+	if (tier_ == tier_ram)
+		basedir_ = ram_directory;
+	else if (tier_ == tier_scratch)
+		basedir_ = scratchdir_;
+	else
+		basedir_ = ".";
+
+	//... an absolute path, the files have to be found again if the working directory changes
+	char *absdir = realpath(basedir_.c_str(), NULL);
+	if (absdir != NULL)
+	{
+		basedir_ = absdir;
+		free(absdir);
+	}
+
+	char hostname[64] = "localhost";
+	gethostname(hostname, sizeof(hostname) - 1);
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	char dirname[256];
+	snprintf(dirname, 256, "%s/___ic_temp_%s_%d", basedir_.c_str(), hostname, (int)getpid());
+	rundir_ = dirname;
+}
+
+void temp_storage::create_rundir(void)
+{
+	if (brundir_created_)
+		return;
+
+	choose_tier();
+
+	if (mkdir(rundir_.c_str(), 0700) != 0 && errno != EEXIST)
+	{
+		music::elog.Print("Could not create temporary directory \'%s\': %s", rundir_.c_str(), strerror(errno));
+		throw std::runtime_error("Could not create temporary directory");
+	}
+	brundir_created_ = true;
+	register_signal_path(signal_rundir, rundir_, bsignal_rundir, 1);
+
+	music::ilog.Print("Temporary particle storage : %s (\'%s\', predicted %.1f Mb)", tier_name().c_str(), rundir_.c_str(), (double)predicted_size_ / 1024. / 1024.);
+}
+
+void temp_storage::get_filename(char *fname, size_t len, int id)
+{
+	if (!binitialized_)
+	{
+		//... not initialized by an output plug-in, behave as before
+		if (set_ == 0)
+			snprintf(fname, len, "___ic_temp_%05d.bin", id);
+		else
+			snprintf(fname, len, "___ic_temp_%05d_%d.bin", id, set_);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	create_rundir();
+	if (set_ == 0)
+		snprintf(fname, len, "%s/___ic_temp_%05d.bin", rundir_.c_str(), id);
+	else
+		snprintf(fname, len, "%s/___ic_temp_%05d_%d.bin", rundir_.c_str(), id, set_);
+
+	std::string sfname(fname);
+	for (auto &f : registered_files_)
+		if (f == sfname)
+			return;
+	registered_files_.push_back(sfname);
+	if (nsignal_files < max_signal_files)
+		register_signal_path(signal_files[nsignal_files], sfname, nsignal_files, nsignal_files + 1);
+}
+
+void temp_storage::select_set(int iset)
+{
+	set_ = iset;
+}
+
+int temp_storage::selected_set(void)
+{
+	return set_;
+}
+
+void temp_storage::cleanup(void)
+{
+	for (auto &f : registered_files_)
+		unlink(f.c_str());
+
+	if (brundir_created_)
+	{
+		rmdir(rundir_.c_str());
+		brundir_created_ = false;
+	}
+}
+
+void temp_storage::reset(void)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	cleanup();
+
+	//... the signal handler must not see the old paths any longer
+	nsignal_files = 0;
+	bsignal_rundir = 0;
+	std::atomic_signal_fence(std::memory_order_release);
+
+	registered_files_.clear();
+	tier_ = tier_cwd;
+	basedir_ = rundir_ = ".";
+	predicted_size_ = 0;
+	binitialized_ = false;
+}
+
+void temp_storage::cleanup_on_signal(int sig)
+{
+	//... only unlink, rmdir, signal and raise here, they are async-signal-safe
+	const int n = nsignal_files;
+	std::atomic_signal_fence(std::memory_order_acquire);
+	for (int i = 0; i < n; ++i)
+		unlink(signal_files[i]);
+	if (bsignal_rundir)
+		rmdir(signal_rundir);
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+void temp_storage::install_cleanup_handlers(void)
+{
+	//... once per process, init is called again after a reset
+	static bool binstalled = false;
+	if (binstalled)
+		return;
+	binstalled = true;
+
+	registered_files_.reserve(256);
+
+	atexit(cleanup);
+
+	//... not on SIGSEGV or SIGBUS, nothing can be relied on after those
+	const int signals[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGABRT};
+	for (int sig : signals)
+		signal(sig, cleanup_on_signal);
+}
+
+std::string temp_storage::tier_name(void)
+{
+	switch (tier_)
+	{
+	case tier_ram:
+		return "ram";
+	case tier_scratch:
+		return "scratch";
+	default:
+		return "cwd";
+	}
+}
+
+} // namespace music
@@ -0,0 +1,108 @@
+// This file is part of MUSIC
+// A software package to generate ICs for cosmological simulations
+// Copyright (C) 2010-2024 by Oliver Hahn
+//
+// monofonIC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// monofonIC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include <config_file.hh>
+
+namespace music
+{
+
+/*!
+ * @class temp_storage
+ * @brief manages the location and lifetime of the temporary particle files
+ *
+ * The particle output plug-ins buffer each field in a temporary file before
+ * assembling the final output. temp_storage decides where these files live:
+ *
+ *   ram     : a per-run directory on a memory backed file system (/dev/shm)
+ *   scratch : a per-run directory below [output] temp_dir (e.g. node-local disk)
+ *   cwd     : a per-run directory in the current working directory
+ *
+ * With [output] temp_storage = auto (default) the first tier that can hold
+ * the predicted size of all temporary files is used. The tier is chosen
+ * when the first file is requested, once the grids have been allocated, so
+ * that the available memory reflects what the run leaves for tmpfs. File names contain the
+ * host name and process id so that concurrent runs do not collide. All files
+ * handed out are removed on normal exit and when the code is terminated by
+ * a signal.
+ */
+class temp_storage
+{
+public:
+	enum tier
+	{
+		tier_ram,
+		tier_scratch,
+		tier_cwd
+	};
+
+protected:
+	static bool binitialized_;
+	static tier tier_;
+	static std::string basedir_;
+	static std::string rundir_;
+	static bool brundir_created_;
+	static size_t predicted_size_;
+	static std::string mode_;				//!< [output] temp_storage
+	static std::string scratchdir_;	//!< [output] temp_dir or $TMPDIR
+	static double ram_fraction_;		//!< [output] temp_ram_fraction
+	static std::vector<std::string> registered_files_;
+	static thread_local int set_;
+	static std::mutex mutex_;
+
+	static void create_rundir(void);
+
+	//! pick the tier by the memory and disk space available when the first file is handed out
+	static void choose_tier(void);
+
+	static void install_cleanup_handlers(void);
+
+	static void cleanup_on_signal(int sig);
+
+public:
+	//! read the temporary storage settings of this run, needs the grid structure stored in cf
+	static void init(config_file &cf);
+
+	//! predicted size in bytes of all temporary particle files for the grid structure in cf
+	static size_t predict_size(config_file &cf);
+
+	//! write the path of temporary file number id into fname (same calling convention as snprintf)
+	static void get_filename(char *fname, size_t len, int id);
+
+	//! select the set of temporary files handed out by this thread, 0 for the output of the run, 1,2,... for its output sets
+	/*! all instances of an output plug-in number their files the same way, the set keeps them apart */
+	static void select_set(int iset);
+
+	//! the set selected by this thread
+	static int selected_set(void);
+
+	//! remove all temporary files and the per-run directory
+	static void cleanup(void);
+
+	//! clean up and forget the settings, so that the next run (e.g. the next job of a server) calls init again
+	static void reset(void);
+
+	//! name of the selected tier
+	static std::string tier_name(void);
+};
+
+} // namespace music
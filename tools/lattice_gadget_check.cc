@@ -0,0 +1,176 @@
+/*
+
+ lattice_gadget_check.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ Consistency check of the reference decoder tools/lattice_ic_reader.hh
+ against the Gadget-2 output of the same run. Run MUSIC twice with the
+ same parameter file, once with format = lattice and once with
+ format = gadget2 (one file, default particle order), or once with
+ format = multi and formats = lattice, gadget2. Then
+
+	c++ -std=c++11 -O2 -o lattice_gadget_check lattice_gadget_check.cc
+	lattice_gadget_check ics.lat ics_gadget.dat
+
+ compares the positions of the dark matter (type 1) and, if present, the
+ gas particles (type 0) of the finest level. Both have to agree to within
+ the quantisation error the lattice file reports, apart from the float
+ precision of the Gadget file. The exit code is non-zero if they do not.
+
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lattice_ic_reader.hh"
+
+//... the leading part of the Gadget-1 header, up to the box length
+struct gadget_header
+{
+	uint32_t npart[6];
+	double mass[6];
+	double time;
+	double redshift;
+	int32_t flag_sfr;
+	int32_t flag_feedback;
+	uint32_t npartTotal[6];
+	int32_t flag_cooling;
+	int32_t num_files;
+	double BoxSize;
+};
+
+//! positions of particle types 0 and 1 in units of the box, from a single Gadget-1 format file
+static void read_gadget_positions(const std::string &fname, std::vector<double> pos[2], gadget_header &head)
+{
+	std::ifstream ifs(fname.c_str(), std::ios::binary);
+	if (!ifs.good())
+		throw std::runtime_error("could not open Gadget file " + fname);
+
+	int32_t blksz = 0;
+	char hbuf[256];
+	ifs.read(reinterpret_cast<char *>(&blksz), sizeof(int32_t));
+	ifs.read(hbuf, 256);
+	ifs.read(reinterpret_cast<char *>(&blksz), sizeof(int32_t));
+	std::copy(hbuf, hbuf + sizeof(gadget_header), reinterpret_cast<char *>(&head));
+	if (!ifs.good() || blksz != 256)
+		throw std::runtime_error(fname + " is not a Gadget-1 format file");
+	if (head.num_files > 1)
+		throw std::runtime_error(fname + " is split into several files, write one file (gadget_num_files = 1)");
+
+	size_t ntot = 0;
+	for (int i = 0; i < 6; ++i)
+		ntot += head.npart[i];
+
+	ifs.read(reinterpret_cast<char *>(&blksz), sizeof(int32_t));
+	const size_t bytes_per_value = (size_t)blksz / (3 * ntot);
+	if (bytes_per_value != sizeof(float) && bytes_per_value != sizeof(double))
+		throw std::runtime_error(fname + " : unexpected size of the position block");
+
+	for (int itype = 0; itype < 2; ++itype)
+	{
+		pos[itype].resize(3 * (size_t)head.npart[itype]);
+		for (size_t i = 0; i < pos[itype].size(); ++i)
+		{
+			if (bytes_per_value == sizeof(float))
+			{
+				float v;
+				ifs.read(reinterpret_cast<char *>(&v), sizeof(float));
+				pos[itype][i] = v / head.BoxSize;
+			}
+			else
+			{
+				double v;
+				ifs.read(reinterpret_cast<char *>(&v), sizeof(double));
+				pos[itype][i] = v / head.BoxSize;
+			}
+		}
+	}
+	if (!ifs.good())
+		throw std::runtime_error(fname + " : unexpected end of file");
+}
+
+//! largest periodic distance in units of the box between the finest level particles of both files
+static double compare(const lattice_ic_reader &lat, int field0, const std::vector<double> &gpos, const char *what)
+{
+	std::vector<double> x[3];
+	if (field0 == lattice_ic_reader::field_dm_dx)
+		lat.get_dm_positions(x[0], x[1], x[2]);
+	else
+		lat.get_gas_positions(x[0], x[1], x[2]);
+
+	//... the finest level comes last in the lattice file
+	const size_t nfine = lat.levels().back().npart;
+	const size_t ip0 = lat.num_particles() - nfine;
+	if (gpos.size() != 3 * nfine)
+		throw std::runtime_error(std::string("different number of finest level ") + what + " particles");
+
+	const double L = lat.header().boxlength;
+	double dmax = 0.0;
+	for (size_t ip = 0; ip < nfine; ++ip)
+		for (int idim = 0; idim < 3; ++idim)
+		{
+			double d = fabs(x[idim][ip0 + ip] / L - gpos[3 * ip + idim]);
+			d = std::min(d, fabs(1.0 - d));
+			dmax = std::max(dmax, d);
+		}
+	return dmax;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <lattice file> <gadget file>\n", argv[0]);
+		return 2;
+	}
+
+	try
+	{
+		lattice_ic_reader lat(argv[1]);
+		gadget_header head;
+		std::vector<double> gpos[2];
+		read_gadget_positions(argv[2], gpos, head);
+
+		const double hfine = 1.0 / (double)(1ull << lat.header().levelmax);
+		bool ok = true;
+
+		const int fields[2] = {lattice_ic_reader::field_gas_dx, lattice_ic_reader::field_dm_dx};
+		const char *names[2] = {"gas", "dark matter"};
+		for (int itype = 1; itype >= 0; --itype)
+		{
+			if (itype == 0 && (head.npart[0] == 0 || !lat.has_field(fields[0])))
+				continue;
+
+			//... quantisation error in cells of the finest level, float rounding of the Gadget positions
+			float maxerr = 0.0f, err;
+			std::vector<float> values;
+			for (int idim = 0; idim < 3; ++idim)
+			{
+				lat.read_field(fields[itype] + idim, values, &err);
+				maxerr = std::max(maxerr, err);
+			}
+			const double tolerance = maxerr * hfine + 4e-7;
+
+			double dmax = compare(lat, fields[itype], gpos[itype], names[itype]);
+			printf("%-12s : max. deviation %g of the box (%g cells), tolerance %g\n", names[itype], dmax, dmax / hfine, tolerance);
+			ok = ok && dmax <= tolerance;
+		}
+
+		printf("%s\n", ok ? "lattice and Gadget positions agree" : "lattice and Gadget positions DIFFER");
+		return ok ? 0 : 1;
+	}
+	catch (std::exception &e)
+	{
+		fprintf(stderr, "error: %s\n", e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,280 @@
+/*
+
+ lattice_ic_reader.hh - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ Reference decoder for the compact lattice output format written by the
+ 'lattice' output plug-in (src/plugins/output_lattice.cc). Header-only,
+ depends on the C++ standard library only, so that it can be dropped into
+ simulation codes.
+
+ Usage:
+
+	lattice_ic_reader ics("ics.lat");
+	std::vector<double> x, y, z;
+	std::vector<float> vx, vy, vz;
+	ics.get_dm_positions(x, y, z);    // in Mpc/h, periodically wrapped
+	ics.get_dm_velocities(vx, vy, vz); // peculiar velocities in km/s
+	double m = ics.particle_mass(ip);   // in 1e10 Msol/h, total matter
+
+ Particles are ordered by level (levelmin first) and within each level in
+ row-major (i,j,k) order of the leaf cells. Baryon fields (if present) use
+ the same order; with baryons the dark matter particle mass is the total
+ matter mass times (Omega_m-Omega_b)/Omega_m.
+
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+class lattice_ic_reader
+{
+public:
+	enum fields
+	{
+		field_dm_dx = 0,
+		field_dm_dy,
+		field_dm_dz,
+		field_dm_vx,
+		field_dm_vy,
+		field_dm_vz,
+		field_gas_dx,
+		field_gas_dy,
+		field_gas_dz,
+		field_gas_vx,
+		field_gas_vy,
+		field_gas_vz
+	};
+
+	struct file_header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t levelmin, levelmax;
+		uint32_t block_size;
+		double boxlength; //!< in Mpc/h
+		double astart;
+		double omega_m, omega_b, H0;
+		uint32_t has_baryons;
+		uint32_t reserved;
+		double gas_shift; //!< offset of the baryon lattice along each axis in units of the box (version 2)
+	};
+
+	struct level_header
+	{
+		int32_t level;
+		int32_t offset[3]; //!< absolute offset in cells of this level
+		uint32_t size[3];
+		uint32_t reserved;
+		uint64_t npart;
+		double mass; //!< total matter particle mass in 1e10 Msol/h
+	};
+
+	struct section_header
+	{
+		uint32_t field;
+		uint32_t reserved;
+		uint64_t nbytes;
+	};
+
+protected:
+	std::string fname_;
+	file_header header_;
+	std::vector<level_header> levels_;
+	std::vector<std::vector<uint8_t>> bitmaps_;
+	std::map<uint32_t, std::streamoff> sections_;
+	uint64_t npart_;
+
+	template <typename T>
+	static void read_raw(std::ifstream &ifs, T *data, size_t n = 1)
+	{
+		ifs.read(reinterpret_cast<char *>(data), n * sizeof(T));
+		if (!ifs.good())
+			throw std::runtime_error("lattice_ic_reader : unexpected end of file");
+	}
+
+	//! unperturbed position of the cell centres plus shift in units of the box, for one dimension
+	void get_lattice(int idim, double shift, std::vector<double> &q) const
+	{
+		q.clear();
+		q.reserve(npart_);
+		for (size_t il = 0; il < levels_.size(); ++il)
+		{
+			const level_header &lh = levels_[il];
+			double h = 1.0 / (double)(1ull << lh.level);
+			size_t idx = 0;
+			for (uint32_t i = 0; i < lh.size[0]; ++i)
+				for (uint32_t j = 0; j < lh.size[1]; ++j)
+					for (uint32_t k = 0; k < lh.size[2]; ++k, ++idx)
+						if (bitmaps_[il][idx / 8] & (1u << (idx % 8)))
+						{
+							uint32_t ijk[3] = {i, j, k};
+							q.push_back(h * ((double)lh.offset[idim] + (double)ijk[idim] + 0.5) + shift);
+						}
+		}
+	}
+
+	void get_positions(int field0, std::vector<double> &x, std::vector<double> &y, std::vector<double> &z) const
+	{
+		std::vector<double> *xyz[3] = {&x, &y, &z};
+		std::vector<double> q;
+		std::vector<float> dx;
+
+		//... the baryon lattice is shifted by half a cell of the finest level
+		const double shift = (field0 == field_gas_dx) ? header_.gas_shift : 0.0;
+
+		for (int idim = 0; idim < 3; ++idim)
+		{
+			get_lattice(idim, shift, q);
+			read_field(field0 + idim, dx);
+
+			//... displacements are in units of the cell size of each level
+			std::vector<double> &p = *xyz[idim];
+			p.resize(npart_);
+			size_t ip = 0;
+			for (auto &lh : levels_)
+			{
+				double h = 1.0 / (double)(1ull << lh.level);
+				for (uint64_t n = 0; n < lh.npart; ++n, ++ip)
+				{
+					double xp = q[ip] + dx[ip] * h;
+					xp = xp - floor(xp);
+					p[ip] = xp * header_.boxlength;
+				}
+			}
+		}
+	}
+
+public:
+	explicit lattice_ic_reader(const std::string &fname)
+			: fname_(fname), npart_(0)
+	{
+		std::ifstream ifs(fname.c_str(), std::ios::binary);
+		if (!ifs.good())
+			throw std::runtime_error("lattice_ic_reader : could not open file " + fname);
+
+		//... version 1 files end the header before gas_shift, their baryons were written without the shift
+		header_.gas_shift = 0.0;
+		read_raw(ifs, reinterpret_cast<char *>(&header_), offsetof(file_header, gas_shift));
+		if (memcmp(header_.magic, "MUSICLAT", 8) != 0 || header_.version < 1 || header_.version > 2)
+			throw std::runtime_error("lattice_ic_reader : " + fname + " is not a MUSIC lattice file (version 1 or 2)");
+		if (header_.version >= 2)
+			read_raw(ifs, &header_.gas_shift);
+
+		for (uint32_t l = header_.levelmin; l <= header_.levelmax; ++l)
+		{
+			level_header lh;
+			read_raw(ifs, &lh);
+			std::vector<uint8_t> bitmap(((size_t)lh.size[0] * lh.size[1] * lh.size[2] + 7) / 8);
+			read_raw(ifs, &bitmap[0], bitmap.size());
+
+			levels_.push_back(lh);
+			bitmaps_.push_back(bitmap);
+			npart_ += lh.npart;
+		}
+
+		//... index the field sections
+		section_header sh;
+		while (ifs.read(reinterpret_cast<char *>(&sh), sizeof(section_header)))
+		{
+			sections_[sh.field] = ifs.tellg();
+			ifs.seekg(sh.nbytes, std::ios::cur);
+		}
+	}
+
+	const file_header &header(void) const { return header_; }
+
+	const std::vector<level_header> &levels(void) const { return levels_; }
+
+	uint64_t num_particles(void) const { return npart_; }
+
+	bool has_field(uint32_t field) const { return sections_.count(field) > 0; }
+
+	//! total matter mass of particle ip in 1e10 Msol/h
+	double particle_mass(uint64_t ip) const
+	{
+		for (auto &lh : levels_)
+		{
+			if (ip < lh.npart)
+				return lh.mass;
+			ip -= lh.npart;
+		}
+		throw std::runtime_error("lattice_ic_reader : particle index out of range");
+	}
+
+	//! decode one field into values (displacements in cells of the particle's level, velocities in km/s)
+	void read_field(uint32_t field, std::vector<float> &values, float *pmaxerr = nullptr) const
+	{
+		auto it = sections_.find(field);
+		if (it == sections_.end())
+			throw std::runtime_error("lattice_ic_reader : field not present in file");
+
+		std::ifstream ifs(fname_.c_str(), std::ios::binary);
+		ifs.seekg(it->second);
+
+		values.resize(npart_);
+		std::vector<int16_t> q(header_.block_size);
+		float maxerr = 0.0f;
+		size_t ip = 0;
+
+		for (auto &lh : levels_)
+		{
+			for (uint64_t i0 = 0; i0 < lh.npart; i0 += header_.block_size)
+			{
+				size_t n = (size_t)std::min<uint64_t>(header_.block_size, lh.npart - i0);
+				float scale, err;
+				read_raw(ifs, &scale);
+				read_raw(ifs, &err);
+				read_raw(ifs, &q[0], n);
+
+				for (size_t i = 0; i < n; ++i)
+					values[ip++] = q[i] * scale;
+				maxerr = std::max(maxerr, err);
+			}
+		}
+
+		if (pmaxerr != nullptr)
+			*pmaxerr = maxerr;
+	}
+
+	//! dark matter positions in Mpc/h, wrapped into the box
+	void get_dm_positions(std::vector<double> &x, std::vector<double> &y, std::vector<double> &z) const
+	{
+		get_positions(field_dm_dx, x, y, z);
+	}
+
+	//! baryon positions in Mpc/h, wrapped into the box
+	void get_gas_positions(std::vector<double> &x, std::vector<double> &y, std::vector<double> &z) const
+	{
+		get_positions(field_gas_dx, x, y, z);
+	}
+
+	//! dark matter peculiar velocities in km/s
+	void get_dm_velocities(std::vector<float> &vx, std::vector<float> &vy, std::vector<float> &vz) const
+	{
+		read_field(field_dm_vx, vx);
+		read_field(field_dm_vy, vy);
+		read_field(field_dm_vz, vz);
+	}
+
+	//! baryon peculiar velocities in km/s
+	void get_gas_velocities(std::vector<float> &vx, std::vector<float> &vy, std::vector<float> &vz) const
+	{
+		read_field(field_gas_vx, vx);
+		read_field(field_gas_vy, vy);
+		read_field(field_gas_vz, vz);
+	}
+};
@@ -0,0 +1,249 @@
+/*
+
+ stream_ic_receiver.cc - This file is part of MUSIC -
+ a code to generate multi-scale initial conditions
+ for cosmological simulations
+
+ Copyright (C) 2010-2024  Oliver Hahn
+
+ Reference receiver for the 'stream' output plug-in
+ (src/plugins/output_stream.cc). It listens on a Unix domain socket or reads
+ a named pipe, checks the framing and prints a summary of what arrived. It
+ depends on the C++ standard library and POSIX only:
+
+	c++ -std=c++11 -O2 -o stream_ic_receiver stream_ic_receiver.cc
+
+ Usage:
+
+	stream_ic_receiver unix:/tmp/music.sock [delay_ms]   # then run MUSIC with
+	                                                       # filename = unix:/tmp/music.sock
+	stream_ic_receiver /tmp/music.fifo [delay_ms]         # filename = /tmp/music.fifo
+
+ delay_ms sleeps after every block to simulate a slow consumer, MUSIC is
+ then throttled by the full socket/pipe buffer.
+
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//... frame layout, has to match src/plugins/output_stream.cc
+enum frame_kind
+{
+	frame_begin = 1,
+	frame_block = 2,
+	frame_end = 3
+};
+
+struct frame_header
+{
+	char magic[4];
+	uint32_t kind;
+	uint32_t field;
+	uint32_t ptype;
+	uint32_t component;
+	uint32_t elem_size;
+	uint64_t first;
+	uint64_t count;
+};
+
+struct stream_header
+{
+	uint64_t npart[6];
+	double mass[6];
+	double time, redshift, boxsize;
+	double omega0, omegalambda, hubbleparam;
+	uint32_t levelmin, levelmax;
+};
+
+static const char *field_names[] = {"?", "pos", "vel", "mass"};
+
+//! read exactly n bytes, returns false on end of stream before the first byte
+static bool read_raw(int fd, void *data, size_t n)
+{
+	char *p = reinterpret_cast<char *>(data);
+	size_t nread = 0;
+	while (nread < n)
+	{
+		ssize_t nr = ::read(fd, p + nread, n - nread);
+		if (nr < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("read failed: ") + strerror(errno));
+		}
+		if (nr == 0)
+		{
+			if (nread == 0)
+				return false;
+			throw std::runtime_error("stream ended in the middle of a frame");
+		}
+		nread += nr;
+	}
+	return true;
+}
+
+static int accept_socket(const std::string &path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("socket path too long");
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path.c_str());
+	if (lfd < 0 || bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(lfd, 1) != 0)
+		throw std::runtime_error("could not listen on " + path + ": " + strerror(errno));
+
+	fprintf(stderr, "listening on %s\n", path.c_str());
+	int fd = accept(lfd, NULL, NULL);
+	close(lfd);
+	unlink(path.c_str());
+	if (fd < 0)
+		throw std::runtime_error(std::string("accept failed: ") + strerror(errno));
+	return fd;
+}
+
+static int open_fifo(const std::string &path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 && mkfifo(path.c_str(), 0600) != 0)
+		throw std::runtime_error("could not create named pipe " + path + ": " + strerror(errno));
+
+	fprintf(stderr, "reading from %s\n", path.c_str());
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("could not open " + path + ": " + strerror(errno));
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s unix:<socket path> | <named pipe> [delay_ms]\n", argv[0]);
+		return 1;
+	}
+
+	std::string target(argv[1]);
+	int delay_ms = (argc > 2) ? atoi(argv[2]) : 0;
+
+	try
+	{
+		int fd = (target.compare(0, 5, "unix:") == 0) ? accept_socket(target.substr(5)) : open_fifo(target);
+
+		auto tstart = std::chrono::steady_clock::now();
+		stream_header sh;
+		bool bheader = false, bend = false;
+		uint64_t nbytes = 0;
+
+		struct field_stats
+		{
+			uint64_t nrecv;
+			float vmin, vmax;
+		};
+		std::map<std::tuple<uint32_t, uint32_t, uint32_t>, field_stats> stats;
+		std::vector<float> buf;
+
+		frame_header fh;
+		while (!bend && read_raw(fd, &fh, sizeof(frame_header)))
+		{
+			nbytes += sizeof(frame_header);
+			if (memcmp(fh.magic, "MSTR", 4) != 0)
+				throw std::runtime_error("bad frame magic, stream out of sync");
+
+			switch (fh.kind)
+			{
+			case frame_begin:
+				if (fh.count != sizeof(stream_header))
+					throw std::runtime_error("unexpected stream header size");
+				read_raw(fd, &sh, sizeof(stream_header));
+				nbytes += sizeof(stream_header);
+				bheader = true;
+				printf("header: z = %g, box = %g Mpc/h, levels %u..%u\n", sh.redshift, sh.boxsize, sh.levelmin, sh.levelmax);
+				for (int i = 0; i < 6; ++i)
+					if (sh.npart[i] > 0)
+						printf("  type %d : %12llu particles [m=%g]\n", i, (unsigned long long)sh.npart[i], sh.mass[i]);
+				break;
+
+			case frame_block:
+			{
+				if (!bheader)
+					throw std::runtime_error("data block before stream header");
+				if (fh.elem_size != sizeof(float) || fh.ptype > 5 || fh.field < 1 || fh.field > 3)
+					throw std::runtime_error("malformed block header");
+
+				auto key = std::make_tuple(fh.field, fh.ptype, fh.component);
+				auto it = stats.find(key);
+				if (it == stats.end())
+					it = stats.insert({key, field_stats{0, 1e30f, -1e30f}}).first;
+				if (fh.first != it->second.nrecv || fh.first + fh.count > sh.npart[fh.ptype])
+					throw std::runtime_error("block out of order or beyond the particle count");
+
+				buf.resize(fh.count);
+				read_raw(fd, &buf[0], fh.count * sizeof(float));
+				nbytes += fh.count * sizeof(float);
+
+				for (float v : buf)
+				{
+					it->second.vmin = std::min(it->second.vmin, v);
+					it->second.vmax = std::max(it->second.vmax, v);
+				}
+				it->second.nrecv += fh.count;
+
+				if (delay_ms > 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+				break;
+			}
+
+			case frame_end:
+				bend = true;
+				break;
+
+			default:
+				throw std::runtime_error("unknown frame kind");
+			}
+		}
+		close(fd);
+
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+
+		bool bcomplete = bend;
+		for (auto &s : stats)
+		{
+			uint32_t field, ptype, comp;
+			std::tie(field, ptype, comp) = s.first;
+			bool bfull = s.second.nrecv == sh.npart[ptype];
+			bcomplete = bcomplete && bfull;
+			printf("  %-4s[%u] type %u : %12llu values in [%g, %g]%s\n", field_names[field], comp, ptype,
+						 (unsigned long long)s.second.nrecv, s.second.vmin, s.second.vmax, bfull ? "" : "  INCOMPLETE");
+		}
+		printf("received %.1f MB in %.2f s%s\n", nbytes / 1048576.0, dt, bend ? "" : ", stream ended without end frame");
+
+		return bcomplete ? 0 : 2;
+	}
+	catch (std::exception &e)
+	{
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+}